@@ -0,0 +1,1795 @@
+/*
+* NAME: Copyright (c) 2020, Biren Patel
+* DESC: throughput floors and fuzzing of the csv parser on adversarial input
+* LISC: MIT License
+*/
+
+#ifdef __linux__
+    #define _GNU_SOURCE
+#endif
+
+#if !defined(CSV_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+    #define BENCH_THREADS
+#endif
+
+#include "csv.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef BENCH_THREADS
+    #include <pthread.h>
+#endif
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+/*******************************************************************************
+Usage: csv_bench [-p] [floor MB/s] [input MiB] [fuzz iterations]
+
+Every case builds one pathological input in memory, parses it through a parser
+context and checks both the expected status and a throughput floor. Because
+the floor is a rate, a case that degrades to quadratic time fails it long
+before it would hang. The fuzz loop then parses short random inputs over the
+structural alphabet with random options and checks the struct csv invariants,
+and random inputs with empty cells are filtered with and without a zone map.
+The push parser is checked against the same reader on random chunkings. With
+thread support a file is also streamed to several consumers of a producer, read
+asynchronously and counted on a pool, and every result is compared with
+csv_read_opts(). Last, random tables go through a columnar file and back, the
+file is damaged at random, and the counting, histogram and rolling kernels are
+checked against plain references, as are packed integer and compressed text
+columns and string cells.
+The exit status is nonzero if any check fails.
+
+With -p, and on Linux only, hardware counters are also collected around
+csv_read_opts(), the column and row conversions and csv_free() on a file, and
+reported per input byte and per cell.
+*/
+
+#define BENCH_FLOOR 10.0
+#define BENCH_MIB 16
+#define BENCH_FUZZ 20000
+#define BENCH_FUZZ_LENGTH 512
+#define BENCH_FUZZ_COLS 8
+#define BENCH_ROLLING 512
+#define BENCH_FILE "csv_bench.tmp"
+
+struct bench_input
+{
+    char *bytes;
+    size_t length;
+    size_t capacity;
+};
+
+struct bench_case
+{
+    const char *name;
+    void (*build)(struct bench_input *input, size_t target);
+    struct csv_options options;
+    csv_errno expect;
+    char pad[4];
+};
+
+static bool bench_write(const struct bench_input *input)
+{
+    FILE *file = fopen(BENCH_FILE, "wb");
+    if (file == NULL) return false;
+    
+    size_t written = fwrite(input->bytes, 1, input->length, file);
+    
+    return fclose(file) == 0 && written == input->length;
+}
+
+static void bench_put(struct bench_input *input, const char *bytes, size_t n)
+{
+    if (input->length + n > input->capacity)
+    {
+        size_t capacity = 2 * (input->length + n);
+        char *grown = realloc(input->bytes, capacity);
+        
+        if (grown == NULL)
+        {
+            fprintf(stderr, "out of memory building input\n");
+            exit(EXIT_FAILURE);
+        }
+        
+        input->bytes = grown;
+        input->capacity = capacity;
+    }
+    
+    memcpy(input->bytes + input->length, bytes, n);
+    input->length += n;
+}
+
+static void bench_puts(struct bench_input *input, const char *text)
+{
+    bench_put(input, text, strlen(text));
+}
+
+/*******************************************************************************
+Input builders. Each one appends roughly target bytes.
+*/
+
+static void build_numeric(struct bench_input *input, size_t target)
+{
+    bench_puts(input, "id,price,delta,scale\n");
+    while (input->length < target) bench_puts(input, "123456,7.25,-42,1e3\n");
+}
+
+static void build_quoted(struct bench_input *input, size_t target)
+{
+    bench_puts(input, "a,b,c\n");
+    while (input->length < target) bench_puts(input, "\"x,y\",\"line\nbreak\",\"he said \"\"hi\"\"\"\n");
+}
+
+static void build_huge_field(struct bench_input *input, size_t target)
+{
+    bench_puts(input, "a\n\"");
+    while (input->length < target) bench_puts(input, "data, with\ncommas\r\n");
+    bench_puts(input, "\"\n");
+}
+
+static void build_escapes(struct bench_input *input, size_t target)
+{
+    bench_puts(input, "a\n\"");
+    while (input->length < target) bench_puts(input, "\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"\"");
+    bench_puts(input, "\"\n");
+}
+
+static void build_wide(struct bench_input *input, size_t target)
+{
+    for (int row = 0; row < 2; row++)
+    {
+        size_t end = input->length + target / 2;
+        
+        while (input->length < end) bench_puts(input, "x,,x,,x,,x,,");
+        bench_puts(input, "x\n");
+    }
+}
+
+static void build_blank(struct bench_input *input, size_t target)
+{
+    bench_puts(input, "a,b\n");
+    while (input->length < target) bench_puts(input, "1,2\n\n\n\n\n\n\n\n\n\n\n\n");
+}
+
+static void build_trailing(struct bench_input *input, size_t target)
+{
+    build_numeric(input, target);
+    bench_puts(input, "\n");
+}
+
+static void build_unbalanced(struct bench_input *input, size_t target)
+{
+    bench_puts(input, "a,b\n\"open");
+    while (input->length < target) bench_puts(input, "x,\"\"y\n");
+}
+
+static void build_ragged(struct bench_input *input, size_t target)
+{
+    while (input->length < target / 2) bench_puts(input, ",,,,,,,,,,,,,,,,");
+    bench_puts(input, "\n");
+    while (input->length < target) bench_puts(input, "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
+}
+
+/******************************************************************************/
+
+static double bench_seconds(clock_t begin, clock_t end)
+{
+    return (double) (end - begin) / CLOCKS_PER_SEC;
+}
+
+static bool bench_run(struct bench_case *c, double floor, size_t target)
+{
+    struct bench_input input = {NULL, 0, 0};
+    csv_errno error = CSV_UNDEFINED;
+    bool pass = true;
+    
+    c->build(&input, target);
+    
+    struct csv_context *context = csv_context_new(&c->options, &error);
+    if (context == NULL) return false;
+    
+    clock_t begin = clock();
+    struct csv *csv = csv_context_read_mem(context, input.bytes, input.length, &error);
+    clock_t end = clock();
+    
+    double seconds = bench_seconds(begin, end);
+    double rate = (double) input.length / 1e6 / (seconds > 0 ? seconds : 1e-9);
+    
+    if (error != c->expect) pass = false;
+    if (rate < floor) pass = false;
+    
+    printf("%-14s %10zu B %8.3f s %9.1f MB/s %10u x %-8u %-4s %s",
+           c->name, input.length, seconds, rate,
+           csv == NULL ? 0 : csv->rows, csv == NULL ? 0 : csv->cols,
+           pass ? "ok" : "FAIL", csv_errno_decode(error));
+    
+    csv_context_free(context);
+    free(input.bytes);
+    
+    return pass;
+}
+
+/*******************************************************************************
+The fuzz inputs are drawn from the bytes that drive the scanner, with the odd
+letter so that unquoted fields are not all empty.
+*/
+
+static uint64_t bench_rand(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    
+    return *state;
+}
+
+static bool bench_check(const struct csv *csv, const struct csv_options *options)
+{
+    if (csv->total != (uint64_t) csv->rows * csv->cols) return false;
+    if (csv->missing >= csv->total) return false;
+    if (options->header == true && csv->header == NULL) return false;
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        if (csv->widths != NULL && csv->widths[i] > csv->cols) return false;
+        
+        for (uint32_t j = 0; j < csv->cols; j++)
+        {
+            if (csv->data[i][j] == NULL) return false;
+        }
+    }
+    
+    return true;
+}
+
+static bool bench_fuzz(uint32_t iterations)
+{
+    static const char alphabet[] = "a,\"\n\r,\"\n";
+    char bytes[BENCH_FUZZ_LENGTH];
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    uint32_t parsed = 0;
+    uint32_t failed = 0;
+    
+    for (uint32_t k = 0; k < iterations; k++)
+    {
+        struct csv_options options = {0};
+        csv_errno error = CSV_UNDEFINED;
+        uint64_t flags = bench_rand(&state);
+        size_t length = (size_t) (bench_rand(&state) % BENCH_FUZZ_LENGTH);
+        
+        options.header = (flags & 1) != 0;
+        options.tolerant = (flags & 2) != 0;
+        options.no_quotes = (flags & 12) == 12;
+        options.ragged = (csv_ragged) ((flags >> 4) & 3);
+        
+        for (size_t i = 0; i < length; i++)
+        {
+            bytes[i] = alphabet[bench_rand(&state) % (sizeof(alphabet) - 1)];
+        }
+        
+        struct csv_context *context = csv_context_new(&options, &error);
+        if (context == NULL) return false;
+        
+        struct csv *csv = csv_context_read_mem(context, bytes, length, &error);
+        
+        if (csv != NULL)
+        {
+            parsed++;
+            
+            if (bench_check(csv, &options) == false)
+            {
+                printf("fuzz iteration %u violates struct csv invariants\n", k);
+                failed++;
+            }
+        }
+        
+        csv_context_free(context);
+    }
+    
+    printf("fuzz           %u inputs, %u parsed, %u failed\n", iterations, parsed, failed);
+    
+    return failed == 0;
+}
+
+/*******************************************************************************
+Zone map differential check. Random two column inputs over a few values, the
+empty cell among them, are filtered with and without a zone map at random
+block sizes. Skipping blocks must never change the selection.
+*/
+
+static bool bench_zonemap(uint32_t iterations)
+{
+    static const char *values[] = {"", "x", "y", "1", "2"};
+    static const char *exprs[] =
+    {
+        "a == ''", "b == ''", "a != ''", "a == 'x'", "b == 'y'", "a == 'z'",
+        "b == 1", "a < 2", "b >= 2", "a == '' and b == 'x'"
+    };
+    
+    uint64_t state = 0xD1B54A32D192ED03ULL;
+    uint32_t failed = 0;
+    
+    for (uint32_t k = 0; k < iterations; k++)
+    {
+        struct bench_input input = {NULL, 0, 0};
+        struct csv_options options = {.header = true};
+        csv_errno error = CSV_UNDEFINED;
+        uint32_t rows = 1 + (uint32_t) (bench_rand(&state) % 16);
+        uint32_t block_rows = 1 + (uint32_t) (bench_rand(&state) % 5);
+        
+        //a file of only missing cells is rejected, so the first cell is never empty
+        bench_puts(&input, "a,b\nx,");
+        bench_puts(&input, values[bench_rand(&state) % 5]);
+        bench_puts(&input, "\n");
+        
+        for (uint32_t i = 1; i < rows; i++)
+        {
+            bench_puts(&input, values[bench_rand(&state) % 5]);
+            bench_puts(&input, ",");
+            bench_puts(&input, values[bench_rand(&state) % 5]);
+            bench_puts(&input, "\n");
+        }
+        
+        struct csv_context *context = csv_context_new(&options, &error);
+        if (context == NULL) return false;
+        
+        struct csv *csv = csv_context_read_mem(context, input.bytes, input.length, &error);
+        uint32_t *scan[sizeof(exprs) / sizeof(exprs[0])];
+        uint32_t n_scan[sizeof(exprs) / sizeof(exprs[0])];
+        const size_t total = csv == NULL ? 0 : sizeof(exprs) / sizeof(exprs[0]);
+        
+        for (size_t e = 0; e < total; e++) scan[e] = csv_filter(csv, exprs[e], &n_scan[e], &error);
+        
+        if (csv != NULL && csv_zonemap_build(csv, block_rows, &error) == false) failed++;
+        
+        for (size_t e = 0; e < total; e++)
+        {
+            uint32_t n_zone = 0;
+            uint32_t *zone = csv_filter(csv, exprs[e], &n_zone, &error);
+            
+            if (scan[e] == NULL || zone == NULL || n_zone != n_scan[e] || memcmp(zone, scan[e], sizeof(uint32_t) * n_zone) != 0)
+            {
+                printf("zone map iteration %u changes the result of %s\n", k, exprs[e]);
+                failed++;
+            }
+            
+            free(scan[e]);
+            free(zone);
+        }
+        
+        if (csv == NULL) failed++;
+        
+        csv_context_free(context);
+        free(input.bytes);
+    }
+    
+    printf("zone map       %u inputs, %u failed\n", iterations, failed);
+    
+    return failed == 0;
+}
+
+/*******************************************************************************
+Push parser differential check. The trailing blank line cases and then random
+inputs from the fuzz alphabet are fed to csv_parser_feed() in random chunks, and
+the status, the records, every field and the number of skipped records must
+match csv_context_read_mem().
+Inputs the reader rejects as only missing cells are not compared.
+*/
+
+struct bench_push
+{
+    const struct csv *csv;
+    uint32_t records;
+    bool differs;
+    char pad[3];
+};
+
+static bool bench_push_record(char **fields, uint32_t n, uint64_t row, void *data)
+{
+    struct bench_push *push = data;
+    const struct csv *csv = push->csv;
+    
+    push->records++;
+    
+    if (csv == NULL || row >= csv->rows || n > csv->cols || (csv->widths == NULL && n != csv->cols))
+    {
+        push->differs = true;
+        return true;
+    }
+    
+    for (uint32_t j = 0; j < n; j++)
+    {
+        if (strcmp(fields[j], csv->data[row][j]) != 0) push->differs = true;
+    }
+    
+    return true;
+}
+
+static bool bench_push(uint32_t iterations)
+{
+    static const char alphabet[] = "a,\"\n\r,\"\n";
+    static const char *trailing[] = {"a,b\n1,2\n3,4\n\n", "a,b\r\n1,2\r\n3,4\r\n\r\n"};
+    const uint32_t fixed = sizeof(trailing) / sizeof(trailing[0]);
+    char bytes[BENCH_FUZZ_LENGTH];
+    uint64_t state = 0xBF58476D1CE4E5B9ULL;
+    uint32_t compared = 0;
+    uint32_t failed = 0;
+    
+    for (uint32_t k = 0; k < fixed + iterations; k++)
+    {
+        struct csv_options options = {0};
+        csv_errno error = CSV_UNDEFINED;
+        uint64_t flags = bench_rand(&state);
+        size_t length = (size_t) (bench_rand(&state) % BENCH_FUZZ_LENGTH);
+        
+        if (k < fixed)
+        {
+            length = strlen(trailing[k]);
+            memcpy(bytes, trailing[k], length);
+        }
+        else
+        {
+            options.header = (flags & 1) != 0;
+            options.tolerant = (flags & 2) != 0;
+            options.no_quotes = (flags & 12) == 12;
+            options.ragged = (csv_ragged) ((flags >> 4) & 3);
+            
+            for (size_t i = 0; i < length; i++)
+            {
+                bytes[i] = alphabet[bench_rand(&state) % (sizeof(alphabet) - 1)];
+            }
+        }
+        
+        struct csv_context *context = csv_context_new(&options, &error);
+        if (context == NULL) return false;
+        
+        struct csv *csv = csv_context_read_mem(context, bytes, length, &error);
+        
+        if (csv == NULL && error == CSV_UNKNOWN_FATAL_ERROR)
+        {
+            csv_context_free(context);
+            continue;
+        }
+        
+        struct bench_push push = {csv, 0, false, {0}};
+        struct csv_parser *parser = csv_parser_new(&options, bench_push_record, &push, &error);
+        bool parsed = parser != NULL;
+        
+        for (size_t at = 0; parsed == true && at < length; )
+        {
+            size_t n = 1 + (size_t) (bench_rand(&state) % 16);
+            if (n > length - at) n = length - at;
+            
+            parsed = csv_parser_feed(parser, bytes + at, n, &error);
+            at += n;
+        }
+        
+        if (parsed == true) parsed = csv_parser_finish(parser, &error);
+        
+        struct csv_parser_stats stats = {0, 0, 0};
+        if (parser != NULL) csv_parser_stats(parser, &stats);
+        
+        if (parsed != (csv != NULL) || (csv != NULL && (push.differs == true || push.records != csv->rows || stats.skipped != csv->quarantined)))
+        {
+            printf("push iteration %u differs from csv_context_read_mem()\n", k);
+            failed++;
+        }
+        
+        compared++;
+        csv_parser_free(parser);
+        csv_context_free(context);
+    }
+    
+    printf("push           %u inputs, %u compared, %u failed\n", fixed + iterations, compared, failed);
+    
+    return failed == 0;
+}
+
+/*******************************************************************************
+Multi consumer check. A numeric file is streamed through a producer to several
+consumer threads at batch sizes and depths that force the rings to wrap and the
+parser to wait on the free list. The consumers must see every record exactly
+once, so the record count and the sum of the record indexes are compared, and
+every field is compared with csv_read_opts(). The same file is then read with
+csv_read_async() on an explicit and on the library pool, and csv_distinct() on
+a pool must agree with the serial count.
+*/
+
+#ifdef BENCH_THREADS
+
+#define BENCH_CONSUMERS 4
+
+struct bench_consumer
+{
+    struct csv_producer *producer;
+    const struct csv *reference;
+    uint64_t records;
+    uint64_t indexes;
+    uint64_t differs;
+    pthread_t tid;
+    csv_errno error;
+    char pad[4];
+};
+
+static void *bench_consume(void *arg)
+{
+    struct bench_consumer *consumer = arg;
+    const struct csv *reference = consumer->reference;
+    struct csv_rows *rows = NULL;
+    
+    while ((rows = csv_consume(consumer->producer, &consumer->error)) != NULL)
+    {
+        for (uint32_t k = 0; k < rows->count; k++)
+        {
+            const uint64_t i = rows->first + k;
+            
+            consumer->records++;
+            consumer->indexes += i;
+            
+            if (i >= reference->rows || rows->cols != reference->cols)
+            {
+                consumer->differs++;
+                continue;
+            }
+            
+            for (uint32_t j = 0; j < rows->cols; j++)
+            {
+                if (strcmp(rows->data[k][j], reference->data[i][j]) != 0) consumer->differs++;
+            }
+        }
+        
+        csv_recycle(consumer->producer, rows);
+    }
+    
+    return NULL;
+}
+
+static bool bench_stream(const struct csv *reference, uint32_t consumers, uint32_t batch_rows, uint32_t depth)
+{
+    struct bench_consumer consumer[BENCH_CONSUMERS];
+    struct csv_options options = {.header = true};
+    csv_errno error = CSV_UNDEFINED;
+    uint64_t records = 0;
+    uint64_t indexes = 0;
+    uint64_t differs = 0;
+    bool pass = true;
+    
+    struct csv_producer *producer = csv_producer_new(&options, batch_rows, depth, &error);
+    if (producer == NULL) return false;
+    
+    for (uint32_t c = 0; c < consumers; c++)
+    {
+        memset(&consumer[c], 0, sizeof(struct bench_consumer));
+        consumer[c].producer = producer;
+        consumer[c].reference = reference;
+        consumer[c].error = CSV_UNDEFINED;
+        
+        if (pthread_create(&consumer[c].tid, NULL, bench_consume, &consumer[c]) != 0)
+        {
+            //without this consumer the stream might never drain
+            csv_producer_cancel(producer);
+            consumers = c;
+            pass = false;
+        }
+    }
+    
+    if (csv_produce(producer, BENCH_FILE, &error) == false) pass = false;
+    
+    for (uint32_t c = 0; c < consumers; c++)
+    {
+        pthread_join(consumer[c].tid, NULL);
+        
+        records += consumer[c].records;
+        indexes += consumer[c].indexes;
+        differs += consumer[c].differs;
+        
+        if (consumer[c].error != CSV_SUCCESS) pass = false;
+    }
+    
+    const uint64_t rows = reference->rows;
+    
+    if (records != rows || indexes != rows * (rows - 1) / 2 || differs != 0) pass = false;
+    
+    printf("producer       %u consumers, %u rows per batch, depth %u, %llu records %s\n",
+           consumers, batch_rows, depth, (unsigned long long) records, pass ? "ok" : "FAIL");
+    
+    csv_producer_free(producer);
+    
+    return pass;
+}
+
+static bool bench_async(const struct csv *reference, struct csv_pool *pool)
+{
+    struct csv_options options = {.header = true, .pool = pool};
+    csv_errno error = CSV_UNDEFINED;
+    struct csv_async *async[BENCH_CONSUMERS];
+    bool pass = true;
+    
+    for (uint32_t k = 0; k < BENCH_CONSUMERS; k++)
+    {
+        async[k] = csv_read_async(BENCH_FILE, &options, NULL, NULL, &error);
+    }
+    
+    for (uint32_t k = 0; k < BENCH_CONSUMERS; k++)
+    {
+        struct csv *csv = async[k] == NULL ? NULL : csv_async_wait(async[k], &error);
+        
+        if (csv == NULL || csv->rows != reference->rows || csv->cols != reference->cols) pass = false;
+        
+        for (uint32_t i = 0; csv != NULL && pass == true && i < csv->rows; i++)
+        {
+            for (uint32_t j = 0; j < csv->cols; j++)
+            {
+                if (strcmp(csv->data[i][j], reference->data[i][j]) != 0) pass = false;
+            }
+        }
+        
+        csv_free(csv);
+    }
+    
+    printf("async          %u reads on the %s pool %s\n", BENCH_CONSUMERS, pool == NULL ? "library" : "given", pass ? "ok" : "FAIL");
+    
+    return pass;
+}
+
+static bool bench_threads(size_t target)
+{
+    struct bench_input input = {NULL, 0, 0};
+    struct csv_pool_options pool_options = {.threads = 3};
+    struct csv_options options = {.header = true};
+    csv_errno error = CSV_UNDEFINED;
+    bool pass = true;
+    
+    build_numeric(&input, target);
+    
+    bool written = bench_write(&input);
+    free(input.bytes);
+    
+    struct csv *reference = written ? csv_read_opts(BENCH_FILE, &options, &error) : NULL;
+    struct csv_pool *pool = csv_pool_new(&pool_options, &error);
+    
+    if (reference == NULL || pool == NULL)
+    {
+        csv_free(reference);
+        csv_pool_free(pool);
+        remove(BENCH_FILE);
+        return false;
+    }
+    
+    if (bench_stream(reference, 1, 1, 1) == false) pass = false;
+    if (bench_stream(reference, 2, 7, 2) == false) pass = false;
+    if (bench_stream(reference, 3, 64, 3) == false) pass = false;
+    if (bench_stream(reference, BENCH_CONSUMERS, 0, 0) == false) pass = false;
+    
+    if (bench_async(reference, pool) == false) pass = false;
+    if (bench_async(reference, NULL) == false) pass = false;
+    
+    for (uint32_t j = 0; j < reference->cols; j++)
+    {
+        uint64_t serial = csv_distinct(reference, j, true, NULL, &error);
+        uint64_t parallel = csv_distinct(reference, j, true, pool, &error);
+        
+        if (serial != parallel)
+        {
+            printf("pool           distinct count of column %u differs\n", j);
+            pass = false;
+        }
+    }
+    
+    csv_pool_free(pool);
+    csv_free(reference);
+    remove(BENCH_FILE);
+    
+    return pass;
+}
+
+#endif
+
+/*******************************************************************************
+Random tables for the columnar and kernel checks. Every column is one of small
+integers, wide integers up to the limits of long, decimals or words, and about
+one cell in eight is missing. The first cell is never missing, since a file of
+only missing cells is rejected.
+*/
+
+#define BENCH_KINDS 4
+
+static void bench_table(struct bench_input *input, uint64_t *state, uint32_t rows, uint32_t cols)
+{
+    static const char *words[] = {"alpha", "beta", "gamma", "delta", "x", "a longer string of text"};
+    uint32_t kinds[BENCH_FUZZ_COLS];
+    char cell[64];
+    
+    for (uint32_t j = 0; j < cols; j++)
+    {
+        kinds[j] = (uint32_t) (bench_rand(state) % BENCH_KINDS);
+        snprintf(cell, sizeof(cell), j == 0 ? "c%u" : ",c%u", j);
+        bench_puts(input, cell);
+    }
+    
+    bench_puts(input, "\n");
+    
+    for (uint32_t i = 0; i < rows; i++)
+    {
+        for (uint32_t j = 0; j < cols; j++)
+        {
+            const uint64_t r = bench_rand(state);
+            
+            cell[0] = '\0';
+            
+            if ((i > 0 || j > 0) && r % 8 == 0) {}
+            else if (kinds[j] == 0) snprintf(cell, sizeof(cell), "%ld", (long) (r >> 8) % 16 - 3);
+            else if (kinds[j] == 1 && r % 16 == 1) snprintf(cell, sizeof(cell), "%ld", LONG_MIN);
+            else if (kinds[j] == 1 && r % 16 == 2) snprintf(cell, sizeof(cell), "%ld", LONG_MAX);
+            else if (kinds[j] == 1) snprintf(cell, sizeof(cell), "%ld", (long) ((r >> 8) % (uint64_t) LONG_MAX) - LONG_MAX / 2);
+            else if (kinds[j] == 2) snprintf(cell, sizeof(cell), "%.2f", (double) ((long) ((r >> 8) % 2000001) - 1000000) / 100.0);
+            else snprintf(cell, sizeof(cell), "%s", words[(r >> 8) % (sizeof(words) / sizeof(words[0]))]);
+            
+            if (j > 0) bench_puts(input, ",");
+            bench_puts(input, cell);
+        }
+        
+        bench_puts(input, "\n");
+    }
+}
+
+/*******************************************************************************
+Columnar round trip. Each random table is written with csv_write_columnar() and
+every column read back must equal the cells converted with strtol() or strtod()
+or copied, with the same missing cells. The file is then damaged by flipping
+random bits or truncating it, and opening and decoding every column must either
+work or fail with CSV_BAD_FORMAT, never read out of bounds. Run under a
+sanitizer to catch the latter.
+*/
+
+static bool bench_columnar_same(const struct csv *csv, struct csv_columnar *columnar)
+{
+    uint32_t rows = 0;
+    uint32_t cols = 0;
+    char **header = csv_columnar_header(columnar);
+    bool same = true;
+    
+    if (csv_columnar_dims(columnar, &rows, &cols) == false || rows != csv->rows || cols != csv->cols) return false;
+    if (header == NULL) return false;
+    
+    for (uint32_t j = 0; j < cols; j++)
+    {
+        const csv_type type = csv_columnar_type(columnar, j);
+        long *longs = type == CSV_TYPE_LONG ? csv_columnar_long(columnar, j, NULL) : NULL;
+        double *doubles = type == CSV_TYPE_DOUBLE ? csv_columnar_double(columnar, j, NULL) : NULL;
+        char **strings = type == CSV_TYPE_STRING ? csv_columnar_str(columnar, j, NULL) : NULL;
+        
+        if (strcmp(header[j], csv->header[j]) != 0) same = false;
+        if (longs == NULL && doubles == NULL && strings == NULL) same = false;
+        
+        for (uint32_t i = 0; same == true && i < rows; i++)
+        {
+            const char *cell = csv->data[i][j];
+            
+            if (csv_columnar_missing(columnar, i, j) != (cell[0] == '\0')) same = false;
+            else if (cell[0] == '\0' && strings == NULL) continue;
+            else if (longs != NULL && longs[i] != strtol(cell, NULL, 10)) same = false;
+            else if (doubles != NULL && doubles[i] != strtod(cell, NULL)) same = false;
+            else if (strings != NULL && strcmp(strings[i], cell) != 0) same = false;
+        }
+        
+        free(longs);
+        free(doubles);
+        free(strings);
+    }
+    
+    return same;
+}
+
+static csv_errno bench_columnar_decode(struct csv_columnar *columnar)
+{
+    csv_errno error = CSV_SUCCESS;
+    uint32_t rows = 0;
+    uint32_t cols = 0;
+    
+    csv_columnar_dims(columnar, &rows, &cols);
+    csv_columnar_header(columnar);
+    
+    for (uint32_t j = 0; j < cols && error == CSV_SUCCESS; j++)
+    {
+        void *decoded = NULL;
+        
+        switch (csv_columnar_type(columnar, j))
+        {
+            case CSV_TYPE_LONG:
+                decoded = csv_columnar_long(columnar, j, &error);
+                break;
+            case CSV_TYPE_DOUBLE:
+                decoded = csv_columnar_double(columnar, j, &error);
+                break;
+            case CSV_TYPE_STRING:
+                decoded = csv_columnar_str(columnar, j, &error);
+                break;
+            case CSV_TYPE_AUTO:
+                error = CSV_BAD_FORMAT;
+                break;
+        }
+        
+        for (uint32_t i = 0; i < rows; i++) csv_columnar_missing(columnar, i, j);
+        
+        free(decoded);
+    }
+    
+    return error;
+}
+
+static bool bench_columnar(uint32_t iterations)
+{
+    uint64_t state = 0x94D049BB133111EBULL;
+    uint32_t damaged = 0;
+    uint32_t rejected = 0;
+    uint32_t failed = 0;
+    
+    for (uint32_t k = 0; k < iterations; k++)
+    {
+        struct bench_input input = {NULL, 0, 0};
+        struct bench_input file = {NULL, 0, 0};
+        struct csv_options options = {.header = true};
+        csv_errno error = CSV_UNDEFINED;
+        uint32_t rows = 1 + (uint32_t) (bench_rand(&state) % 300);
+        uint32_t cols = 1 + (uint32_t) (bench_rand(&state) % BENCH_FUZZ_COLS);
+        
+        bench_table(&input, &state, rows, cols);
+        
+        struct csv_context *context = csv_context_new(&options, &error);
+        if (context == NULL) return false;
+        
+        struct csv *csv = csv_context_read_mem(context, input.bytes, input.length, &error);
+        struct csv_columnar *columnar = NULL;
+        
+        if (csv != NULL && csv_write_columnar(csv, NULL, BENCH_FILE, &error) == true)
+        {
+            columnar = csv_columnar_open(BENCH_FILE, &error);
+        }
+        
+        if (columnar == NULL || bench_columnar_same(csv, columnar) == false)
+        {
+            printf("columnar iteration %u does not round trip\n", k);
+            failed++;
+        }
+        
+        csv_columnar_close(columnar);
+        csv_context_free(context);
+        
+        //keep the intact file to damage a fresh copy each time
+        FILE *stream = fopen(BENCH_FILE, "rb");
+        
+        for (int c = stream == NULL ? EOF : fgetc(stream); c != EOF; c = fgetc(stream))
+        {
+            char byte = (char) c;
+            bench_put(&file, &byte, 1);
+        }
+        
+        if (stream != NULL) fclose(stream);
+        
+        for (uint32_t f = 0; f < 8 && file.length > 0; f++)
+        {
+            struct bench_input copy = file;
+            const uint64_t r = bench_rand(&state);
+            
+            copy.bytes = malloc(file.length);
+            if (copy.bytes == NULL) return false;
+            
+            memcpy(copy.bytes, file.bytes, file.length);
+            
+            //odd flips land in the last bytes, where one bit of the footer moves a column
+            const size_t tail = file.length < 512 ? file.length : 512;
+            const size_t at = f % 2 == 1 ? file.length - 1 - (r >> 3) % tail : (r >> 3) % file.length;
+            
+            if (f % 4 == 3) copy.length = (size_t) (r % file.length);
+            else copy.bytes[at] ^= (char) (1u << (r % 8));
+            
+            damaged++;
+            error = CSV_UNDEFINED;
+            columnar = bench_write(&copy) ? csv_columnar_open(BENCH_FILE, &error) : NULL;
+            
+            if (columnar != NULL) error = bench_columnar_decode(columnar);
+            if (error != CSV_SUCCESS) rejected++;
+            
+            if (error != CSV_SUCCESS && error != CSV_BAD_FORMAT)
+            {
+                printf("columnar iteration %u damage %u fails with %s", k, f, csv_errno_decode(error));
+                failed++;
+            }
+            
+            csv_columnar_close(columnar);
+            free(copy.bytes);
+        }
+        
+        free(file.bytes);
+        free(input.bytes);
+    }
+    
+    remove(BENCH_FILE);
+    
+    printf("columnar       %u files, %u damaged, %u rejected, %u failed\n", iterations, damaged, rejected, failed);
+    
+    return failed == 0;
+}
+
+/*******************************************************************************
+Kernel references. On the same random tables, value counts are recounted cell
+by cell, histograms are binned one cell at a time before and after a zone map
+is built, and rolling windows over random values with NaN among them are
+aggregated window by window.
+*/
+
+static bool bench_counts(struct csv *csv, uint32_t j)
+{
+    uint32_t n = 0;
+    uint64_t present = 0;
+    bool same = true;
+    
+    struct csv_count *counts = csv_value_counts(csv, j, 0, NULL, &n, NULL);
+    if (counts == NULL) return false;
+    
+    for (uint32_t i = 0; i < csv->rows; i++) present += csv->data[i][j][0] != '\0';
+    
+    for (uint32_t v = 0; v < n; v++)
+    {
+        uint64_t count = 0;
+        
+        for (uint32_t i = 0; i < csv->rows; i++) count += strcmp(csv->data[i][j], counts[v].value) == 0;
+        
+        if (count != counts[v].count || (v > 0 && counts[v].count > counts[v - 1].count)) same = false;
+        present -= count;
+    }
+    
+    if (present != 0 || n != csv_distinct(csv, j, true, NULL, NULL)) same = false;
+    
+    free(counts);
+    
+    return same;
+}
+
+static bool bench_histogram(struct csv *csv, uint32_t j, uint32_t bins)
+{
+    uint64_t expect[BENCH_FUZZ_COLS + 1] = {0};
+    double lo = HUGE_VAL;
+    double hi = -HUGE_VAL;
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        const char *cell = csv->data[i][j];
+        char *end = NULL;
+        double v = strtod(cell, &end);
+        
+        if (cell[0] == '\0') continue;
+        if (*end != '\0') return true;
+        
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+    }
+    
+    if (!(hi > lo)) return true;
+    
+    //leave cells below the range, and one on its upper edge for the last bin
+    lo += (hi - lo) / 8;
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        double v = strtod(csv->data[i][j], NULL);
+        
+        if (csv->data[i][j][0] == '\0' || v < lo || v > hi) continue;
+        
+        uint32_t b = (uint32_t) ((v - lo) * (bins / (hi - lo)));
+        expect[b < bins ? b : bins - 1]++;
+    }
+    
+    uint64_t *counts = csv_histogram(csv, j, bins, lo, hi, NULL, NULL);
+    bool same = counts != NULL && memcmp(counts, expect, sizeof(uint64_t) * bins) == 0;
+    
+    free(counts);
+    
+    return same;
+}
+
+static bool bench_rolling(uint64_t *state)
+{
+    double values[BENCH_ROLLING];
+    double out[BENCH_ROLLING];
+    const uint32_t n = (uint32_t) (bench_rand(state) % BENCH_ROLLING);
+    const uint32_t window = 1 + (uint32_t) (bench_rand(state) % 40);
+    bool same = true;
+    
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const uint64_t r = bench_rand(state);
+        values[i] = r % 16 == 0 ? (double) NAN : (double) ((long) (r % 200001) - 100000) / 100.0;
+    }
+    
+    for (csv_rolling_op op = CSV_ROLLING_SUM; op <= CSV_ROLLING_MAX; op++)
+    {
+        if (csv_rolling(values, n, window, op, out, NULL) == false) return false;
+        
+        for (uint32_t i = 0; i < n; i++)
+        {
+            double expect = NAN;
+            double scale = 1;
+            
+            for (uint32_t k = i + 1 >= window ? i + 1 - window : 0; i + 1 >= window && k <= i; k++)
+            {
+                double v = values[k];
+                
+                if (k == i + 1 - window && (op == CSV_ROLLING_SUM || op == CSV_ROLLING_MEAN)) expect = 0;
+                
+                if (op == CSV_ROLLING_SUM || op == CSV_ROLLING_MEAN) expect += v;
+                else if (v == v && (expect != expect || (op == CSV_ROLLING_MIN ? v < expect : v > expect))) expect = v;
+                
+                scale += v == v ? fabs(v) : 0;
+            }
+            
+            if (op == CSV_ROLLING_MEAN) expect /= window;
+            
+            //the running sums round differently, within a few ulps of the window total
+            if (expect != expect ? out[i] == out[i] : fabs(out[i] - expect) > scale * 1e-12) same = false;
+        }
+    }
+    
+    return same;
+}
+
+static bool bench_kernels(uint32_t iterations)
+{
+    uint64_t state = 0xE7037ED1A0B428DBULL;
+    uint32_t failed = 0;
+    
+    for (uint32_t k = 0; k < iterations; k++)
+    {
+        struct bench_input input = {NULL, 0, 0};
+        struct csv_options options = {.header = true};
+        csv_errno error = CSV_UNDEFINED;
+        uint32_t rows = 1 + (uint32_t) (bench_rand(&state) % 300);
+        uint32_t cols = 1 + (uint32_t) (bench_rand(&state) % BENCH_FUZZ_COLS);
+        uint32_t bins = 1 + (uint32_t) (bench_rand(&state) % BENCH_FUZZ_COLS);
+        uint32_t block_rows = 1 + (uint32_t) (bench_rand(&state) % 64);
+        bool same = true;
+        
+        bench_table(&input, &state, rows, cols);
+        
+        struct csv_context *context = csv_context_new(&options, &error);
+        if (context == NULL) return false;
+        
+        struct csv *csv = csv_context_read_mem(context, input.bytes, input.length, &error);
+        if (csv == NULL) same = false;
+        
+        for (uint32_t j = 0; same == true && j < cols; j++)
+        {
+            if (bench_counts(csv, j) == false || bench_histogram(csv, j, bins) == false) same = false;
+        }
+        
+        if (same == true && csv_zonemap_build(csv, block_rows, &error) == false) same = false;
+        
+        for (uint32_t j = 0; same == true && j < cols; j++)
+        {
+            if (bench_histogram(csv, j, bins) == false) same = false;
+        }
+        
+        if (bench_rolling(&state) == false) same = false;
+        
+        if (same == false)
+        {
+            printf("kernel iteration %u differs from the reference\n", k);
+            failed++;
+        }
+        
+        csv_context_free(context);
+        free(input.bytes);
+    }
+    
+    printf("kernels        %u tables, %u failed\n", iterations, failed);
+    
+    return failed == 0;
+}
+
+/*******************************************************************************
+Integer column check. Random arrays of a few blocks mix blocks of one value,
+narrow and wide ranges, and the limits of long, so that packed, unpacked and
+zero width blocks meet. Random reads, unpacked ranges, filters and summaries
+are compared with the plain array.
+*/
+
+static bool bench_intcol_same(const struct csv_intcol *col, const long *values, uint32_t n, uint64_t *state)
+{
+    long *out = malloc(sizeof(long) * (n + 1));
+    struct csv_intcol_summary summary;
+    bool same = out != NULL && csv_intcol_length(col) == n;
+    
+    for (uint32_t i = 0; same == true && i < n; i++)
+    {
+        if (csv_intcol_get(col, i) != values[i]) same = false;
+    }
+    
+    for (uint32_t k = 0; same == true && k < 8; k++)
+    {
+        const uint32_t first = (uint32_t) (bench_rand(state) % (n + 1));
+        const uint32_t length = (uint32_t) (bench_rand(state) % (n - first + 1));
+        
+        if (csv_intcol_unpack(col, first, length, out, NULL) == false) same = false;
+        else if (length > 0 && memcmp(out, values + first, sizeof(long) * length) != 0) same = false;
+    }
+    
+    for (uint32_t k = 0; same == true && k < 8; k++)
+    {
+        long lo = values[bench_rand(state) % n];
+        long hi = values[bench_rand(state) % n];
+        uint32_t selected = 0;
+        uint32_t expect = 0;
+        
+        //an empty range now and then
+        if (lo > hi && k % 2 == 0)
+        {
+            long swap = lo;
+            lo = hi;
+            hi = swap;
+        }
+        
+        uint32_t *sel = csv_intcol_filter(col, lo, hi, &selected, NULL);
+        struct csv_intcol_summary reference = {0, 0, 0, 0};
+        double scale = 0;
+        
+        for (uint32_t i = 0; sel != NULL && i < n; i++)
+        {
+            if (values[i] < lo || values[i] > hi) continue;
+            if (expect >= selected || sel[expect] != i) same = false;
+            
+            if (reference.count == 0 || values[i] < reference.min) reference.min = values[i];
+            if (reference.count == 0 || values[i] > reference.max) reference.max = values[i];
+            
+            reference.count++;
+            reference.sum += (double) values[i];
+            scale += fabs((double) values[i]);
+            expect++;
+        }
+        
+        if (sel == NULL || expect != selected) same = false;
+        else if (csv_intcol_summarize(col, sel, selected, &summary, NULL) == false) same = false;
+        else if (summary.count != reference.count || summary.min != reference.min || summary.max != reference.max) same = false;
+        else if (fabs(summary.sum - reference.sum) > scale * 1e-12) same = false;
+        
+        free(sel);
+    }
+    
+    struct csv_intcol_summary reference = {n, values[0], values[0], 0};
+    double scale = 0;
+    
+    for (uint32_t i = 0; i < n; i++)
+    {
+        reference.min = values[i] < reference.min ? values[i] : reference.min;
+        reference.max = values[i] > reference.max ? values[i] : reference.max;
+        reference.sum += (double) values[i];
+        scale += fabs((double) values[i]);
+    }
+    
+    if (same == false) {}
+    else if (csv_intcol_summarize(col, NULL, 0, &summary, NULL) == false) same = false;
+    else if (summary.count != n || summary.min != reference.min || summary.max != reference.max) same = false;
+    else if (fabs(summary.sum - reference.sum) > scale * 1e-12) same = false;
+    
+    free(out);
+    
+    return same;
+}
+
+static bool bench_intcol(uint32_t iterations)
+{
+    uint64_t state = 0xBF58476D1CE4E5B9ULL;
+    uint32_t failed = 0;
+    
+    for (uint32_t k = 0; k < iterations; k++)
+    {
+        const uint32_t n = 1 + (uint32_t) (bench_rand(&state) % (3 * CSV_INTCOL_BLOCK + 2));
+        long *values = malloc(sizeof(long) * n);
+        if (values == NULL) return false;
+        
+        for (uint32_t i = 0; i < n; i += CSV_INTCOL_BLOCK)
+        {
+            const uint64_t mode = bench_rand(&state) % 4;
+            const uint32_t shift = 2 + (uint32_t) (bench_rand(&state) % 62);
+            const long base = (long) (bench_rand(&state) % ((uint64_t) LONG_MAX / 2)) - LONG_MAX / 2;
+            
+            for (uint32_t b = i; b < n && b < i + CSV_INTCOL_BLOCK; b++)
+            {
+                const uint64_t r = bench_rand(&state);
+                const long limits[] = {LONG_MIN, LONG_MAX, 0, -1};
+                
+                if (mode == 0) values[b] = base;
+                else if (mode == 1) values[b] = limits[r % 4];
+                else values[b] = base + (long) ((r >> shift) % ((uint64_t) LONG_MAX / 2));
+            }
+        }
+        
+        struct csv_intcol *col = csv_intcol_new(values, n, NULL);
+        
+        if (col == NULL || bench_intcol_same(col, values, n, &state) == false)
+        {
+            printf("intcol iteration %u differs from the array\n", k);
+            failed++;
+        }
+        
+        csv_intcol_free(col);
+        free(values);
+    }
+    
+    printf("intcol         %u columns, %u failed\n", iterations, failed);
+    
+    return failed == 0;
+}
+
+/*******************************************************************************
+Text column check. Random strings of repeated words, which compress, and of
+random bytes, which do not, are stored with now and then a cell longer than a
+block, and every cell is read back in order and at random. The cells of a
+random table compressed with csv_col_compressed() must read back as well.
+*/
+
+static bool bench_textcol_same(const struct csv_textcol *col, const char * const *strings, uint32_t n, uint64_t *state)
+{
+    bool same = csv_textcol_length(col) == n;
+    
+    for (uint32_t k = 0; same == true && k < 2 * n; k++)
+    {
+        const uint32_t i = k < n ? k : (uint32_t) (bench_rand(state) % n);
+        const char *string = csv_textcol_get(col, i, NULL);
+        
+        if (string == NULL || strcmp(string, strings[i]) != 0) same = false;
+    }
+    
+    return same;
+}
+
+static bool bench_textcol(uint32_t iterations)
+{
+    static const char *words[] = {"Mozilla/5.0 ", "(X11; Linux x86_64) ", "Gecko ", "comment ", "a"};
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    uint32_t failed = 0;
+    
+    for (uint32_t k = 0; k < iterations; k++)
+    {
+        const uint32_t n = 1 + (uint32_t) (bench_rand(&state) % 2000);
+        char **strings = calloc(n, sizeof(char *));
+        struct bench_input *cells = calloc(n, sizeof(struct bench_input));
+        if (strings == NULL || cells == NULL) return false;
+        
+        for (uint32_t i = 0; i < n; i++)
+        {
+            const uint64_t r = bench_rand(&state);
+            const uint32_t length = r % 64 == 0 ? CSV_TEXTCOL_BLOCK + (uint32_t) (r % 4096) : (uint32_t) (r % 200);
+            
+            while (cells[i].length < length)
+            {
+                const uint64_t s = bench_rand(&state);
+                char byte = (char) (1 + s % 255);
+                
+                if (r % 3 == 0) bench_put(&cells[i], &byte, 1);
+                else bench_puts(&cells[i], words[s % (sizeof(words) / sizeof(words[0]))]);
+            }
+            
+            bench_put(&cells[i], "", 1);
+            strings[i] = cells[i].bytes;
+        }
+        
+        struct csv_textcol *col = csv_textcol_new((const char * const *) strings, n, NULL);
+        
+        if (col == NULL || bench_textcol_same(col, (const char * const *) strings, n, &state) == false)
+        {
+            printf("textcol iteration %u differs from the strings\n", k);
+            failed++;
+        }
+        
+        csv_textcol_free(col);
+        
+        for (uint32_t i = 0; i < n; i++) free(cells[i].bytes);
+        free(cells);
+        free(strings);
+        
+        struct bench_input input = {NULL, 0, 0};
+        struct csv_options options = {.header = true};
+        csv_errno error = CSV_UNDEFINED;
+        
+        bench_table(&input, &state, 1 + (uint32_t) (bench_rand(&state) % 300), 1);
+        
+        struct csv_context *context = csv_context_new(&options, &error);
+        if (context == NULL) return false;
+        
+        struct csv *csv = csv_context_read_mem(context, input.bytes, input.length, &error);
+        const char **column = csv == NULL ? NULL : malloc(sizeof(char *) * csv->rows);
+        
+        for (uint32_t i = 0; column != NULL && i < csv->rows; i++) column[i] = csv->data[i][0];
+        
+        col = column == NULL ? NULL : csv_col_compressed(csv, 0, &error);
+        
+        if (col == NULL || bench_textcol_same(col, column, csv->rows, &state) == false)
+        {
+            printf("textcol iteration %u differs from the table\n", k);
+            failed++;
+        }
+        
+        csv_textcol_free(col);
+        csv_context_free(context);
+        free(column);
+        free(input.bytes);
+    }
+    
+    printf("textcol        %u columns, %u failed\n", iterations, failed);
+    
+    return failed == 0;
+}
+
+/*******************************************************************************
+String cell check. Random strings around CSV_STR_INLINE bytes share long
+prefixes and differ in the odd byte, so that inlined and referenced cells meet
+with equal lengths and prefixes. Comparison must agree with strcmp() in sign,
+the order must be a sorted and stable permutation, and selections must match a
+plain scan. The same holds for the cells csv_cols() makes of a random table.
+*/
+
+static int bench_sign(int value)
+{
+    return (value > 0) - (value < 0);
+}
+
+static bool bench_str_same(const struct csv_str *cells, const char * const *strings, uint32_t n, uint64_t *state)
+{
+    uint32_t *order = csv_str_order(cells, n, NULL);
+    bool *seen = calloc(n, sizeof(bool));
+    bool same = order != NULL && seen != NULL;
+    
+    for (uint32_t i = 0; same == true && i < n; i++)
+    {
+        const uint32_t k = (uint32_t) (bench_rand(state) % n);
+        
+        if (cells[i].length != strlen(strings[i])) same = false;
+        else if (memcmp(csv_str_data(&cells[i]), strings[i], cells[i].length) != 0) same = false;
+        else if (bench_sign(csv_str_cmp(&cells[i], &cells[k])) != bench_sign(strcmp(strings[i], strings[k]))) same = false;
+        else if (csv_str_eq(&cells[i], &cells[k]) != (strcmp(strings[i], strings[k]) == 0)) same = false;
+        
+        if (order[i] >= n || seen[order[i]] == true) same = false;
+        else seen[order[i]] = true;
+        
+        if (same == true && i > 0)
+        {
+            const int c = strcmp(strings[order[i - 1]], strings[order[i]]);
+            if (c > 0 || (c == 0 && order[i - 1] > order[i])) same = false;
+        }
+    }
+    
+    for (uint32_t k = 0; same == true && k < 4; k++)
+    {
+        const uint32_t v = (uint32_t) (bench_rand(state) % n);
+        uint32_t count = 0;
+        uint32_t expect = 0;
+        
+        uint32_t *sel = csv_str_select(cells, n, &cells[v], &count, NULL);
+        
+        for (uint32_t i = 0; sel != NULL && i < n; i++)
+        {
+            if (strcmp(strings[i], strings[v]) != 0) continue;
+            if (expect >= count || sel[expect] != i) same = false;
+            expect++;
+        }
+        
+        if (sel == NULL || expect != count) same = false;
+        
+        free(sel);
+    }
+    
+    free(seen);
+    free(order);
+    
+    return same;
+}
+
+static bool bench_str(uint32_t iterations)
+{
+    uint64_t state = 0xD1B54A32D192ED03ULL;
+    uint32_t failed = 0;
+    
+    for (uint32_t k = 0; k < iterations; k++)
+    {
+        const uint32_t n = 1 + (uint32_t) (bench_rand(&state) % 500);
+        char (*strings)[2 * CSV_STR_INLINE + 1] = calloc(n, sizeof(*strings));
+        const char **pointers = calloc(n, sizeof(char *));
+        struct csv_str *cells = calloc(n, sizeof(struct csv_str));
+        bool same = strings != NULL && pointers != NULL && cells != NULL;
+        
+        for (uint32_t i = 0; same == true && i < n; i++)
+        {
+            const uint64_t r = bench_rand(&state);
+            const uint32_t length = CSV_STR_INLINE - 4 + (uint32_t) (r % 9);
+            
+            //an 'a' run with one byte from a small alphabet somewhere in it
+            memset(strings[i], 'a', length);
+            strings[i][(r >> 8) % (length + 1)] = "ab`~\x7f\x80"[(r >> 16) % 6];
+            strings[i][length] = '\0';
+            
+            pointers[i] = strings[i];
+            if (csv_str_from(strings[i], &cells[i], NULL) == false) same = false;
+        }
+        
+        if (same == false || bench_str_same(cells, pointers, n, &state) == false)
+        {
+            printf("str iteration %u differs from strcmp\n", k);
+            failed++;
+        }
+        
+        free(cells);
+        free(pointers);
+        free(strings);
+        
+        struct bench_input input = {NULL, 0, 0};
+        struct csv_options options = {.header = true};
+        csv_errno error = CSV_UNDEFINED;
+        
+        bench_table(&input, &state, 1 + (uint32_t) (bench_rand(&state) % 300), 1);
+        
+        struct csv_context *context = csv_context_new(&options, &error);
+        if (context == NULL) return false;
+        
+        struct csv *csv = csv_context_read_mem(context, input.bytes, input.length, &error);
+        const char **column = csv == NULL ? NULL : malloc(sizeof(char *) * csv->rows);
+        
+        for (uint32_t i = 0; column != NULL && i < csv->rows; i++) column[i] = csv->data[i][0];
+        
+        cells = column == NULL ? NULL : csv_cols(csv, 0, &error);
+        
+        if (cells == NULL || bench_str_same(cells, column, csv->rows, &state) == false)
+        {
+            printf("str iteration %u differs from the table\n", k);
+            failed++;
+        }
+        
+        free(cells);
+        free(column);
+        csv_context_free(context);
+        free(input.bytes);
+    }
+    
+    printf("str            %u columns, %u failed\n", iterations, failed);
+    
+    return failed == 0;
+}
+
+/*******************************************************************************
+Hardware counters. Each event gets its own perf_event_open descriptor rather
+than one group, so a PMU that cannot schedule all of them at once still reports
+the rest. Events the kernel refuses, for example under a strict
+perf_event_paranoid setting, are reported as unavailable.
+*/
+
+#define BENCH_EVENTS 6
+
+struct bench_counters
+{
+    int fd[BENCH_EVENTS];
+    uint64_t value[BENCH_EVENTS];
+};
+
+static const char *bench_event_names[BENCH_EVENTS] =
+{
+    "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses", "dTLB-misses"
+};
+
+#ifdef __linux__
+
+#define BENCH_CACHE_MISS(cache)                                                \
+        ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8)                          \
+                 | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static void bench_counters_open(struct bench_counters *counters)
+{
+    static const uint32_t type[BENCH_EVENTS] =
+    {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+        PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE
+    };
+    
+    static const uint64_t config[BENCH_EVENTS] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        BENCH_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D),
+        BENCH_CACHE_MISS(PERF_COUNT_HW_CACHE_LL),
+        BENCH_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)
+    };
+    
+    for (int k = 0; k < BENCH_EVENTS; k++)
+    {
+        struct perf_event_attr attr;
+        
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type[k];
+        attr.config = config[k];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        
+        counters->fd[k] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        counters->value[k] = 0;
+    }
+}
+
+static void bench_counters_close(struct bench_counters *counters)
+{
+    for (int k = 0; k < BENCH_EVENTS; k++)
+    {
+        if (counters->fd[k] >= 0) close(counters->fd[k]);
+    }
+}
+
+static void bench_counters_start(struct bench_counters *counters)
+{
+    for (int k = 0; k < BENCH_EVENTS; k++)
+    {
+        if (counters->fd[k] < 0) continue;
+        
+        ioctl(counters->fd[k], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fd[k], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void bench_counters_stop(struct bench_counters *counters)
+{
+    for (int k = 0; k < BENCH_EVENTS; k++)
+    {
+        if (counters->fd[k] < 0) continue;
+        
+        ioctl(counters->fd[k], PERF_EVENT_IOC_DISABLE, 0);
+        
+        if (read(counters->fd[k], &counters->value[k], sizeof(uint64_t)) != sizeof(uint64_t))
+        {
+            counters->value[k] = 0;
+        }
+    }
+}
+
+#else
+
+static void bench_counters_open(struct bench_counters *counters)
+{
+    for (int k = 0; k < BENCH_EVENTS; k++)
+    {
+        counters->fd[k] = -1;
+        counters->value[k] = 0;
+    }
+}
+
+static void bench_counters_close(struct bench_counters *counters)
+{
+    (void) counters;
+}
+
+static void bench_counters_start(struct bench_counters *counters)
+{
+    (void) counters;
+}
+
+static void bench_counters_stop(struct bench_counters *counters)
+{
+    (void) counters;
+}
+
+#endif
+
+static void bench_counters_print(const struct bench_counters *counters, const char *phase, size_t bytes, uint64_t cells)
+{
+    printf("%s\n", phase);
+    
+    for (int k = 0; k < BENCH_EVENTS; k++)
+    {
+        if (counters->fd[k] < 0)
+        {
+            printf("    %-14s unavailable\n", bench_event_names[k]);
+            continue;
+        }
+        
+        double total = (double) counters->value[k];
+        double per_byte = total / (double) (bytes == 0 ? 1 : bytes);
+        
+        if (cells == 0) printf("    %-14s %14.0f %10.3f /byte\n", bench_event_names[k], total, per_byte);
+        else
+        {
+            printf("    %-14s %14.0f %10.3f /byte %10.3f /cell\n", bench_event_names[k], total,
+                   per_byte, total / (double) cells);
+        }
+    }
+}
+
+/*******************************************************************************
+Profile the file based API on one input. A conversion gives up at the first
+cell it cannot convert, so an unmeasured pass first finds the columns or rows
+that convert in full. Only those are measured, and the per cell figures divide
+by the cells they hold, which exposes the cost of walking the row pointers
+column by column. A phase with nothing to convert reports per byte only.
+*/
+
+static bool bench_profile(const char *name, void (*build)(struct bench_input *input, size_t target), size_t target)
+{
+    struct bench_input input = {NULL, 0, 0};
+    struct bench_counters counters;
+    struct csv_options options = {0};
+    csv_errno error = CSV_UNDEFINED;
+    char phase[64];
+    
+    build(&input, target);
+    
+    bool written = bench_write(&input);
+    free(input.bytes);
+    
+    if (written == false) return false;
+    
+    bench_counters_open(&counters);
+    options.header = true;
+    
+    bench_counters_start(&counters);
+    struct csv *csv = csv_read_opts(BENCH_FILE, &options, &error);
+    bench_counters_stop(&counters);
+    
+    if (csv == NULL)
+    {
+        printf("%s: %s", name, csv_errno_decode(error));
+        bench_counters_close(&counters);
+        remove(BENCH_FILE);
+        return false;
+    }
+    
+    snprintf(phase, sizeof(phase), "%s csv_read_opts", name);
+    bench_counters_print(&counters, phase, input.length, csv->total);
+    
+    bool *cols = malloc(sizeof(bool) * ((size_t) csv->cols + 1));
+    bool *rows = malloc(sizeof(bool) * ((size_t) csv->rows + 1));
+    uint64_t converted = 0;
+    
+    if (cols == NULL || rows == NULL)
+    {
+        free(cols);
+        free(rows);
+        csv_free(csv);
+        bench_counters_close(&counters);
+        remove(BENCH_FILE);
+        return false;
+    }
+    
+    for (uint32_t j = 0; j < csv->cols; j++)
+    {
+        long *values = csv_coll(csv, j, 10, &error);
+        cols[j] = values != NULL;
+        converted += cols[j];
+        free(values);
+    }
+    
+    bench_counters_start(&counters);
+    for (uint32_t j = 0; j < csv->cols; j++) if (cols[j] == true) free(csv_coll(csv, j, 10, &error));
+    bench_counters_stop(&counters);
+    
+    snprintf(phase, sizeof(phase), "%s csv_coll", name);
+    bench_counters_print(&counters, phase, input.length, converted * csv->rows);
+    
+    converted = 0;
+    
+    for (uint32_t j = 0; j < csv->cols; j++)
+    {
+        double *values = csv_cold(csv, j, &error);
+        cols[j] = values != NULL;
+        converted += cols[j];
+        free(values);
+    }
+    
+    bench_counters_start(&counters);
+    for (uint32_t j = 0; j < csv->cols; j++) if (cols[j] == true) free(csv_cold(csv, j, &error));
+    bench_counters_stop(&counters);
+    
+    snprintf(phase, sizeof(phase), "%s csv_cold", name);
+    bench_counters_print(&counters, phase, input.length, converted * csv->rows);
+    
+    converted = 0;
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        double *values = csv_rowd(csv, i, &error);
+        rows[i] = values != NULL;
+        converted += rows[i];
+        free(values);
+    }
+    
+    bench_counters_start(&counters);
+    for (uint32_t i = 0; i < csv->rows; i++) if (rows[i] == true) free(csv_rowd(csv, i, &error));
+    bench_counters_stop(&counters);
+    
+    snprintf(phase, sizeof(phase), "%s csv_rowd", name);
+    bench_counters_print(&counters, phase, input.length, converted * csv->cols);
+    
+    free(cols);
+    free(rows);
+    
+    uint64_t cells = csv->total;
+    
+    bench_counters_start(&counters);
+    csv_free(csv);
+    bench_counters_stop(&counters);
+    
+    snprintf(phase, sizeof(phase), "%s csv_free", name);
+    bench_counters_print(&counters, phase, input.length, cells);
+    
+    bench_counters_close(&counters);
+    remove(BENCH_FILE);
+    
+    return true;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+    bool profile = argc > 1 && strcmp(argv[1], "-p") == 0;
+    
+    if (profile == true)
+    {
+        argc--;
+        argv++;
+    }
+    
+    double floor = argc > 1 ? atof(argv[1]) : BENCH_FLOOR;
+    size_t target = (size_t) (argc > 2 ? atol(argv[2]) : BENCH_MIB) << 20;
+    uint32_t fuzz = argc > 3 ? (uint32_t) atol(argv[3]) : BENCH_FUZZ;
+    bool pass = true;
+    
+    struct bench_case cases[] =
+    {
+        {"numeric",     build_numeric,      {.header = true}, CSV_SUCCESS, {0}},
+        {"quoted",      build_quoted,       {.header = true}, CSV_SUCCESS, {0}},
+        {"huge field",  build_huge_field,   {.header = true}, CSV_SUCCESS, {0}},
+        {"field limit", build_huge_field,   {.header = true, .max_field = 1 << 20}, CSV_FIELD_LEN_OVERFLOW, {0}},
+        {"escapes",     build_escapes,      {.header = true}, CSV_SUCCESS, {0}},
+        {"wide",        build_wide,         {.header = false}, CSV_SUCCESS, {0}},
+        {"blank lines", build_blank,        {.header = true, .ragged = CSV_RAGGED_PAD}, CSV_SUCCESS, {0}},
+        {"trailing",    build_trailing,     {.header = true}, CSV_SUCCESS, {0}},
+        {"unbalanced",  build_unbalanced,   {.header = true, .tolerant = true}, CSV_SUCCESS, {0}},
+        {"cell limit",  build_ragged,       {.max_cells = 1 << 24, .ragged = CSV_RAGGED_PAD}, CSV_LIMIT_EXCEEDED, {0}}
+    };
+    
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        if (bench_run(&cases[i], floor, target) == false) pass = false;
+    }
+    
+    if (bench_fuzz(fuzz) == false) pass = false;
+    if (bench_zonemap(fuzz / 10) == false) pass = false;
+    if (bench_push(fuzz) == false) pass = false;
+    
+    #ifdef BENCH_THREADS
+    if (bench_threads(target / 16) == false) pass = false;
+    #endif
+    
+    if (bench_columnar(fuzz / 20) == false) pass = false;
+    if (bench_kernels(fuzz / 20) == false) pass = false;
+    if (bench_intcol(fuzz / 50) == false) pass = false;
+    if (bench_textcol(fuzz / 200) == false) pass = false;
+    if (bench_str(fuzz / 50) == false) pass = false;
+    
+    if (profile == true)
+    {
+        if (bench_profile("numeric", build_numeric, target) == false) pass = false;
+        if (bench_profile("quoted", build_quoted, target) == false) pass = false;
+    }
+    
+    return pass ? EXIT_SUCCESS : EXIT_FAILURE;
+}
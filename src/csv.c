@@ -4,6 +4,27 @@
 * LISC: MIT License
 */
 
+/*******************************************************************************
+Parallel kernels use POSIX threads unless CSV_NO_THREADS is defined, otherwise
+they run on the calling thread. Descriptor reads of the push parser need POSIX
+too. The feature test macros must precede all headers, glibc needs _GNU_SOURCE
+for the CPU affinity calls of struct csv_pool.
+*/
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define CSV_POSIX
+    #ifndef _POSIX_C_SOURCE
+        #define _POSIX_C_SOURCE 200809L
+    #endif
+#endif
+
+#if !defined(CSV_NO_THREADS) && defined(CSV_POSIX)
+    #define CSV_PTHREADS
+    #if defined(__linux__) && !defined(_GNU_SOURCE)
+        #define _GNU_SOURCE
+    #endif
+#endif
+
 #include "csv.h"
 
 #include <stdio.h>
@@ -12,17 +33,70 @@
 #include <limits.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef CSV_POSIX
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#ifdef CSV_PTHREADS
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+#if defined(CSV_PTHREADS) && defined(__linux__)
+    #include <sys/eventfd.h>
+#endif
+
+/*******************************************************************************
+Static tracing probes. Building with CSV_USDT defined places USDT probes from
+the systemtap sys/sdt.h header at the start and end of each parse phase, each
+conversion and csv_free, and on every block the reader loads. A disabled probe
+site is a single nop, and without CSV_USDT the probes compile to nothing. With
+bpftrace the probes are addressed as usdt:<binary>:csv:<name>.
+*/
+
+#ifdef CSV_USDT
+    #include <sys/sdt.h>
+    #define CSV_PROBE(name) DTRACE_PROBE(csv, name)
+    #define CSV_PROBE1(name, a) DTRACE_PROBE1(csv, name, a)
+    #define CSV_PROBE2(name, a, b) DTRACE_PROBE2(csv, name, a, b)
+#else
+    #define CSV_PROBE(name) do {} while (0)
+    #define CSV_PROBE1(name, a) do {} while (0)
+    #define CSV_PROBE2(name, a, b) do {} while (0)
+#endif
 
 /*******************************************************************************
 Static prototypes
 */
 
-static csv_errno csv_dims(FILE * const csvfile, bool header, uint32_t *r, uint32_t *c);
-static csv_errno csv_cols(FILE * const csvfile, uint32_t *cols);
-static csv_errno csv_rows(FILE * const csvfile, uint32_t *rows);
-static csv_errno csv_tokenize(FILE * const csvfile, char *buffer, int n);
-static csv_errno csv_get_header(struct csv *csv, FILE * const csvfile, fpos_t *pos);
-static csv_errno csv_get_data(struct csv *csv, FILE * const csvfile, fpos_t data_pos);
+struct csv_reader;
+
+static void csv_init(struct csv *csv, struct csv_context *context);
+static csv_errno csv_parse(struct csv *csv, struct csv_reader *reader, const struct csv_options *options);
+static csv_errno csv_dims(struct csv *csv, struct csv_reader *reader, const struct csv_options *options);
+static csv_errno csv_tokenize(struct csv_reader *reader, struct csv_arena *arena, char **field, int *end);
+static csv_errno csv_get_record(struct csv *csv, struct csv_reader *reader, char **cells, uint32_t *width);
+static csv_errno csv_get_header(struct csv *csv, struct csv_reader *reader);
+static csv_errno csv_get_data(struct csv *csv, struct csv_reader *reader, const struct csv_options *options);
+static csv_errno csv_build_lookup(struct csv *csv);
+static uint64_t csv_lookup_capacity(uint32_t cols);
+static uint32_t csv_group_rows(uint32_t cols);
+static struct csv_arena *csv_arena_new(void);
+static void csv_arena_reset(struct csv_arena *arena);
+static void csv_arena_free(struct csv_arena *arena);
+static void *csv_alloc(struct csv *csv, size_t size);
+static csv_errno csv_convert_long(const char *cell, const int base, long *value);
+static csv_errno csv_convert_double(const char *cell, double *value);
+static uint64_t csv_hash(const char *bytes, size_t n);
+static void csv_zone_column(struct csv *csv, struct csv_zonemap *map, uint32_t j);
+static void csv_zonemap_free(struct csv_zonemap *map);
+static void csv_parallel(struct csv_pool *pool, void (*task)(void *), void *args, size_t size, uint32_t n);
 
 /*******************************************************************************
 File macros
@@ -36,425 +110,2813 @@ File macros
         } while (0)                                                            \
 
 /*******************************************************************************
-Read a CSV file from disk into memory as a 2D array of csv cells. 
+Arena slab allocator. All header and cell strings of a struct csv are carved
+out of large slabs, which replaces one malloc per cell with one per slab and
+lets csv_free release everything in a handful of calls. The tokenizer appends
+bytes to the field under construction at the end of the head slab. When the
+slab fills up, the partial field is moved to a fresh slab of at least twice its
+length, so a field of any length costs amortized O(1) per byte. A reset hands
+every slab to a spare list that is drawn from before calling malloc again.
 */
 
-struct csv *csv_read(const char * const filename, const bool header, csv_errno *error)
+struct csv_slab
 {
-    csv_errno status = CSV_UNDEFINED;
-    uint32_t rows = 0;
-    uint32_t cols = 0;
-    fpos_t data_pos = 0;
-    
-    //verify and open file
-    if (filename == NULL) STOP(error, CSV_NULL_FILENAME, early_stop);
-    FILE *csvfile = fopen(filename, "rt");
-    if (csvfile == NULL) STOP(error, CSV_INVALID_FILE, early_stop);
-    
-    //fetch array dimensions
-    status = csv_dims(csvfile, header, &rows, &cols);
-    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    struct csv_slab *next;
+    size_t size;
+    size_t used;
+    char bytes[];
+};
+
+struct csv_arena
+{
+    struct csv_slab *head;
+    struct csv_slab *spare;
+    uint64_t capacity;
+    uint64_t carved;
+    size_t field;
+};
+
+static struct csv_arena *csv_arena_new(void)
+{
+    struct csv_arena *arena = malloc(sizeof(struct csv_arena));
+    if (arena == NULL) return NULL;
     
-    //configure struct csv
-    struct csv *csv = malloc(sizeof(struct csv));
-    if (csv == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    arena->head = NULL;
+    arena->spare = NULL;
+    arena->capacity = 0;
+    arena->carved = 0;
+    arena->field = 0;
     
-    csv->rows = rows;
-    csv->cols = cols;
-    csv->total = (uint64_t) rows * cols;
+    return arena;
+}
+
+static void csv_arena_reset(struct csv_arena *arena)
+{
+    if (arena == NULL) return;
     
-    //fetch header    
-    if (header == false) csv->header = NULL;
-    else
-    {       
-        status = csv_get_header(csv, csvfile, &data_pos);
-        if (status != CSV_SUCCESS) STOP(error, status, fail);
+    while (arena->head != NULL)
+    {
+        struct csv_slab *next = arena->head->next;
+        arena->head->next = arena->spare;
+        arena->spare = arena->head;
+        arena->head = next;
     }
     
-    //read each datum into a 2D array of strings (3D ragged array)    
-    status = csv_get_data(csv, csvfile, data_pos);
-    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    arena->carved = 0;
+    arena->field = 0;
+}
+
+static void csv_arena_free(struct csv_arena *arena)
+{
+    if (arena == NULL) return;
     
-    //sanity checks
-    if (csv->total <= csv->missing) STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
-    else goto success;
+    csv_arena_reset(arena);
     
-    //error handling
-    success:
-        fclose(csvfile);
-        if (error != NULL) *error = CSV_SUCCESS;
-        return csv;
-        
-    fail:
-        fclose(csvfile);
-        return NULL;
-        
-    early_stop:
-        return NULL;
+    while (arena->spare != NULL)
+    {
+        struct csv_slab *next = arena->spare->next;
+        free(arena->spare);
+        arena->spare = next;
+    }
+    
+    free(arena);
 }
 
 /*******************************************************************************
-Determine the dimensions of the csv file for malloc. The number of rows returned
-is excluding the header. Full RFC 4180 compliance means that we can bypass a few
-error handling routines.
+Push a slab with room for the partial field plus at least need more bytes, and
+carry the partial field over. A large enough spare slab is reused if there is
+one.
 */
 
-static csv_errno csv_dims(FILE * const csvfile, bool header, uint32_t *r, uint32_t *c)
+static bool csv_arena_slab(struct csv_arena *arena, size_t need)
 {
-    csv_errno status = CSV_UNDEFINED;
+    struct csv_slab *old = arena->head;
+    struct csv_slab **spare = &arena->spare;
+    size_t partial = old == NULL ? 0 : old->used - arena->field;
+    size_t size = 2 * (partial + need);
     
-    status = csv_cols(csvfile, c);
+    if (size < CSV_ARENA_SLAB_LENGTH) size = CSV_ARENA_SLAB_LENGTH;
     
-    if (status != CSV_SUCCESS) return status;
+    while (*spare != NULL && (*spare)->size < size) spare = &(*spare)->next;
     
-    status = csv_rows(csvfile, r);
+    struct csv_slab *slab = *spare;
     
-    if (status == CSV_SUCCESS)
+    if (slab != NULL) *spare = slab->next;
+    else
     {
-        if (header == true) (*r)--;
-        rewind(csvfile);
+        slab = malloc(sizeof(struct csv_slab) + size);
+        if (slab == NULL) return false;
+        
+        slab->size = size;
+        arena->capacity += size;
     }
     
-    return status;
+    slab->next = old;
+    slab->used = partial;
+    
+    if (partial > 0)
+    {
+        memcpy(slab->bytes, old->bytes + arena->field, partial);
+        old->used = arena->field;
+    }
+    
+    arena->head = slab;
+    arena->field = 0;
+    
+    return true;
 }
 
-/*******************************************************************************
-Read the first row of the CSV file to calculate total columns. RFC implies that 
-the first row alone is enough to determine the number of columns. For double
-quotes, RFC 4180 rule 7 implies all quotes always come in pairs, so we consume
-two quotes at a time without risk, even when they are not the correct pairing.
-*/
+static inline bool csv_arena_putc(struct csv_arena *arena, char c)
+{
+    struct csv_slab *slab = arena->head;
+    
+    if (slab == NULL || slab->used == slab->size)
+    {
+        if (csv_arena_slab(arena, 1) == false) return false;
+        slab = arena->head;
+    }
+    
+    slab->bytes[slab->used++] = c;
+    
+    return true;
+}
 
-static csv_errno csv_cols(FILE * const csvfile, uint32_t *cols)
+static bool csv_arena_append(struct csv_arena *arena, const char *bytes, size_t n)
 {
-    int c = 0;
-    *cols = 1;
+    struct csv_slab *slab = arena->head;
     
-    rewind(csvfile);
+    if (n == 0) return true;
     
-    while ((c = getc(csvfile)) != EOF)
+    if (slab == NULL || slab->size - slab->used < n)
     {
-        switch (c)
-        {
-            case ',':
-                (*cols)++;
-                if (*cols == 0) return CSV_NUM_COLUMNS_OVERFLOW;
-                break;
-            
-            case '\n':
-                return CSV_SUCCESS;
-            
-            //double quotes -> consume everything until enclosing quote
-            //RFC 4180 rule 7 implies quotes incl. escapes always come in pairs
-            case '"':
-                while (1)
-                {
-                    c = getc(csvfile);
-                    if (c == '"') break;
-                    else continue;
-                }
-                break;
-                
-            default:
-                break;
-        }
+        if (csv_arena_slab(arena, n) == false) return false;
+        slab = arena->head;
     }
     
-    return CSV_SUCCESS;
+    memcpy(slab->bytes + slab->used, bytes, n);
+    slab->used += n;
+    
+    return true;
 }
 
-
 /*******************************************************************************
-Calculate total rows, including both the header and the actual data rows. Avoid
-double responsibility so the manager will handle the logic to exclude the header 
-from the total count.
+Drop the carriage return of a CRLF record terminator from the field under
+construction. The file is read in binary mode, so RFC 4180 CRLF line endings
+reach the tokenizer unchanged on every platform.
 */
 
-static csv_errno csv_rows(FILE * const csvfile, uint32_t *rows)
+static void csv_arena_trim_cr(struct csv_arena *arena)
 {
-    int c = 0;
-    *rows = 0;
-    
-    rewind(csvfile);
+    struct csv_slab *slab = arena->head;
     
-    while ((c = getc(csvfile)) != EOF)
+    if (slab != NULL && slab->used > arena->field && slab->bytes[slab->used - 1] == '\r')
     {
-        switch (c)
-        {
-            //RFC rule 2 branch for EOF + CRLF
-            case '\n':
-                c = getc(csvfile);
-                
-                if (c == EOF) goto terminate;
-                else
-                {
-                    if (c != ungetc(c, csvfile)) return CSV_FATAL_UNGETC;
-                    (*rows)++;
-                    if (*rows == 0) return CSV_NUM_ROWS_OVERFLOW;
-                }
-                
-                break;
-            
-            //same as csv_cols, consume until closing quote
-            case '"':
-                while (1)
-                {
-                    c = getc(csvfile);
-                    if (c == '"') break;
-                    else continue;
-                }
-                break;
-                
-            default:
-                break;
-        }
+        slab->used--;
     }
-    
-    //RFC 4180 rule 2 exception to account for no CRLF on final row
-    terminate:
-        (*rows)++;
-        if (*rows == 0) return CSV_NUM_ROWS_OVERFLOW;
-    
-    return CSV_SUCCESS;
 }
 
+/*******************************************************************************
+Release the most recently terminated field, which always sits at the end of the
+head slab, and make its space available to the next field.
+*/
+
+static void csv_arena_drop(struct csv_arena *arena, char *field)
+{
+    arena->head->used = (size_t) (field - arena->head->bytes);
+    arena->field = arena->head->used;
+}
 
 /*******************************************************************************
-Field tokenizer. Read next field from current file position and write it into
-the target buffer as a nul-terminated string. EOF condition is not used in the
-header processing. Enclosing quotes and escape sequence quotes are removed.
+Carve a pointer aligned block out of the arena between two fields. Used for the
+row, cell and index arrays of a context owned struct csv.
 */
 
-static csv_errno csv_tokenize(FILE * const csvfile, char *buffer, int n)
+static void *csv_arena_alloc(struct csv_arena *arena, size_t size)
 {
-    int lag = 0;
-    int lead = 0;
-    uint32_t i = 0;
+    const size_t align = sizeof(void*);
+    struct csv_slab *slab = arena->head;
+    size_t offset = slab == NULL ? 0 : (slab->used + align - 1) / align * align;
     
-    while (1)
+    if (slab == NULL || offset > slab->size || slab->size - offset < size)
     {
-        lag = getc(csvfile);
-        
-        if (lag == '"')
-        {
-            lead = getc(csvfile);
-            
-            if (lead == ',' || lead == '\n' || lead == EOF) break;
-            else buffer[i++] = (char) lead;
-        }
-        else if (lag == ',' || lag == '\n' || lag == EOF) break;
-        else buffer[i++] = (char) lag;
-        
-        if (i == 0) return CSV_FIELD_LEN_OVERFLOW;
+        if (csv_arena_slab(arena, size) == false) return NULL;
+        slab = arena->head;
+        offset = 0;
     }
     
-    if (i == (uint32_t) n) return CSV_BUFFER_OVERFLOW;
-    
-    buffer[i] = '\0';
+    arena->carved += offset + size - slab->used;
+    slab->used = offset + size;
+    arena->field = slab->used;
     
-    return CSV_SUCCESS;
+    return slab->bytes + offset;
 }
 
-
 /*******************************************************************************
-If the CSV file contains a header, dynamically allocate a ragged array of column
-names and assign to struct csv metadata. By RFC 4180 rule 3, the header has the
-same format as the records. Note the file position as the start of the data.
+Terminate the field under construction and start the next one after it.
 */
 
-static csv_errno csv_get_header(struct csv *csv, FILE * const csvfile, fpos_t *pos)
+static char *csv_arena_field(struct csv_arena *arena)
 {
-    csv_errno status = CSV_UNDEFINED;
-    
-    rewind(csvfile);
+    if (csv_arena_putc(arena, '\0') == false) return NULL;
     
-    //intermediate buffer for each file read
-    char *tmp = malloc(CSV_TEMPORARY_BUFFER_LENGTH);
-    if (tmp == NULL) return CSV_MALLOC_FAILED;
-    
-    //final target for header contents
-    csv->header = malloc(sizeof(void*) * (uint64_t) csv->rows);
-    if (csv->header == NULL) return CSV_MALLOC_FAILED;
+    char *field = arena->head->bytes + arena->field;
+    arena->field = arena->head->used;
     
-    for (uint32_t i = 0; i < csv->cols; i++)
+    return field;
+}
+
+/*******************************************************************************
+Block reader. The file is consumed in blocks of CSV_BLOCK_LENGTH bytes rather
+than one getc at a time. Each block is checked once for double quotes with
+memchr, and blocks without any quotes are handed to kernels that only look for
+delimiters and newlines. A no_quotes hint skips the check and treats '"' as
+ordinary data in every block. A reader without a file walks a caller supplied
+memory buffer in the same blocks without copying it.
+*/
+
+struct csv_reader
+{
+    FILE *file;
+    const char *source;
+    uint64_t size;
+    char *block;
+    const char *buffer;
+    size_t pos;
+    size_t len;
+    uint64_t offset;
+    uint64_t report;
+    uint64_t interval;
+    bool quotes;
+    bool no_quotes;
+    bool eof;
+    char pad[5];
+};
+
+static void csv_reader_init(struct csv_reader *reader, FILE *file, char *block, bool no_quotes)
+{
+    reader->file = file;
+    reader->source = NULL;
+    reader->size = 0;
+    reader->block = block;
+    reader->buffer = block;
+    reader->pos = 0;
+    reader->len = 0;
+    reader->offset = 0;
+    reader->report = UINT64_MAX;
+    reader->interval = UINT64_MAX;
+    reader->quotes = false;
+    reader->no_quotes = no_quotes;
+    reader->eof = false;
+}
+
+static void csv_reader_init_mem(struct csv_reader *reader, const char *bytes, size_t length, bool no_quotes)
+{
+    csv_reader_init(reader, NULL, NULL, no_quotes);
+    reader->source = bytes;
+    reader->size = length;
+}
+
+static void csv_reader_rewind(struct csv_reader *reader)
+{
+    if (reader->file != NULL) rewind(reader->file);
+    reader->report = reader->interval;
+    reader->pos = 0;
+    reader->len = 0;
+    reader->offset = 0;
+    reader->eof = false;
+}
+
+/*******************************************************************************
+Reposition the reader at an absolute byte offset. Only needed to recover from
+an unbalanced quote, which happens at most once per pass.
+*/
+
+static csv_errno csv_reader_seek(struct csv_reader *reader, uint64_t offset)
+{
+    if (reader->file == NULL)
     {
-        //load temp buffer with next field
-        status = csv_tokenize(csvfile, tmp, CSV_TEMPORARY_BUFFER_LENGTH);
-        if (status != CSV_SUCCESS) return status;
-        
-        //copy temp to size-appropriate block and save
-        csv->header[i] = malloc(strlen(tmp) + 1);
-        if (csv->header[i] == NULL) return CSV_MALLOC_FAILED;
-        strncpy(csv->header[i], tmp, strlen(tmp) + 1);
+        if (offset > reader->size) return CSV_READ_FAIL;
+    }
+    else
+    {
+        if (offset > LONG_MAX) return CSV_READ_FAIL;
+        if (fseek(reader->file, (long) offset, SEEK_SET) != 0) return CSV_READ_FAIL;
     }
     
-    free(tmp);
-    fgetpos(csvfile, pos);
+    reader->pos = 0;
+    reader->len = 0;
+    reader->offset = offset;
+    reader->eof = false;
     
-    return CSV_SUCCESS;    
+    return CSV_SUCCESS;
 }
 
-
 /*******************************************************************************
-Load flexible array of struct csv with all of the file contents. Read a field
-one by one into a temporary buffer and copy the minimal amount of memory space
-to data. Missing fields are allocated as the nul character, rather than being
-set as a null pointer. In practice this has made working with the data easier.
+Load the next block once the current one is exhausted. False at end of file.
 */
 
-static csv_errno csv_get_data(struct csv *csv, FILE * const csvfile, fpos_t data_pos)
+static bool csv_reader_fill(struct csv_reader *reader)
 {
-    csv_errno status = CSV_UNDEFINED;
-    csv->missing = 0;
-    
-    fsetpos(csvfile, &data_pos);
-    
-    //intermediate buffer for each file read
-    char *tmp = malloc(CSV_TEMPORARY_BUFFER_LENGTH);
-    if (tmp == NULL) return CSV_MALLOC_FAILED;
+    if (reader->pos < reader->len) return true;
+    if (reader->eof == true) return false;
     
-    //alloc data as a 2D array for [i][j] indexing
-    csv->data = malloc(sizeof(void*) * (uint64_t) csv->rows);
-    if (csv->data == NULL) return CSV_MALLOC_FAILED;
+    reader->offset += reader->len;
+    reader->pos = 0;
     
-    for (uint32_t i = 0; i < csv->rows; i++)
+    if (reader->file != NULL)
     {
-        csv->data[i] = malloc(sizeof(void*) * (uint64_t) csv->cols);
-        if (csv->data[i] == NULL) return CSV_MALLOC_FAILED;   
+        reader->len = fread(reader->block, 1, CSV_BLOCK_LENGTH, reader->file);
     }
-    
-    for (uint32_t i = 0; i < csv->rows; i++)
+    else
     {
-        for (uint32_t j = 0; j < csv->cols; j++)
-        {
-            //load temp buffer with next field
-            status = csv_tokenize(csvfile, tmp, CSV_TEMPORARY_BUFFER_LENGTH);
-            if (status != CSV_SUCCESS) return status;
-            
-            //load csv cell
-            if (tmp[0] == '\0') csv->missing++;
-            
-            csv->data[i][j] = malloc(strlen(tmp) + 1);
-            if (csv->data[i][j] == NULL) return CSV_MALLOC_FAILED;
-            strncpy(csv->data[i][j], tmp, strlen(tmp) + 1);
-        }
+        uint64_t rest = reader->size - reader->offset;
+        reader->len = rest < CSV_BLOCK_LENGTH ? (size_t) rest : CSV_BLOCK_LENGTH;
+        reader->buffer = reader->source + reader->offset;
     }
     
-    free(tmp);
-    return status;
+    CSV_PROBE2(block, reader->offset, reader->len);
+    
+    if (reader->len < CSV_BLOCK_LENGTH) reader->eof = true;
+    if (reader->len == 0) return false;
+    
+    reader->quotes = !reader->no_quotes && memchr(reader->buffer, '"', reader->len) != NULL;
+    
+    return true;
 }
 
-
 /*******************************************************************************
-Quite a lot of dynamic allocations happened during csv_read. First release the 
-headers, then release char data pointers, release column arrays, release row
-arrays, and finally release the struct itself. DrMemory double checks everything
-in the unit test source.
+Move forward to an absolute byte offset by consuming blocks, used to step over
+quarantined records during the data pass.
 */
 
-void csv_free(struct csv *csv)
-{    
-    for (uint32_t i = 0; i < csv->cols; i++)
+static void csv_reader_skip(struct csv_reader *reader, uint64_t offset)
+{
+    while (reader->offset + reader->pos < offset && csv_reader_fill(reader) == true)
     {
-        free(csv->header[i]);
-    }
-    
-    free(csv->header);
-    
-    for (uint32_t i = 0; i < csv->rows; i++)
-    {        
-        for (uint32_t j = 0; j < csv->cols; j++)
-        {
-            free(csv->data[i][j]);
-        }
+        uint64_t available = reader->len - reader->pos;
+        uint64_t wanted = offset - reader->offset - reader->pos;
         
-        free(csv->data[i]);
+        reader->pos += (size_t) (wanted < available ? wanted : available);
     }
+}
+
+static inline int csv_reader_getc(struct csv_reader *reader)
+{
+    if (reader->pos == reader->len && csv_reader_fill(reader) == false) return EOF;
     
-    free(csv->data);
-    
-    free(csv);
+    return (unsigned char) reader->buffer[reader->pos++];
 }
 
+static inline int csv_reader_peek(struct csv_reader *reader)
+{
+    if (reader->pos == reader->len && csv_reader_fill(reader) == false) return EOF;
+    
+    return (unsigned char) reader->buffer[reader->pos];
+}
 
 /*******************************************************************************
-Attempt to convert a row of data to an array of longs. Assumes that data is not
-missing.
+Progress reporting. Each pass compares its position with the next report offset
+once per block or row, and only calls out to the user callback every interval
+bytes. A false return from the callback cancels the parse, which then unwinds
+through the normal failure path and releases everything with the arena.
 */
 
-long *csv_rowl(struct csv *csv, const uint32_t i, const int base, csv_errno *error)
+static void csv_reader_progress(struct csv_reader *reader, const struct csv_options *options)
 {
-    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
-    if (i >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    if (options->progress == NULL) return;
     
-    long *data = malloc(sizeof(long) * csv->cols);
-    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    reader->interval = options->progress_bytes == 0 ? CSV_PROGRESS_BYTES : options->progress_bytes;
+    reader->report = reader->interval;
+}
 
-    for (uint32_t j = 0; j < csv->cols; j++)
-    {
-        errno = 0;
-        long tmp = 0;
-        char *end = NULL;
-        
-        if (csv->data[i][j][0] == '\0') STOP(error, CSV_MISSING_DATA, fail);
-        else tmp = strtol(csv->data[i][j], &end, base);
-        
-        //parse error handling
-        if (end == csv->data[i][j]) 
-            STOP(error, CSV_READ_FAIL, fail);
-        if (errno == ERANGE && tmp == LONG_MIN)
-            STOP(error, CSV_READ_UNDERFLOW, fail);
-        if (errno == ERANGE && tmp == LONG_MAX)
-            STOP(error, CSV_READ_OVERFLOW, fail);
-        if (errno == EINVAL)
-            STOP(error, CSV_INVALID_BASE, fail);
-        if (errno == 0 && *end != '\0')
-            STOP(error, CSV_READ_PARTIAL, fail);
-        if (errno != 0)
-            STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
-        
-        //success
-        assert(*end == '\0' && "missing condition");
-        data[j] = tmp;
-    }
+static inline csv_errno csv_reader_report(struct csv_reader *reader, const struct csv_options *options, uint32_t pass, uint64_t rows)
+{
+    const uint64_t bytes = reader->offset + reader->pos;
+    struct csv_progress progress;
     
-    if (error != NULL) *error = CSV_SUCCESS;
-    return data;
+    if (bytes < reader->report) return CSV_SUCCESS;
     
-    fail:
-        free(data);
-        return NULL;
+    reader->report = bytes + reader->interval;
+    progress.bytes = bytes;
+    progress.rows = rows;
+    progress.pass = pass;
     
-    early_stop:
-        return NULL;
+    return options->progress(&progress, options->progress_data) ? CSV_SUCCESS : CSV_CANCELLED;
 }
 
 /*******************************************************************************
-Attempt to convert a column of data to an array of longs. Assumes that data is
-not missing. Will likely be slower than csv_rowl due to cache thrashing.
+Quote-free kernel. Return the offset of the first delimiter or newline in the
+n bytes at p, or n if there is none. Eight bytes are tested at a time with the
+classic SWAR zero byte trick, then the matching word is resolved bytewise.
 */
 
-long *csv_coll(struct csv *csv, const uint32_t j, const int base, csv_errno *error)
+#define CSV_SWAR_ONES 0x0101010101010101ULL
+#define CSV_SWAR_HIGH 0x8080808080808080ULL
+#define CSV_SWAR_ZERO(v) (((v) - CSV_SWAR_ONES) & ~(v) & CSV_SWAR_HIGH)
+
+static size_t csv_scan_structural(const char *p, size_t n)
 {
-    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
-    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    size_t i = 0;
     
-    long *data = malloc(sizeof(long) * csv->rows);
-    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
-
-    for (uint32_t i = 0; i < csv->rows; i++)
+    for (; i + 8 <= n; i += 8)
     {
-        errno = 0;
-        long tmp = 0;
-        char *end = NULL;
+        uint64_t word = 0;
+        memcpy(&word, p + i, 8);
         
-        if (csv->data[i][j][0] == '\0') STOP(error, CSV_MISSING_DATA, fail);
-        else tmp = strtol(csv->data[i][j], &end, base);
+        uint64_t comma = word ^ (CSV_SWAR_ONES * ',');
+        uint64_t newline = word ^ (CSV_SWAR_ONES * '\n');
         
-        //parse error handling
-        if (end == csv->data[i][j]) 
-            STOP(error, CSV_READ_FAIL, fail);
-        if (errno == ERANGE && tmp == LONG_MIN)
+        if ((CSV_SWAR_ZERO(comma) | CSV_SWAR_ZERO(newline)) != 0) break;
+    }
+    
+    for (; i < n; i++)
+    {
+        if (p[i] == ',' || p[i] == '\n') return i;
+    }
+    
+    return n;
+}
+
+/*******************************************************************************
+Read a CSV file from disk into memory as a 2D array of csv cells. 
+*/
+
+struct csv *csv_read(const char * const filename, const bool header, csv_errno *error)
+{
+    struct csv_options options = {0};
+    
+    options.header = header;
+    
+    return csv_read_opts(filename, &options, error);
+}
+
+/*******************************************************************************
+The dimensions pass, the header and the data are all read through one block
+reader. The reader is rewound once after the dimensions pass and the data pass
+simply continues wherever the header left off.
+*/
+
+struct csv *csv_read_opts(const char * const filename, const struct csv_options *options, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    struct csv_options defaults = {0};
+    struct csv_reader reader;
+    struct csv *csv = NULL;
+    char *block = NULL;
+    
+    if (options == NULL) options = &defaults;
+    
+    //verify and open file
+    if (filename == NULL) STOP(error, CSV_NULL_FILENAME, early_stop);
+    FILE *csvfile = fopen(filename, "rb");
+    if (csvfile == NULL) STOP(error, CSV_INVALID_FILE, early_stop);
+    
+    block = malloc(CSV_BLOCK_LENGTH);
+    if (block == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    csv_reader_init(&reader, csvfile, block, options->no_quotes);
+    
+    //configure struct csv
+    csv = malloc(sizeof(struct csv));
+    if (csv == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    csv_init(csv, NULL);
+    csv->arena = csv_arena_new();
+    if (csv->arena == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    status = csv_parse(csv, &reader, options);
+    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    else goto success;
+    
+    //error handling
+    success:
+        free(block);
+        fclose(csvfile);
+        if (error != NULL) *error = CSV_SUCCESS;
+        return csv;
+        
+    fail:
+        free(block);
+        fclose(csvfile);
+        if (csv != NULL) csv_free(csv);
+        return NULL;
+        
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Put a struct csv into the empty state, leaving the arena to the caller.
+*/
+
+static void csv_init(struct csv *csv, struct csv_context *context)
+{
+    csv->rows = 0;
+    csv->cols = 0;
+    csv->missing = 0;
+    csv->total = 0;
+    csv->quarantined = 0;
+    csv->quarantine = NULL;
+    csv->widths = NULL;
+    csv->header = NULL;
+    csv->lookup = NULL;
+    csv->data = NULL;
+    csv->zonemap = NULL;
+    csv->context = context;
+}
+
+/*******************************************************************************
+Run the dimensions, header and data passes over an initialized reader. Shared
+by csv_read_opts() and the context readers.
+*/
+
+static csv_errno csv_parse(struct csv *csv, struct csv_reader *reader, const struct csv_options *options)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    csv_reader_progress(reader, options);
+    
+    //fetch array dimensions and quarantine malformed records
+    CSV_PROBE(dims_start);
+    status = csv_dims(csv, reader, options);
+    CSV_PROBE2(dims_done, csv->rows, csv->cols);
+    if (status != CSV_SUCCESS) return status;
+    
+    csv->total = (uint64_t) csv->rows * csv->cols;
+    
+    //padding policies can multiply a short file into a huge grid
+    if (options->max_cells != 0 && csv->total > options->max_cells) return CSV_LIMIT_EXCEEDED;
+    
+    //fetch header
+    if (options->header == true)
+    {
+        CSV_PROBE(header_start);
+        status = csv_get_header(csv, reader);
+        CSV_PROBE1(header_done, csv->cols);
+        if (status != CSV_SUCCESS) return status;
+    }
+    
+    //read each datum into a 2D array of strings (3D ragged array)
+    CSV_PROBE(data_start);
+    status = csv_get_data(csv, reader, options);
+    CSV_PROBE2(data_done, csv->rows, csv->missing);
+    if (status != CSV_SUCCESS) return status;
+    
+    //sanity checks
+    if (csv->total <= csv->missing) return CSV_UNKNOWN_FATAL_ERROR;
+    
+    return CSV_SUCCESS;
+}
+
+/*******************************************************************************
+Allocation for the row, cell and index arrays of a struct csv. A context owned
+struct carves them out of its arena, so they cost nothing once the context is
+warm and are released by the arena reset. Otherwise they come from malloc and
+are released by csv_free().
+*/
+
+static void *csv_alloc(struct csv *csv, size_t size)
+{
+    if (csv->context != NULL) return csv_arena_alloc(csv->arena, size);
+    
+    return malloc(size);
+}
+
+/*******************************************************************************
+Dimensions pass. Every record of the file is scanned once with the same quoting
+rules as the tokenizer: a quote only opens a quoted field at the start of the
+field, a doubled quote inside it is an escape, and any other quote closes it.
+The first record fixes the number of columns and every later record is checked
+against it under the ragged row policy, so validation costs nothing extra.
+Records that do not fit, or that open a quote which is never closed, fail the
+read unless the tolerant option is set, in which case they are recorded in the
+quarantine list and skipped by the data pass.
+
+Blocks without quotes jump from one delimiter or newline to the next with the
+structural scan, and blocks that lie entirely inside a quoted field only look
+for newlines to keep the line count. A quote that is never closed runs to the
+end of the file. It is then known that no quote follows it, so the scan resumes
+once after the first newline inside it and the whole pass stays linear.
+
+Field lengths are measured here in raw bytes against the max_field limit, so an
+oversized field is rejected before the data pass allocates anything for it.
+
+An empty record that does not fit is held back rather than rejected at once.
+Only the next record shows that it was a blank line inside the data, so one at
+the very end of the file, left by a trailing blank line, is simply ignored.
+*/
+
+enum csv_scan_state
+{
+    CSV_SCAN_START,
+    CSV_SCAN_UNQUOTED,
+    CSV_SCAN_QUOTED,
+    CSV_SCAN_QUOTE
+};
+
+struct csv_scan
+{
+    uint64_t start;
+    uint64_t start_line;
+    uint64_t line;
+    uint64_t resume;
+    uint64_t resume_line;
+    uint64_t records;
+    uint64_t capacity;
+    uint64_t field;
+    uint64_t max_field;
+    struct csv_quarantine blank;
+    uint32_t fields;
+    uint32_t cols;
+    enum csv_scan_state state;
+    csv_ragged ragged;
+    bool tolerant;
+    bool held;
+    char pad[6];
+};
+
+static struct csv_quarantine csv_scan_entry(const struct csv_scan *scan, uint64_t end, csv_errno reason)
+{
+    struct csv_quarantine entry;
+    
+    entry.offset = scan->start;
+    entry.length = end - scan->start;
+    entry.line = scan->start_line;
+    entry.fields = scan->fields;
+    entry.reason = reason;
+    
+    return entry;
+}
+
+static csv_errno csv_quarantine(struct csv *csv, struct csv_scan *scan, const struct csv_quarantine *entry)
+{
+    if (csv->quarantined == scan->capacity)
+    {
+        uint64_t capacity = scan->capacity == 0 ? 16 : scan->capacity * 2;
+        struct csv_quarantine *list = realloc(csv->quarantine, sizeof(struct csv_quarantine) * capacity);
+        if (list == NULL) return CSV_MALLOC_FAILED;
+        
+        csv->quarantine = list;
+        scan->capacity = capacity;
+    }
+    
+    csv->quarantine[csv->quarantined++] = *entry;
+    
+    return CSV_SUCCESS;
+}
+
+/*******************************************************************************
+A held back empty record turned out not to be the last one, so it is rejected
+or quarantined just like any other record that does not fit.
+*/
+
+static csv_errno csv_scan_release(struct csv *csv, struct csv_scan *scan)
+{
+    if (scan->held == false) return CSV_SUCCESS;
+    
+    scan->held = false;
+    
+    if (scan->tolerant == false) return CSV_FIELD_COUNT_MISMATCH;
+    
+    return csv_quarantine(csv, scan, &scan->blank);
+}
+
+static void csv_scan_reset(struct csv_scan *scan, uint64_t start)
+{
+    scan->start = start;
+    scan->field = start;
+    scan->start_line = scan->line;
+    scan->resume = 0;
+    scan->fields = 1;
+    scan->state = CSV_SCAN_START;
+}
+
+/*******************************************************************************
+Close the current record, which ends just before offset end.
+*/
+
+static csv_errno csv_scan_record(struct csv *csv, struct csv_scan *scan, uint64_t end)
+{
+    csv_errno status = csv_scan_release(csv, scan);
+    bool fits = false;
+    
+    if (status != CSV_SUCCESS) return status;
+    if (scan->cols == 0) scan->cols = scan->fields;
+    
+    switch (scan->ragged)
+    {
+        case CSV_RAGGED_ERROR:
+            fits = scan->fields == scan->cols;
+            break;
+        case CSV_RAGGED_PAD:
+            fits = scan->fields <= scan->cols;
+            break;
+        case CSV_RAGGED_TRUNCATE:
+            fits = true;
+            break;
+        case CSV_RAGGED_KEEP:
+            if (scan->fields > scan->cols) scan->cols = scan->fields;
+            fits = true;
+            break;
+    }
+    
+    if (fits == true)
+    {
+        if (++scan->records > UINT32_MAX) return CSV_NUM_ROWS_OVERFLOW;
+    }
+    else if (scan->fields == 1 && end - scan->start <= 2)
+    {
+        //a newline, possibly after a carriage return, or a single short field
+        scan->blank = csv_scan_entry(scan, end, CSV_FIELD_COUNT_MISMATCH);
+        scan->held = true;
+    }
+    else if (scan->tolerant == true)
+    {
+        struct csv_quarantine entry = csv_scan_entry(scan, end, CSV_FIELD_COUNT_MISMATCH);
+        status = csv_quarantine(csv, scan, &entry);
+    }
+    else status = CSV_FIELD_COUNT_MISMATCH;
+    
+    csv_scan_reset(scan, end);
+    
+    return status;
+}
+
+/*******************************************************************************
+Advance the scan by one byte c, where next is the offset just after c.
+*/
+
+static inline csv_errno csv_scan_byte(struct csv *csv, struct csv_scan *scan, int c, uint64_t next)
+{
+    if (scan->state == CSV_SCAN_QUOTED)
+    {
+        if (c == '"') scan->state = CSV_SCAN_QUOTE;
+        else if (c == '\n')
+        {
+            scan->line++;
+            
+            if (scan->resume == 0)
+            {
+                scan->resume = next;
+                scan->resume_line = scan->line;
+            }
+        }
+        
+        return CSV_SUCCESS;
+    }
+    
+    switch (c)
+    {
+        case ',':
+            if (next - 1 - scan->field > scan->max_field) return CSV_FIELD_LEN_OVERFLOW;
+            scan->field = next;
+            scan->state = CSV_SCAN_START;
+            if (++scan->fields == 0) return CSV_NUM_COLUMNS_OVERFLOW;
+            return CSV_SUCCESS;
+        
+        case '\n':
+            if (next - 1 - scan->field > scan->max_field) return CSV_FIELD_LEN_OVERFLOW;
+            scan->line++;
+            return csv_scan_record(csv, scan, next);
+        
+        case '"':
+            if (scan->state == CSV_SCAN_START) scan->state = CSV_SCAN_QUOTED;
+            else if (scan->state == CSV_SCAN_QUOTE) scan->state = CSV_SCAN_QUOTED;
+            return CSV_SUCCESS;
+        
+        default:
+            scan->state = CSV_SCAN_UNQUOTED;
+            return CSV_SUCCESS;
+    }
+}
+
+/******************************************************************************/
+
+static csv_errno csv_dims(struct csv *csv, struct csv_reader *reader, const struct csv_options *options)
+{
+    csv_errno status = CSV_SUCCESS;
+    struct csv_scan scan = {0};
+    
+    scan.line = 1;
+    scan.tolerant = options->tolerant;
+    scan.ragged = options->ragged;
+    scan.max_field = options->max_field == 0 ? UINT32_MAX : options->max_field;
+    csv_scan_reset(&scan, 0);
+    csv_reader_rewind(reader);
+    
+    scan:
+    while (csv_reader_fill(reader) == true)
+    {
+        const char *buffer = reader->buffer;
+        const size_t len = reader->len;
+        const uint64_t base = reader->offset;
+        size_t pos = reader->pos;
+        
+        while (pos < len && status == CSV_SUCCESS)
+        {
+            if (reader->quotes == true)
+            {
+                status = csv_scan_byte(csv, &scan, (unsigned char) buffer[pos], base + pos + 1);
+                pos++;
+            }
+            else if (scan.state == CSV_SCAN_QUOTED)
+            {
+                const char *p = memchr(buffer + pos, '\n', len - pos);
+                if (p == NULL) pos = len;
+                else
+                {
+                    pos = (size_t) (p - buffer);
+                    status = csv_scan_byte(csv, &scan, '\n', base + pos + 1);
+                    pos++;
+                }
+            }
+            else
+            {
+                size_t n = csv_scan_structural(buffer + pos, len - pos);
+                
+                if (n > 0) scan.state = CSV_SCAN_UNQUOTED;
+                pos += n;
+                
+                if (pos < len)
+                {
+                    status = csv_scan_byte(csv, &scan, (unsigned char) buffer[pos], base + pos + 1);
+                    pos++;
+                }
+            }
+        }
+        
+        reader->pos = len;
+        if (status != CSV_SUCCESS) return status;
+        
+        status = csv_reader_report(reader, options, 1, scan.records);
+        if (status != CSV_SUCCESS) return status;
+    }
+    
+    const uint64_t eof = reader->offset + reader->len;
+    
+    if (scan.state == CSV_SCAN_QUOTED)
+    {
+        if (scan.tolerant == false || scan.cols == 0) return CSV_UNBALANCED_QUOTE;
+        
+        uint64_t resume = scan.resume;
+        uint64_t resume_line = scan.resume_line;
+        struct csv_quarantine entry = csv_scan_entry(&scan, resume == 0 ? eof : resume, CSV_UNBALANCED_QUOTE);
+        
+        status = csv_scan_release(csv, &scan);
+        if (status != CSV_SUCCESS) return status;
+        
+        status = csv_quarantine(csv, &scan, &entry);
+        if (status != CSV_SUCCESS) return status;
+        
+        if (resume != 0)
+        {
+            status = csv_reader_seek(reader, resume);
+            if (status != CSV_SUCCESS) return status;
+            
+            scan.line = resume_line;
+            csv_scan_reset(&scan, resume);
+            goto scan;
+        }
+    }
+    else if (eof > scan.start || scan.cols == 0)
+    {
+        //RFC 4180 rule 2 exception to account for no CRLF on final row
+        if (eof - scan.field > scan.max_field) return CSV_FIELD_LEN_OVERFLOW;
+        
+        status = csv_scan_record(csv, &scan, eof);
+        if (status != CSV_SUCCESS) return status;
+    }
+    
+    //the held back record is only ignored if it is a bare LF or CRLF
+    if (scan.held == true)
+    {
+        status = csv_reader_seek(reader, scan.blank.offset);
+        if (status != CSV_SUCCESS) return status;
+        
+        int c = csv_reader_getc(reader);
+        if (c == '\r' && scan.blank.length == 2) c = csv_reader_getc(reader);
+        
+        if (c != '\n')
+        {
+            status = csv_scan_release(csv, &scan);
+            if (status != CSV_SUCCESS) return status;
+        }
+    }
+    
+    csv->cols = scan.cols;
+    csv->rows = (uint32_t) scan.records;
+    
+    if (options->header == true) csv->rows--;
+    
+    csv_reader_rewind(reader);
+    
+    return CSV_SUCCESS;
+}
+
+
+/*******************************************************************************
+Field tokenizer. Read next field from current reader position and append it to
+the arena as a nul-terminated string. The character that ended the field, one
+of comma, newline or EOF, is returned through end. Enclosing quotes and escape
+sequence quotes are removed. Inside a quote-free block the field is located
+with the structural scan and copied in one piece. As soon as the field reaches
+a block with quotes, the remainder is handled one byte at a time by the
+quote-aware state machine.
+*/
+
+static csv_errno csv_tokenize(struct csv_reader *reader, struct csv_arena *arena, char **field, int *end)
+{
+    uint64_t length = 0;
+    bool quoted = false;
+    int c = 0;
+    
+    while (csv_reader_fill(reader) == true && reader->quotes == false)
+    {
+        const char *p = reader->buffer + reader->pos;
+        size_t n = csv_scan_structural(p, reader->len - reader->pos);
+        
+        if (csv_arena_append(arena, p, n) == false) return CSV_MALLOC_FAILED;
+        length += n;
+        reader->pos += n;
+        
+        if (reader->pos < reader->len)
+        {
+            c = (unsigned char) reader->buffer[reader->pos++];
+            if (c == '\n') csv_arena_trim_cr(arena);
+            goto terminate;
+        }
+    }
+    
+    //opening quote is only recognized at the start of the field
+    if (length == 0 && csv_reader_peek(reader) == '"')
+    {
+        quoted = true;
+        reader->pos++;
+    }
+    
+    while ((c = csv_reader_getc(reader)) != EOF)
+    {
+        if (quoted == true && c == '"')
+        {
+            if (csv_reader_peek(reader) != '"')
+            {
+                quoted = false;
+                continue;
+            }
+            
+            reader->pos++;
+        }
+        else if (quoted == false && c == ',') break;
+        else if (quoted == false && c == '\n')
+        {
+            csv_arena_trim_cr(arena);
+            break;
+        }
+        
+        if (csv_arena_putc(arena, (char) c) == false) return CSV_MALLOC_FAILED;
+        length++;
+    }
+    
+    terminate:
+        if (length > UINT32_MAX) return CSV_FIELD_LEN_OVERFLOW;
+        
+        *end = c;
+        *field = csv_arena_field(arena);
+        if (*field == NULL) return CSV_MALLOC_FAILED;
+    
+    return CSV_SUCCESS;
+}
+
+
+/*******************************************************************************
+Read one record into cols cells. The dimensions pass has already applied the
+ragged row policy, so a record that reaches this point either fits, is short
+and gets padded with missing fields, or is long and has its trailing fields
+tokenized and dropped. The number of fields present in the file is returned
+through width.
+*/
+
+static csv_errno csv_get_record(struct csv *csv, struct csv_reader *reader, char **cells, uint32_t *width)
+{
+    csv_errno status = CSV_SUCCESS;
+    char *extra = NULL;
+    int end = ',';
+    uint32_t j = 0;
+    
+    for (j = 0; j < csv->cols && end == ','; j++)
+    {
+        status = csv_tokenize(reader, csv->arena, &cells[j], &end);
+        if (status != CSV_SUCCESS) return status;
+        
+        if (cells[j][0] == '\0') csv->missing++;
+    }
+    
+    *width = j;
+    
+    for (; j < csv->cols; j++)
+    {
+        cells[j] = csv_arena_field(csv->arena);
+        if (cells[j] == NULL) return CSV_MALLOC_FAILED;
+        
+        csv->missing++;
+    }
+    
+    while (end == ',')
+    {
+        status = csv_tokenize(reader, csv->arena, &extra, &end);
+        if (status != CSV_SUCCESS) return status;
+        
+        csv_arena_drop(csv->arena, extra);
+    }
+    
+    return CSV_SUCCESS;
+}
+
+/*******************************************************************************
+If the CSV file contains a header, dynamically allocate a ragged array of column
+names and assign to struct csv metadata. By RFC 4180 rule 3, the header has the
+same format as the records. The reader is left at the start of the data. The
+name lookup table is built once here so that name resolution never needs a
+linear scan of the header.
+*/
+
+static csv_errno csv_get_header(struct csv *csv, struct csv_reader *reader)
+{
+    csv_errno status = CSV_UNDEFINED;
+    uint32_t width = 0;
+    uint64_t missing = csv->missing;
+    
+    //final target for header contents
+    csv->header = csv_alloc(csv, sizeof(void*) * (uint64_t) csv->cols);
+    if (csv->header == NULL) return CSV_MALLOC_FAILED;
+    
+    status = csv_get_record(csv, reader, csv->header, &width);
+    if (status != CSV_SUCCESS) return status;
+    
+    //empty column names are not missing data
+    csv->missing = missing;
+    
+    return csv_build_lookup(csv);
+}
+
+/*******************************************************************************
+The lookup table has a power of two capacity of at least twice the number of
+columns, so linear probe sequences stay short even for very wide headers. Slots
+hold the column index plus one, which leaves zero to mark an empty slot.
+*/
+
+static uint64_t csv_lookup_capacity(uint32_t cols)
+{
+    uint64_t capacity = 8;
+    
+    while (capacity < 2 * (uint64_t) cols) capacity *= 2;
+    
+    return capacity;
+}
+
+static csv_errno csv_build_lookup(struct csv *csv)
+{
+    uint64_t mask = csv_lookup_capacity(csv->cols) - 1;
+    
+    csv->lookup = csv_alloc(csv, sizeof(uint32_t) * (mask + 1));
+    if (csv->lookup == NULL) return CSV_MALLOC_FAILED;
+    
+    memset(csv->lookup, 0, sizeof(uint32_t) * (mask + 1));
+    
+    for (uint32_t j = 0; j < csv->cols; j++)
+    {
+        const char *name = csv->header[j];
+        uint64_t pos = csv_hash(name, strlen(name)) & mask;
+        
+        while (csv->lookup[pos] != 0)
+        {
+            if (strcmp(csv->header[csv->lookup[pos] - 1], name) == 0) break;
+            pos = (pos + 1) & mask;
+        }
+        
+        if (csv->lookup[pos] == 0) csv->lookup[pos] = j + 1;
+    }
+    
+    return CSV_SUCCESS;
+}
+
+
+/*******************************************************************************
+Row groups hold as many whole rows as fit in CSV_ROW_GROUP_CELLS pointers, and
+always at least one row. Narrow files get a few large blocks while very wide
+files fall back to roughly one block per row without ever exceeding it.
+*/
+
+static uint32_t csv_group_rows(uint32_t cols)
+{
+    uint64_t rows = CSV_ROW_GROUP_CELLS / (cols == 0 ? 1 : cols);
+    
+    if (rows == 0) return 1;
+    if (rows > UINT32_MAX) return UINT32_MAX;
+    
+    return (uint32_t) rows;
+}
+
+/*******************************************************************************
+Load flexible array of struct csv with all of the file contents. Fields are
+tokenized straight into the arena, so there is no temporary buffer and no copy.
+The [i][j] pointers are carved out of row group blocks, and the first row of
+each group owns its block. Missing fields are allocated as the nul character,
+rather than being set as a null pointer. In practice this has made working
+with the data easier.
+*/
+
+static csv_errno csv_get_data(struct csv *csv, struct csv_reader *reader, const struct csv_options *options)
+{
+    csv_errno status = CSV_SUCCESS;
+    const uint32_t group = csv_group_rows(csv->cols);
+    char **block = NULL;
+    uint64_t next = 0;
+    csv->missing = 0;
+    
+    //alloc data as a 2D array for [i][j] indexing, unset groups stay null
+    csv->data = csv_alloc(csv, sizeof(void*) * ((uint64_t) csv->rows + 1));
+    if (csv->data == NULL) return CSV_MALLOC_FAILED;
+    
+    memset(csv->data, 0, sizeof(void*) * ((uint64_t) csv->rows + 1));
+    
+    if (options->ragged == CSV_RAGGED_KEEP)
+    {
+        csv->widths = csv_alloc(csv, sizeof(uint32_t) * ((uint64_t) csv->rows + 1));
+        if (csv->widths == NULL) return CSV_MALLOC_FAILED;
+    }
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        if (i % group == 0)
+        {
+            uint64_t n = csv->rows - i < group ? csv->rows - i : group;
+            block = csv_alloc(csv, sizeof(void*) * n * csv->cols);
+            if (block == NULL) return CSV_MALLOC_FAILED;
+        }
+        
+        csv->data[i] = block + (uint64_t) (i % group) * csv->cols;
+    }
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        //quarantined records are sorted by offset, step over any that start here
+        while (next < csv->quarantined
+               && reader->offset + reader->pos == csv->quarantine[next].offset)
+        {
+            csv_reader_skip(reader, csv->quarantine[next].offset + csv->quarantine[next].length);
+            next++;
+        }
+        
+        uint32_t width = 0;
+        
+        status = csv_reader_report(reader, options, 2, i);
+        if (status != CSV_SUCCESS) return status;
+        
+        status = csv_get_record(csv, reader, csv->data[i], &width);
+        if (status != CSV_SUCCESS) return status;
+        
+        if (csv->widths != NULL) csv->widths[i] = width;
+    }
+    
+    return status;
+}
+
+
+/*******************************************************************************
+The strings all live in the arena, so only the header array, the row group
+blocks, the row array and the indexes need to be released individually before
+the struct itself. Partially loaded structs are handled too, which lets
+csv_read clean up after a failure. DrMemory double checks everything in the
+unit test source. A context owned struct is handed back to its context instead.
+*/
+
+void csv_free(struct csv *csv)
+{    
+    if (csv == NULL) return;
+    
+    if (csv->context != NULL)
+    {
+        csv_context_reset(csv->context);
+        return;
+    }
+    
+    CSV_PROBE1(free_start, csv->total);
+    
+    free(csv->header);
+    
+    if (csv->data != NULL)
+    {
+        const uint32_t group = csv_group_rows(csv->cols);
+        
+        for (uint64_t i = 0; i < csv->rows; i += group)
+        {
+            free(csv->data[i]);
+        }
+    }
+    
+    free(csv->data);
+    free(csv->quarantine);
+    free(csv->widths);
+    csv_arena_free(csv->arena);
+    
+    free(csv->lookup);
+    csv_zonemap_free(csv->zonemap);
+    
+    free(csv);
+    
+    CSV_PROBE(free_done);
+}
+
+/*******************************************************************************
+Reusable parser context. The context owns a struct csv, the block buffer and an
+arena whose slabs survive every reset, so once it has parsed a file of a given
+size, parsing another one like it needs no allocation beyond fopen. The header,
+lookup, row and cell arrays are carved out of the same arena as the strings.
+*/
+
+struct csv_context
+{
+    struct csv csv;
+    struct csv_options options;
+    char *block;
+};
+
+struct csv_context *csv_context_new(const struct csv_options *options, csv_errno *error)
+{
+    struct csv_context *context = malloc(sizeof(struct csv_context));
+    if (context == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    csv_init(&context->csv, context);
+    context->csv.arena = csv_arena_new();
+    context->block = malloc(CSV_BLOCK_LENGTH);
+    
+    if (context->csv.arena == NULL || context->block == NULL)
+    {
+        STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    if (options != NULL) context->options = *options;
+    else memset(&context->options, 0, sizeof(struct csv_options));
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return context;
+    
+    fail:
+        csv_context_free(context);
+        return NULL;
+        
+    early_stop:
+        return NULL;
+}
+
+void csv_context_reset(struct csv_context *context)
+{
+    if (context == NULL) return;
+    
+    struct csv *csv = &context->csv;
+    
+    //everything but the quarantine list and the zone map lives in the arena
+    free(csv->quarantine);
+    csv_zonemap_free(csv->zonemap);
+    csv_arena_reset(csv->arena);
+    
+    csv_init(csv, context);
+}
+
+void csv_context_free(struct csv_context *context)
+{
+    if (context == NULL) return;
+    
+    csv_context_reset(context);
+    csv_arena_free(context->csv.arena);
+    free(context->block);
+    free(context);
+}
+
+/*******************************************************************************
+Memory accounting. Every allocation of a struct csv has a size that follows
+from its dimensions, so the report is computed from rows, cols and the arena
+slab list without walking the cells. Cell string bytes are whatever the arena
+holds beyond the header names and the arrays carved out of it. The allocator
+overhead is estimated as a fixed header per allocation plus the unused tails of
+the arena slabs.
+*/
+
+#define CSV_MALLOC_OVERHEAD 16
+
+bool csv_memory_usage(const struct csv *csv, struct csv_memory *usage, csv_errno *error)
+{
+    const uint64_t word = sizeof(void*);
+    uint64_t allocations = 2;
+    uint64_t names = 0;
+    uint64_t used = 0;
+    uint64_t spare = 0;
+    
+    if (csv == NULL || usage == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    memset(usage, 0, sizeof(struct csv_memory));
+    
+    for (const struct csv_slab *slab = csv->arena->head; slab != NULL; slab = slab->next)
+    {
+        used += slab->used;
+        allocations++;
+    }
+    
+    for (const struct csv_slab *slab = csv->arena->spare; slab != NULL; slab = slab->next)
+    {
+        spare += slab->size;
+        allocations++;
+    }
+    
+    //arrays that a context carves out of the arena are not separate allocations
+    const bool owned = csv->context == NULL;
+    
+    if (csv->header != NULL)
+    {
+        for (uint32_t j = 0; j < csv->cols; j++) names += strlen(csv->header[j]) + 1;
+        
+        usage->header = word * csv->cols + names;
+        allocations += owned;
+    }
+    
+    if (csv->data != NULL)
+    {
+        const uint32_t group = csv_group_rows(csv->cols);
+        
+        usage->pointers = word * ((uint64_t) csv->rows + 1) + word * csv->rows * csv->cols;
+        if (owned) allocations += 1 + ((uint64_t) csv->rows + group - 1) / group;
+    }
+    
+    if (csv->widths != NULL)
+    {
+        usage->pointers += sizeof(uint32_t) * ((uint64_t) csv->rows + 1);
+        allocations += owned;
+    }
+    
+    if (csv->lookup != NULL)
+    {
+        usage->indexes += sizeof(uint32_t) * csv_lookup_capacity(csv->cols);
+        allocations += owned;
+    }
+    
+    if (csv->quarantine != NULL)
+    {
+        uint64_t capacity = 16;
+        
+        while (capacity < csv->quarantined) capacity *= 2;
+        
+        usage->indexes += sizeof(struct csv_quarantine) * capacity;
+        allocations++;
+    }
+    
+    if (csv->zonemap != NULL)
+    {
+        const struct csv_zonemap *map = csv->zonemap;
+        
+        usage->indexes += sizeof(struct csv_zonemap) + sizeof(bool) * csv->cols + 1;
+        usage->indexes += sizeof(struct csv_zone) * map->blocks * csv->cols + 1;
+        allocations += 3;
+    }
+    
+    usage->cells = used - csv->arena->carved - names;
+    usage->caches = spare;
+    
+    if (owned == false) usage->caches += CSV_BLOCK_LENGTH;
+    
+    usage->overhead = allocations * CSV_MALLOC_OVERHEAD + sizeof(struct csv) + sizeof(struct csv_arena);
+    usage->overhead += csv->arena->capacity - spare - used;
+    
+    usage->total = usage->cells + usage->pointers + usage->header + usage->indexes;
+    usage->total += usage->caches + usage->overhead;
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    early_stop:
+        return false;
+}
+
+/*******************************************************************************
+The file is read unbuffered, since the reader already asks for whole blocks and
+a stdio buffer would only add an allocation and a copy per file.
+*/
+
+struct csv *csv_context_read(struct csv_context *context, const char * const filename, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    struct csv_reader reader;
+    
+    if (context == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (filename == NULL) STOP(error, CSV_NULL_FILENAME, early_stop);
+    
+    csv_context_reset(context);
+    
+    FILE *csvfile = fopen(filename, "rb");
+    if (csvfile == NULL) STOP(error, CSV_INVALID_FILE, early_stop);
+    
+    setvbuf(csvfile, NULL, _IONBF, 0);
+    csv_reader_init(&reader, csvfile, context->block, context->options.no_quotes);
+    
+    status = csv_parse(&context->csv, &reader, &context->options);
+    fclose(csvfile);
+    
+    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return &context->csv;
+    
+    fail:
+        csv_context_reset(context);
+        return NULL;
+        
+    early_stop:
+        return NULL;
+}
+
+struct csv *csv_context_read_mem(struct csv_context *context, const char *bytes, const size_t length, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    struct csv_reader reader;
+    
+    if (context == NULL || bytes == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    csv_context_reset(context);
+    csv_reader_init_mem(&reader, bytes, length, context->options.no_quotes);
+    
+    status = csv_parse(&context->csv, &reader, &context->options);
+    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return &context->csv;
+    
+    fail:
+        csv_context_reset(context);
+        return NULL;
+        
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Latency histograms. Buckets follow the HDR histogram layout with 32 sub-buckets
+per power of two, so recording is a shift and an add and the relative error is
+bounded at every scale. Counters are updated with relaxed atomics because the
+producer records from the parsing thread and from every consumer at once. Each
+histogram costs about 11 KiB and only exists with the latency option.
+*/
+
+#define CSV_LATENCY_EXACT 64
+#define CSV_LATENCY_SUB 32
+#define CSV_LATENCY_KINDS 3
+
+static uint64_t csv_clock(void)
+{
+    #ifdef CSV_POSIX
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+    #else
+    return (uint64_t) ((double) clock() * (1e9 / CLOCKS_PER_SEC));
+    #endif
+}
+
+static uint32_t csv_latency_index(uint64_t ns)
+{
+    uint32_t msb = 0;
+    
+    if (ns < CSV_LATENCY_EXACT) return (uint32_t) ns;
+    
+    while ((ns >> msb) > 1) msb++;
+    
+    uint64_t index = CSV_LATENCY_EXACT + (uint64_t) (msb - 6) * CSV_LATENCY_SUB + ((ns >> (msb - 5)) - CSV_LATENCY_SUB);
+    
+    return index < CSV_LATENCY_BUCKETS ? (uint32_t) index : CSV_LATENCY_BUCKETS - 1;
+}
+
+/*******************************************************************************
+Highest value that lands in bucket index.
+*/
+
+static uint64_t csv_latency_value(uint32_t index)
+{
+    if (index < CSV_LATENCY_EXACT) return index;
+    
+    uint32_t k = index - CSV_LATENCY_EXACT;
+    uint32_t shift = k / CSV_LATENCY_SUB + 1;
+    uint64_t sub = k % CSV_LATENCY_SUB + CSV_LATENCY_SUB;
+    
+    return ((sub + 1) << shift) - 1;
+}
+
+static struct csv_latency *csv_latency_new(void)
+{
+    struct csv_latency *latency = calloc(CSV_LATENCY_KINDS, sizeof(struct csv_latency));
+    if (latency == NULL) return NULL;
+    
+    for (uint32_t k = 0; k < CSV_LATENCY_KINDS; k++) latency[k].min = UINT64_MAX;
+    
+    return latency;
+}
+
+static void csv_latency_record(struct csv_latency *latency, uint64_t ns)
+{
+    #ifdef CSV_PTHREADS
+    uint64_t seen = __atomic_load_n(&latency->min, __ATOMIC_RELAXED);
+    
+    while (ns < seen && !__atomic_compare_exchange_n(&latency->min, &seen, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    
+    seen = __atomic_load_n(&latency->max, __ATOMIC_RELAXED);
+    
+    while (ns > seen && !__atomic_compare_exchange_n(&latency->max, &seen, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    
+    __atomic_add_fetch(&latency->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&latency->sum, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&latency->buckets[csv_latency_index(ns)], 1, __ATOMIC_RELAXED);
+    #else
+    if (ns < latency->min) latency->min = ns;
+    if (ns > latency->max) latency->max = ns;
+    
+    latency->count++;
+    latency->sum += ns;
+    latency->buckets[csv_latency_index(ns)]++;
+    #endif
+}
+
+static void csv_latency_copy(struct csv_latency *target, const struct csv_latency *source)
+{
+    #ifdef CSV_PTHREADS
+    target->count = __atomic_load_n(&source->count, __ATOMIC_RELAXED);
+    target->min = __atomic_load_n(&source->min, __ATOMIC_RELAXED);
+    target->max = __atomic_load_n(&source->max, __ATOMIC_RELAXED);
+    target->sum = __atomic_load_n(&source->sum, __ATOMIC_RELAXED);
+    
+    for (uint32_t k = 0; k < CSV_LATENCY_BUCKETS; k++)
+    {
+        target->buckets[k] = __atomic_load_n(&source->buckets[k], __ATOMIC_RELAXED);
+    }
+    #else
+    *target = *source;
+    #endif
+}
+
+static bool csv_latency_get(const struct csv_latency *source, const csv_latency_kind kind, struct csv_latency *latency, csv_errno *error)
+{
+    if (latency == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (source == NULL || (uint32_t) kind >= CSV_LATENCY_KINDS) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    csv_latency_copy(latency, &source[kind]);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    early_stop:
+        return false;
+}
+
+uint64_t csv_latency_percentile(const struct csv_latency *latency, const double percentile)
+{
+    if (latency == NULL || latency->count == 0) return 0;
+    
+    double wanted = percentile / 100.0 * (double) latency->count;
+    uint64_t rank = wanted < 1.0 ? 1 : (uint64_t) ceil(wanted);
+    uint64_t seen = 0;
+    
+    if (rank > latency->count) rank = latency->count;
+    
+    for (uint32_t k = 0; k < CSV_LATENCY_BUCKETS; k++)
+    {
+        seen += latency->buckets[k];
+        
+        if (seen >= rank)
+        {
+            uint64_t value = csv_latency_value(k);
+            return value < latency->max ? value : latency->max;
+        }
+    }
+    
+    return latency->max;
+}
+
+/*******************************************************************************
+Push parser. Input arrives in chunks of any size and is never rewound, so there
+is no dimensions pass. The column count comes from the first record and the
+ragged policy is applied as each record closes. The field under construction
+lives at the end of the arena head slab between calls, and the quote state is
+kept in the same four states as the scan of csv_dims, so a record may be split
+across any number of chunks. Unquoted runs are located with the structural
+scan and quoted runs with memchr, so each byte is looked at a constant number
+of times. Completed records are handed to the callback and the arena is reset
+with its capacity kept, which bounds memory by the longest record.
+
+A stream cannot be rewound, so tolerant mode copies the raw bytes of a record
+from the first newline inside a quoted field. If the quote is still open at the
+end of the stream, the record is skipped and parsing resumes from that copy,
+which is where the dimensions pass of csv_read resumes too.
+
+An empty record that does not fit is held back the same way as in the scan of
+csv_dims. The next record releases it as a mismatch, and the end of the stream
+drops it, since only a bare LF or CRLF closes an empty record here.
+*/
+
+struct csv_parser
+{
+    struct csv_options options;
+    csv_record_fn on_record;
+    void *data;
+    struct csv_arena *arena;
+    char **fields;
+    char **header;
+    char *block;
+    char *tail;
+    size_t tail_length;
+    size_t tail_capacity;
+    struct csv_latency *latency;
+    struct csv_parser_stats stats;
+    uint64_t callbacks;
+    uint64_t field;
+    uint64_t max_field;
+    uint64_t extra;
+    uint64_t report;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t cols;
+    enum csv_scan_state state;
+    csv_errno status;
+    bool recording;
+    bool finished;
+    bool held;
+    char pad;
+};
+
+struct csv_parser *csv_parser_new(const struct csv_options *options, csv_record_fn on_record, void *data, csv_errno *error)
+{
+    if (on_record == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    struct csv_parser *parser = malloc(sizeof(struct csv_parser));
+    if (parser == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    if (options != NULL) parser->options = *options;
+    else memset(&parser->options, 0, sizeof(struct csv_options));
+    
+    parser->on_record = on_record;
+    parser->data = data;
+    parser->arena = csv_arena_new();
+    parser->fields = NULL;
+    parser->header = NULL;
+    parser->block = NULL;
+    parser->tail = NULL;
+    parser->tail_length = 0;
+    parser->tail_capacity = 0;
+    parser->latency = NULL;
+    parser->stats.bytes = 0;
+    parser->stats.records = 0;
+    parser->stats.skipped = 0;
+    parser->callbacks = 0;
+    parser->field = 0;
+    parser->max_field = parser->options.max_field == 0 ? UINT32_MAX : parser->options.max_field;
+    parser->extra = 0;
+    parser->report = UINT64_MAX;
+    parser->count = 0;
+    parser->capacity = 0;
+    parser->cols = 0;
+    parser->state = CSV_SCAN_START;
+    parser->status = CSV_SUCCESS;
+    parser->recording = false;
+    parser->finished = false;
+    parser->held = false;
+    
+    if (parser->options.progress != NULL)
+    {
+        parser->options.progress_bytes = parser->options.progress_bytes == 0 ? CSV_PROGRESS_BYTES : parser->options.progress_bytes;
+        parser->report = parser->options.progress_bytes;
+    }
+    
+    if (parser->options.latency == true) parser->latency = csv_latency_new();
+    
+    if (parser->arena == NULL || (parser->options.latency == true && parser->latency == NULL))
+    {
+        csv_parser_free(parser);
+        STOP(error, CSV_MALLOC_FAILED, early_stop);
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return parser;
+    
+    early_stop:
+        return NULL;
+}
+
+void csv_parser_free(struct csv_parser *parser)
+{
+    if (parser == NULL) return;
+    
+    csv_arena_free(parser->arena);
+    free(parser->fields);
+    free(parser->header);
+    free(parser->block);
+    free(parser->tail);
+    free(parser->latency);
+    free(parser);
+}
+
+/*******************************************************************************
+Close the field under construction. Fields beyond the column count are only
+counted, and their bytes are handed straight back to the arena.
+*/
+
+static csv_errno csv_parser_field(struct csv_parser *parser)
+{
+    if (parser->field > parser->max_field) return CSV_FIELD_LEN_OVERFLOW;
+    
+    char *field = csv_arena_field(parser->arena);
+    if (field == NULL) return CSV_MALLOC_FAILED;
+    
+    parser->field = 0;
+    
+    if (parser->cols != 0 && parser->count >= parser->cols && parser->options.ragged != CSV_RAGGED_KEEP)
+    {
+        csv_arena_drop(parser->arena, field);
+        parser->extra++;
+        return CSV_SUCCESS;
+    }
+    
+    if (parser->count == parser->capacity)
+    {
+        if (parser->capacity == UINT32_MAX) return CSV_NUM_COLUMNS_OVERFLOW;
+        
+        uint64_t capacity = parser->capacity == 0 ? 16 : 2 * (uint64_t) parser->capacity;
+        if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+        
+        char **fields = realloc(parser->fields, sizeof(void*) * capacity);
+        if (fields == NULL) return CSV_MALLOC_FAILED;
+        
+        parser->fields = fields;
+        parser->capacity = (uint32_t) capacity;
+    }
+    
+    parser->fields[parser->count++] = field;
+    
+    return CSV_SUCCESS;
+}
+
+/*******************************************************************************
+Keep the first record as the header, in one block that outlives the arena.
+*/
+
+static csv_errno csv_parser_keep_header(struct csv_parser *parser)
+{
+    size_t bytes = sizeof(void*) * parser->count;
+    
+    for (uint32_t j = 0; j < parser->count; j++) bytes += strlen(parser->fields[j]) + 1;
+    
+    parser->header = malloc(bytes);
+    if (parser->header == NULL) return CSV_MALLOC_FAILED;
+    
+    char *next = (char *) (parser->header + parser->count);
+    
+    for (uint32_t j = 0; j < parser->count; j++)
+    {
+        size_t length = strlen(parser->fields[j]) + 1;
+        memcpy(next, parser->fields[j], length);
+        parser->header[j] = next;
+        next += length;
+    }
+    
+    return CSV_SUCCESS;
+}
+
+/*******************************************************************************
+Close the current record and apply the ragged policy the same way as
+csv_scan_record, then pad short records and deliver the result.
+*/
+
+static void csv_parser_restart(struct csv_parser *parser)
+{
+    csv_arena_reset(parser->arena);
+    parser->count = 0;
+    parser->extra = 0;
+    parser->field = 0;
+    parser->tail_length = 0;
+    parser->recording = false;
+    parser->state = CSV_SCAN_START;
+}
+
+/*******************************************************************************
+A held back empty record turned out not to be the last one, so it fails or is
+skipped like any other record that does not fit.
+*/
+
+static csv_errno csv_parser_release(struct csv_parser *parser)
+{
+    if (parser->held == false) return CSV_SUCCESS;
+    
+    parser->held = false;
+    
+    if (parser->options.tolerant == false) return CSV_FIELD_COUNT_MISMATCH;
+    
+    parser->stats.skipped++;
+    return CSV_SUCCESS;
+}
+
+static csv_errno csv_parser_record(struct csv_parser *parser)
+{
+    //no field yet and at most the carriage return that csv_arena_trim_cr removed
+    const bool empty = parser->count == 0 && parser->extra == 0 && parser->field <= 1;
+    csv_errno status = csv_parser_release(parser);
+    bool fits = false;
+    
+    if (status != CSV_SUCCESS) return status;
+    
+    status = csv_parser_field(parser);
+    if (status != CSV_SUCCESS) return status;
+    
+    const uint64_t width = parser->count + parser->extra;
+    
+    if (parser->cols == 0)
+    {
+        parser->cols = parser->count;
+        
+        if (parser->options.header == true)
+        {
+            status = csv_parser_keep_header(parser);
+            goto reset;
+        }
+    }
+    
+    switch (parser->options.ragged)
+    {
+        case CSV_RAGGED_ERROR:
+            fits = width == parser->cols;
+            break;
+        case CSV_RAGGED_PAD:
+            fits = width <= parser->cols;
+            break;
+        case CSV_RAGGED_TRUNCATE:
+        case CSV_RAGGED_KEEP:
+            fits = true;
+            break;
+    }
+    
+    if (fits == false)
+    {
+        if (empty == true && parser->fields[0][0] == '\0') parser->held = true;
+        else if (parser->options.tolerant == false) return CSV_FIELD_COUNT_MISMATCH;
+        else parser->stats.skipped++;
+        
+        goto reset;
+    }
+    
+    while (parser->options.ragged != CSV_RAGGED_KEEP && parser->count < parser->cols)
+    {
+        status = csv_parser_field(parser);
+        if (status != CSV_SUCCESS) return status;
+    }
+    
+    const uint64_t start = parser->latency == NULL ? 0 : csv_clock();
+    const bool proceed = parser->on_record(parser->fields, parser->count, parser->stats.records, parser->data);
+    
+    if (parser->latency != NULL)
+    {
+        const uint64_t elapsed = csv_clock() - start;
+        
+        csv_latency_record(&parser->latency[CSV_LATENCY_CALLBACK], elapsed);
+        parser->callbacks += elapsed;
+    }
+    
+    if (proceed == false) return CSV_CANCELLED;
+    
+    parser->stats.records++;
+    
+    reset:
+        csv_parser_restart(parser);
+    
+    return status;
+}
+
+static bool csv_parser_record_tail(struct csv_parser *parser, const char *bytes, size_t n)
+{
+    if (n == 0) return true;
+    
+    if (parser->tail_capacity - parser->tail_length < n)
+    {
+        size_t capacity = 2 * (parser->tail_length + n);
+        char *tail = realloc(parser->tail, capacity);
+        if (tail == NULL) return false;
+        
+        parser->tail = tail;
+        parser->tail_capacity = capacity;
+    }
+    
+    memcpy(parser->tail + parser->tail_length, bytes, n);
+    parser->tail_length += n;
+    
+    return true;
+}
+
+static csv_errno csv_parser_bytes(struct csv_parser *parser, const char *bytes, size_t length)
+{
+    csv_errno status = CSV_SUCCESS;
+    size_t pos = 0;
+    
+    while (pos < length && status == CSV_SUCCESS)
+    {
+        const char *p = bytes + pos;
+        size_t from = pos;
+        size_t n = 0;
+        
+        switch (parser->state)
+        {
+            case CSV_SCAN_START:
+                if (*p == '"' && parser->options.no_quotes == false)
+                {
+                    parser->state = CSV_SCAN_QUOTED;
+                    parser->field++;
+                    pos++;
+                    break;
+                }
+                
+                parser->state = CSV_SCAN_UNQUOTED;
+                break;
+            
+            case CSV_SCAN_UNQUOTED:
+                n = csv_scan_structural(p, length - pos);
+                
+                if (csv_arena_append(parser->arena, p, n) == false) return CSV_MALLOC_FAILED;
+                parser->field += n;
+                pos += n;
+                
+                if (pos == length) break;
+                
+                pos++;
+                parser->state = CSV_SCAN_START;
+                
+                if (p[n] == ',') status = csv_parser_field(parser);
+                else
+                {
+                    csv_arena_trim_cr(parser->arena);
+                    status = csv_parser_record(parser);
+                }
+                
+                break;
+            
+            case CSV_SCAN_QUOTED:
+                p = memchr(p, '"', length - pos);
+                n = p == NULL ? length - pos : (size_t) (p - bytes) - pos;
+                
+                if (parser->options.tolerant == true && parser->recording == false)
+                {
+                    const char *newline = memchr(bytes + pos, '\n', n);
+                    
+                    if (newline != NULL)
+                    {
+                        parser->recording = true;
+                        from = (size_t) (newline - bytes) + 1;
+                    }
+                }
+                
+                if (csv_arena_append(parser->arena, bytes + pos, n) == false) return CSV_MALLOC_FAILED;
+                parser->field += n;
+                pos += n;
+                
+                if (p == NULL) break;
+                
+                parser->state = CSV_SCAN_QUOTE;
+                parser->field++;
+                pos++;
+                break;
+            
+            case CSV_SCAN_QUOTE:
+                //an escaped quote stays quoted, anything else continues unquoted
+                if (*p != '"')
+                {
+                    parser->state = CSV_SCAN_UNQUOTED;
+                    break;
+                }
+                
+                if (csv_arena_putc(parser->arena, '"') == false) return CSV_MALLOC_FAILED;
+                parser->state = CSV_SCAN_QUOTED;
+                parser->field++;
+                pos++;
+                break;
+        }
+        
+        if (parser->recording == true && csv_parser_record_tail(parser, bytes + from, pos - from) == false)
+        {
+            return CSV_MALLOC_FAILED;
+        }
+        
+        if (parser->field > parser->max_field) return CSV_FIELD_LEN_OVERFLOW;
+    }
+    
+    return status;
+}
+
+/*******************************************************************************
+A failed parser keeps its status, so every later call reports the same error.
+*/
+
+bool csv_parser_feed(struct csv_parser *parser, const char *bytes, const size_t length, csv_errno *error)
+{
+    if (parser == NULL || (bytes == NULL && length > 0)) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (parser->status != CSV_SUCCESS) STOP(error, parser->status, early_stop);
+    if (parser->finished == true) STOP(error, CSV_READ_FAIL, early_stop);
+    
+    //callback time is measured separately and taken out of the parse time
+    const uint64_t start = parser->latency == NULL ? 0 : csv_clock();
+    parser->callbacks = 0;
+    
+    parser->status = csv_parser_bytes(parser, bytes, length);
+    parser->stats.bytes += length;
+    
+    if (parser->latency != NULL)
+    {
+        csv_latency_record(&parser->latency[CSV_LATENCY_PARSE], csv_clock() - start - parser->callbacks);
+    }
+    
+    if (parser->status == CSV_SUCCESS && parser->stats.bytes >= parser->report)
+    {
+        struct csv_progress progress;
+        
+        parser->report = parser->stats.bytes + parser->options.progress_bytes;
+        progress.bytes = parser->stats.bytes;
+        progress.rows = parser->stats.records;
+        progress.pass = 2;
+        
+        if (parser->options.progress(&progress, parser->options.progress_data) == false)
+        {
+            parser->status = CSV_CANCELLED;
+        }
+    }
+    
+    if (parser->status != CSV_SUCCESS) STOP(error, parser->status, early_stop);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    early_stop:
+        return false;
+}
+
+/*******************************************************************************
+RFC 4180 rule 2 exception, the final record may end without a newline. A quote
+that is still open at the end of the stream fails, or in tolerant mode drops
+the record it belongs to. A record still held back at this point was left by a
+trailing blank line and is dropped.
+*/
+
+bool csv_parser_finish(struct csv_parser *parser, csv_errno *error)
+{
+    if (parser == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (parser->status != CSV_SUCCESS) STOP(error, parser->status, early_stop);
+    if (parser->finished == true) goto done;
+    
+    parser->finished = true;
+    
+    while (parser->status == CSV_SUCCESS && parser->state == CSV_SCAN_QUOTED)
+    {
+        if (parser->options.tolerant == false || parser->cols == 0)
+        {
+            parser->status = CSV_UNBALANCED_QUOTE;
+            break;
+        }
+        
+        //take the copy before the restart clears it, then parse it again
+        char *tail = parser->tail;
+        size_t length = parser->recording == true ? parser->tail_length : 0;
+        
+        parser->tail = NULL;
+        parser->tail_capacity = 0;
+        parser->stats.skipped++;
+        csv_parser_release(parser);
+        csv_parser_restart(parser);
+        
+        parser->status = csv_parser_bytes(parser, tail, length);
+        free(tail);
+    }
+    
+    if (parser->status == CSV_SUCCESS && (parser->state != CSV_SCAN_START || parser->count > 0 || parser->extra > 0))
+    {
+        parser->status = csv_parser_record(parser);
+    }
+    
+    parser->held = false;
+    
+    if (parser->status != CSV_SUCCESS) STOP(error, parser->status, early_stop);
+    
+    done:
+        if (error != NULL) *error = CSV_SUCCESS;
+        return true;
+    
+    early_stop:
+        return false;
+}
+
+/*******************************************************************************
+Each call makes at most CSV_PUMP_READS reads into a block owned by the parser,
+so a stream that is always readable still yields to the caller's event loop.
+*/
+
+csv_pump csv_parser_pump(struct csv_parser *parser, const int fd, csv_errno *error)
+{
+    if (parser == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (parser->status != CSV_SUCCESS) STOP(error, parser->status, early_stop);
+    if (parser->finished == true) goto end;
+    
+    #ifdef CSV_POSIX
+    if (parser->block == NULL)
+    {
+        parser->block = malloc(CSV_BLOCK_LENGTH);
+        if (parser->block == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    }
+    
+    for (uint32_t k = 0; k < CSV_PUMP_READS; k++)
+    {
+        ssize_t n = read(fd, parser->block, CSV_BLOCK_LENGTH);
+        
+        if (n > 0)
+        {
+            if (csv_parser_feed(parser, parser->block, (size_t) n, error) == false) return CSV_PUMP_ERROR;
+        }
+        else if (n == 0)
+        {
+            if (csv_parser_finish(parser, error) == false) return CSV_PUMP_ERROR;
+            goto end;
+        }
+        else if (errno == EINTR) k--;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            if (error != NULL) *error = CSV_SUCCESS;
+            return CSV_PUMP_AGAIN;
+        }
+        else
+        {
+            parser->status = CSV_READ_FAIL;
+            STOP(error, CSV_READ_FAIL, early_stop);
+        }
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return CSV_PUMP_MORE;
+    #else
+    (void) fd;
+    STOP(error, CSV_READ_FAIL, early_stop);
+    #endif
+    
+    end:
+        if (error != NULL) *error = CSV_SUCCESS;
+        return CSV_PUMP_EOF;
+    
+    early_stop:
+        return CSV_PUMP_ERROR;
+}
+
+char **csv_parser_header(const struct csv_parser *parser, uint32_t *n)
+{
+    if (parser == NULL || parser->header == NULL) return NULL;
+    
+    if (n != NULL) *n = parser->cols;
+    return parser->header;
+}
+
+bool csv_parser_latency(const struct csv_parser *parser, const csv_latency_kind kind, struct csv_latency *latency, csv_errno *error)
+{
+    if (parser == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    return csv_latency_get(parser->latency, kind, latency, error);
+    
+    early_stop:
+        return false;
+}
+
+bool csv_parser_stats(const struct csv_parser *parser, struct csv_parser_stats *stats)
+{
+    if (parser == NULL || stats == NULL) return false;
+    
+    *stats = parser->stats;
+    return true;
+}
+
+/*******************************************************************************
+Batch fan-out. A producer thread runs the push parser and copies each record
+into the arena of the current batch, then publishes full batches to a bounded
+multi producer multi consumer ring. Consumers hand batches back through a
+second ring of the same capacity that serves as free list, and a recycled
+batch keeps its arena capacity, so the steady state does not call malloc.
+
+The rings are the bounded queue of Dmitry Vyukov. Every slot carries a sequence
+number that tells producers and consumers whose turn the slot is, so a push or
+pop is one compare and swap on the ring position plus an acquire load and a
+release store on the slot. Head and tail sit on separate cache lines.
+
+Only waiting takes a lock. A thread that finds its ring empty registers in the
+waiter count of the ring and checks the ring once more under the lock before it
+sleeps. The other side publishes and only then reads the waiter count with a
+read-modify-write, which orders it against the registration of the waiter, so
+either it sees the waiter and signals, or the waiter sees the item. The common
+path never touches the mutex.
+*/
+
+#define CSV_CACHE_LINE 64
+#define CSV_RING_SPINS 64
+
+struct csv_rows_node
+{
+    struct csv_rows rows;
+    uint64_t started;
+    uint64_t published;
+    uint64_t taken;
+};
+
+struct csv_ring_slot
+{
+    uint64_t sequence;
+    struct csv_rows *rows;
+};
+
+struct csv_ring
+{
+    struct csv_ring_slot *slots;
+    uint64_t mask;
+    char pad0[CSV_CACHE_LINE];
+    uint64_t head;
+    char pad1[CSV_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t tail;
+    char pad2[CSV_CACHE_LINE - sizeof(uint64_t) - sizeof(uint32_t)];
+    uint32_t waiters;
+    #ifdef CSV_PTHREADS
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    #endif
+};
+
+struct csv_producer
+{
+    struct csv_ring ready;
+    struct csv_ring free;
+    struct csv_parser *parser;
+    struct csv_rows **batches;
+    struct csv_rows *current;
+    struct csv_latency *latency;
+    uint32_t allocated;
+    uint32_t depth;
+    uint32_t batch_rows;
+    csv_errno status;
+    csv_errno failure;
+    bool produced;
+    bool closed;
+    bool cancelled;
+    char pad;
+};
+
+#ifdef CSV_PTHREADS
+
+static bool csv_ring_init(struct csv_ring *ring, uint32_t depth)
+{
+    uint64_t capacity = 1;
+    
+    while (capacity < depth) capacity *= 2;
+    
+    ring->slots = malloc(sizeof(struct csv_ring_slot) * capacity);
+    if (ring->slots == NULL) return false;
+    
+    for (uint64_t k = 0; k < capacity; k++) ring->slots[k].sequence = k;
+    
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->waiters = 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    
+    return true;
+}
+
+static void csv_ring_free(struct csv_ring *ring)
+{
+    if (ring->slots == NULL) return;
+    
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->cond);
+    free(ring->slots);
+}
+
+static bool csv_ring_push(struct csv_ring *ring, struct csv_rows *rows)
+{
+    uint64_t pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    struct csv_ring_slot *slot = NULL;
+    
+    while (true)
+    {
+        slot = &ring->slots[pos & ring->mask];
+        int64_t diff = (int64_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+        else if (diff < 0) return false;
+        else pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    }
+    
+    slot->rows = rows;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    
+    return true;
+}
+
+static struct csv_rows *csv_ring_pop(struct csv_ring *ring)
+{
+    uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    struct csv_ring_slot *slot = NULL;
+    
+    while (true)
+    {
+        slot = &ring->slots[pos & ring->mask];
+        int64_t diff = (int64_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+        
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+        else if (diff < 0) return NULL;
+        else pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    }
+    
+    struct csv_rows *rows = slot->rows;
+    __atomic_store_n(&slot->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+    
+    return rows;
+}
+
+/*******************************************************************************
+Wake the waiters of a ring after a push. Closing or cancelling broadcasts.
+*/
+
+static void csv_ring_signal(struct csv_ring *ring, bool all)
+{
+    if (all == false && __atomic_add_fetch(&ring->waiters, 0, __ATOMIC_SEQ_CST) == 0) return;
+    
+    pthread_mutex_lock(&ring->lock);
+    if (all == true) pthread_cond_broadcast(&ring->cond);
+    else pthread_cond_signal(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/*******************************************************************************
+Pop from a ring, spinning briefly and then sleeping until an item arrives or
+the flag at stop is set. Null once stopped and empty.
+*/
+
+static struct csv_rows *csv_ring_wait(struct csv_ring *ring, const bool *stop)
+{
+    struct csv_rows *rows = NULL;
+    
+    for (uint32_t k = 0; k < CSV_RING_SPINS; k++)
+    {
+        rows = csv_ring_pop(ring);
+        if (rows != NULL) return rows;
+    }
+    
+    pthread_mutex_lock(&ring->lock);
+    __atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+    
+    while ((rows = csv_ring_pop(ring)) == NULL && __atomic_load_n(stop, __ATOMIC_ACQUIRE) == false)
+    {
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    }
+    
+    __atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+    
+    //the item that raced with stop is still delivered
+    return rows != NULL ? rows : csv_ring_pop(ring);
+}
+
+/*******************************************************************************
+Batches are allocated as the first member of a node that carries the latency
+timestamps, so the public struct csv_rows converts back to its node.
+*/
+
+static struct csv_rows *csv_rows_new(uint32_t batch_rows)
+{
+    struct csv_rows_node *node = malloc(sizeof(struct csv_rows_node));
+    if (node == NULL) return NULL;
+    
+    struct csv_rows *rows = &node->rows;
+    
+    rows->first = 0;
+    rows->count = 0;
+    rows->cols = 0;
+    rows->data = malloc(sizeof(void*) * batch_rows);
+    rows->widths = malloc(sizeof(uint32_t) * batch_rows);
+    rows->arena = csv_arena_new();
+    
+    if (rows->data == NULL || rows->widths == NULL || rows->arena == NULL)
+    {
+        free(rows->data);
+        free(rows->widths);
+        csv_arena_free(rows->arena);
+        free(node);
+        return NULL;
+    }
+    
+    return rows;
+}
+
+/*******************************************************************************
+Batch to fill next. New batches are allocated until depth exist, after that the
+producer waits for a consumer to recycle one.
+*/
+
+static struct csv_rows *csv_producer_batch(struct csv_producer *producer)
+{
+    struct csv_rows *rows = csv_ring_pop(&producer->free);
+    
+    if (rows == NULL && producer->allocated < producer->depth)
+    {
+        rows = csv_rows_new(producer->batch_rows);
+        if (rows != NULL) producer->batches[producer->allocated++] = rows;
+    }
+    else if (rows == NULL)
+    {
+        rows = csv_ring_wait(&producer->free, &producer->cancelled);
+    }
+    
+    if (rows != NULL)
+    {
+        csv_arena_reset(rows->arena);
+        rows->count = 0;
+        
+        if (producer->latency != NULL) ((struct csv_rows_node *) rows)->started = csv_clock();
+    }
+    
+    return rows;
+}
+
+static void csv_producer_publish(struct csv_producer *producer)
+{
+    if (producer->current == NULL) return;
+    
+    if (producer->latency != NULL)
+    {
+        struct csv_rows_node *node = (struct csv_rows_node *) producer->current;
+        
+        node->published = csv_clock();
+        csv_latency_record(&producer->latency[CSV_LATENCY_PARSE], node->published - node->started);
+    }
+    
+    csv_ring_push(&producer->ready, producer->current);
+    csv_ring_signal(&producer->ready, false);
+    producer->current = NULL;
+}
+
+/*******************************************************************************
+Record callback of the producer parser. The cell array is carved from the same
+arena as the strings, so a batch costs no allocation once it is warm.
+*/
+
+static bool csv_producer_record(char **fields, const uint32_t n, const uint64_t row, void *data)
+{
+    struct csv_producer *producer = data;
+    struct csv_rows *rows = producer->current;
+    
+    if (__atomic_load_n(&producer->cancelled, __ATOMIC_ACQUIRE) == true) return false;
+    
+    if (rows == NULL)
+    {
+        rows = csv_producer_batch(producer);
+        if (rows == NULL) goto fail;
+        
+        rows->first = row;
+        rows->cols = producer->parser->cols;
+        producer->current = rows;
+    }
+    
+    char **cells = csv_arena_alloc(rows->arena, sizeof(void*) * (n == 0 ? 1 : n));
+    if (cells == NULL) goto fail;
+    
+    for (uint32_t j = 0; j < n; j++)
+    {
+        if (csv_arena_append(rows->arena, fields[j], strlen(fields[j])) == false) goto fail;
+        
+        cells[j] = csv_arena_field(rows->arena);
+        if (cells[j] == NULL) goto fail;
+    }
+    
+    rows->data[rows->count] = cells;
+    rows->widths[rows->count] = n;
+    
+    if (++rows->count == producer->batch_rows) csv_producer_publish(producer);
+    
+    return true;
+    
+    //the parser reports any false return as a cancel, keep the real reason
+    fail:
+        if (__atomic_load_n(&producer->cancelled, __ATOMIC_ACQUIRE) == false) producer->failure = CSV_MALLOC_FAILED;
+        return false;
+}
+
+#endif
+
+struct csv_producer *csv_producer_new(const struct csv_options *options, const uint32_t batch_rows, const uint32_t depth, csv_errno *error)
+{
+    #ifdef CSV_PTHREADS
+    csv_errno status = CSV_UNDEFINED;
+    
+    struct csv_producer *producer = calloc(1, sizeof(struct csv_producer));
+    if (producer == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    producer->depth = depth == 0 ? CSV_BATCH_DEPTH : depth;
+    producer->batch_rows = batch_rows == 0 ? CSV_BATCH_ROWS : batch_rows;
+    producer->status = CSV_SUCCESS;
+    producer->failure = CSV_SUCCESS;
+    producer->batches = calloc(producer->depth, sizeof(void*));
+    
+    if (producer->batches == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    if (csv_ring_init(&producer->ready, producer->depth) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    if (csv_ring_init(&producer->free, producer->depth) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    //the producer measures per batch, its parser does not measure per record
+    struct csv_options parsing = {0};
+    
+    if (options != NULL) parsing = *options;
+    parsing.latency = false;
+    
+    if (options != NULL && options->latency == true)
+    {
+        producer->latency = csv_latency_new();
+        if (producer->latency == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    producer->parser = csv_parser_new(&parsing, csv_producer_record, producer, &status);
+    if (producer->parser == NULL) STOP(error, status, fail);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return producer;
+    
+    fail:
+        csv_producer_free(producer);
+        return NULL;
+    #else
+    (void) options;
+    (void) batch_rows;
+    (void) depth;
+    STOP(error, CSV_UNKNOWN_FATAL_ERROR, early_stop);
+    #endif
+    
+    early_stop:
+        return NULL;
+}
+
+void csv_producer_free(struct csv_producer *producer)
+{
+    if (producer == NULL) return;
+    
+    #ifdef CSV_PTHREADS
+    for (uint32_t k = 0; k < producer->allocated; k++)
+    {
+        free(producer->batches[k]->data);
+        free(producer->batches[k]->widths);
+        csv_arena_free(producer->batches[k]->arena);
+        free((struct csv_rows_node *) producer->batches[k]);
+    }
+    
+    csv_ring_free(&producer->ready);
+    csv_ring_free(&producer->free);
+    #endif
+    
+    csv_parser_free(producer->parser);
+    free(producer->batches);
+    free(producer->latency);
+    free(producer);
+}
+
+/*******************************************************************************
+The status is written before the queue is closed with a release store, and
+consumers only read it after observing the close, so no lock is needed.
+*/
+
+bool csv_produce(struct csv_producer *producer, const char * const filename, csv_errno *error)
+{
+    csv_errno status = CSV_SUCCESS;
+    
+    if (producer == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (filename == NULL) STOP(error, CSV_NULL_FILENAME, early_stop);
+    if (producer->produced == true) STOP(error, CSV_READ_FAIL, early_stop);
+    
+    #ifdef CSV_PTHREADS
+    producer->produced = true;
+    
+    FILE *csvfile = fopen(filename, "rb");
+    char *block = malloc(CSV_BLOCK_LENGTH);
+    
+    if (csvfile == NULL) status = CSV_INVALID_FILE;
+    else if (block == NULL) status = CSV_MALLOC_FAILED;
+    else
+    {
+        setvbuf(csvfile, NULL, _IONBF, 0);
+        
+        while (status == CSV_SUCCESS)
+        {
+            size_t n = fread(block, 1, CSV_BLOCK_LENGTH, csvfile);
+            
+            if (n > 0) csv_parser_feed(producer->parser, block, n, &status);
+            else if (ferror(csvfile)) status = CSV_READ_FAIL;
+            else
+            {
+                csv_parser_finish(producer->parser, &status);
+                break;
+            }
+        }
+    }
+    
+    if (csvfile != NULL) fclose(csvfile);
+    free(block);
+    
+    //a batch that could not be filled is recycled rather than published
+    if (status == CSV_SUCCESS) csv_producer_publish(producer);
+    else if (producer->current != NULL)
+    {
+        csv_ring_push(&producer->free, producer->current);
+        producer->current = NULL;
+    }
+    
+    if (status == CSV_CANCELLED && producer->failure != CSV_SUCCESS) status = producer->failure;
+    
+    if (status == CSV_SUCCESS && __atomic_load_n(&producer->cancelled, __ATOMIC_ACQUIRE) == true)
+    {
+        status = CSV_CANCELLED;
+    }
+    
+    producer->status = status;
+    __atomic_store_n(&producer->closed, true, __ATOMIC_RELEASE);
+    csv_ring_signal(&producer->ready, true);
+    #endif
+    
+    if (status != CSV_SUCCESS) STOP(error, status, early_stop);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    early_stop:
+        return false;
+}
+
+struct csv_rows *csv_consume(struct csv_producer *producer, csv_errno *error)
+{
+    if (producer == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    #ifdef CSV_PTHREADS
+    struct csv_rows *rows = csv_ring_wait(&producer->ready, &producer->closed);
+    
+    if (rows != NULL)
+    {
+        if (producer->latency != NULL)
+        {
+            struct csv_rows_node *node = (struct csv_rows_node *) rows;
+            
+            node->taken = csv_clock();
+            csv_latency_record(&producer->latency[CSV_LATENCY_WAIT], node->taken - node->published);
+        }
+        
+        if (error != NULL) *error = CSV_SUCCESS;
+        return rows;
+    }
+    
+    if (error != NULL) *error = producer->status;
+    #endif
+    
+    early_stop:
+        return NULL;
+}
+
+void csv_recycle(struct csv_producer *producer, struct csv_rows *rows)
+{
+    if (producer == NULL || rows == NULL) return;
+    
+    #ifdef CSV_PTHREADS
+    if (producer->latency != NULL)
+    {
+        const struct csv_rows_node *node = (const struct csv_rows_node *) rows;
+        csv_latency_record(&producer->latency[CSV_LATENCY_CALLBACK], csv_clock() - node->taken);
+    }
+    
+    csv_ring_push(&producer->free, rows);
+    csv_ring_signal(&producer->free, false);
+    #endif
+}
+
+void csv_producer_cancel(struct csv_producer *producer)
+{
+    if (producer == NULL) return;
+    
+    #ifdef CSV_PTHREADS
+    __atomic_store_n(&producer->cancelled, true, __ATOMIC_RELEASE);
+    csv_ring_signal(&producer->free, true);
+    #endif
+}
+
+bool csv_producer_latency(const struct csv_producer *producer, const csv_latency_kind kind, struct csv_latency *latency, csv_errno *error)
+{
+    if (producer == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    return csv_latency_get(producer->latency, kind, latency, error);
+    
+    early_stop:
+        return false;
+}
+
+char **csv_producer_header(const struct csv_producer *producer, uint32_t *n)
+{
+    return producer == NULL ? NULL : csv_parser_header(producer->parser, n);
+}
+
+/*******************************************************************************
+Attempt to convert a row of data to an array of longs. Assumes that data is not
+missing.
+*/
+
+long *csv_rowl(struct csv *csv, const uint32_t i, const int base, csv_errno *error)
+{
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (i >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    long *data = malloc(sizeof(long) * csv->cols);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    CSV_PROBE2(convert_start, "rowl", i);
+
+    for (uint32_t j = 0; j < csv->cols; j++)
+    {
+        errno = 0;
+        long tmp = 0;
+        char *end = NULL;
+        
+        if (csv->data[i][j][0] == '\0') STOP(error, CSV_MISSING_DATA, fail);
+        else tmp = strtol(csv->data[i][j], &end, base);
+        
+        //parse error handling
+        if (end == csv->data[i][j]) 
+            STOP(error, CSV_READ_FAIL, fail);
+        if (errno == ERANGE && tmp == LONG_MIN)
+            STOP(error, CSV_READ_UNDERFLOW, fail);
+        if (errno == ERANGE && tmp == LONG_MAX)
+            STOP(error, CSV_READ_OVERFLOW, fail);
+        if (errno == EINVAL)
+            STOP(error, CSV_INVALID_BASE, fail);
+        if (errno == 0 && *end != '\0')
+            STOP(error, CSV_READ_PARTIAL, fail);
+        if (errno != 0)
+            STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
+        
+        //success
+        assert(*end == '\0' && "missing condition");
+        data[j] = tmp;
+    }
+    
+    CSV_PROBE2(convert_done, "rowl", i);
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        CSV_PROBE2(convert_done, "rowl", i);
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Attempt to convert a column of data to an array of longs. Assumes that data is
+not missing. Will likely be slower than csv_rowl due to cache thrashing.
+*/
+
+long *csv_coll(struct csv *csv, const uint32_t j, const int base, csv_errno *error)
+{
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    long *data = malloc(sizeof(long) * csv->rows);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    CSV_PROBE2(convert_start, "coll", j);
+
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        errno = 0;
+        long tmp = 0;
+        char *end = NULL;
+        
+        if (csv->data[i][j][0] == '\0') STOP(error, CSV_MISSING_DATA, fail);
+        else tmp = strtol(csv->data[i][j], &end, base);
+        
+        //parse error handling
+        if (end == csv->data[i][j]) 
+            STOP(error, CSV_READ_FAIL, fail);
+        if (errno == ERANGE && tmp == LONG_MIN)
             STOP(error, CSV_READ_UNDERFLOW, fail);
         if (errno == ERANGE && tmp == LONG_MAX)
             STOP(error, CSV_READ_OVERFLOW, fail);
@@ -465,132 +2927,4914 @@ long *csv_coll(struct csv *csv, const uint32_t j, const int base, csv_errno *err
         if (errno != 0)
             STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
         
-        //success
-        assert(*end == '\0' && "missing condition");
-        data[i] = tmp;
+        //success
+        assert(*end == '\0' && "missing condition");
+        data[i] = tmp;
+    }
+    
+    CSV_PROBE2(convert_done, "coll", j);
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        CSV_PROBE2(convert_done, "coll", j);
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Missing values lead to error rather than copying the nul-char as the target.
+*/
+
+char *csv_rowc(struct csv *csv, const uint32_t i, csv_errno *error)
+{
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (i >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    char *data = malloc(sizeof(char) * csv->cols);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    CSV_PROBE2(convert_start, "rowc", i);
+    
+    for (uint32_t j = 0; j < csv->cols; j++)
+    {
+        char tmp = csv->data[i][j][0];
+        
+        if (tmp == '\0')
+        {
+            STOP(error, CSV_MISSING_DATA, fail);
+        }
+        else
+        {
+            data[j] = tmp;
+        }
+    }
+    
+    CSV_PROBE2(convert_done, "rowc", i);
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        CSV_PROBE2(convert_done, "rowc", i);
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Missing values lead to error rather than copying the nul-char as the target.
+*/
+
+char *csv_colc(struct csv *csv, const uint32_t j, csv_errno *error)
+{
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    char *data = malloc(sizeof(char) * csv->rows);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    CSV_PROBE2(convert_start, "colc", j);
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        char tmp = csv->data[i][j][0];
+        
+        if (tmp == '\0')
+        {
+            STOP(error, CSV_MISSING_DATA, fail);
+        }
+        else
+        {
+            data[i] = tmp;
+        }
+    }
+    
+    CSV_PROBE2(convert_done, "colc", j);
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        CSV_PROBE2(convert_done, "colc", j);
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/******************************************************************************/
+
+double *csv_rowd(struct csv *csv, const uint32_t i, csv_errno *error)
+{
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (i >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    double *data = malloc(sizeof(double) * csv->cols);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    CSV_PROBE2(convert_start, "rowd", i);
+
+    for (uint32_t j = 0; j < csv->cols; j++)
+    {
+        errno = 0;
+        double tmp = 0;
+        char *end = NULL;
+        
+        if (csv->data[i][j][0] == '\0') STOP(error, CSV_MISSING_DATA, fail);
+        else tmp = strtod(csv->data[i][j], &end);
+        
+        //parse error handling
+        if (end == csv->data[i][j]) 
+            STOP(error, CSV_READ_FAIL, fail);
+        if (errno == 0 && *end != '\0')
+            STOP(error, CSV_READ_PARTIAL, fail);
+        if (errno != 0)
+            STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
+        
+        //success
+        assert(*end == '\0' && "missing condition");
+        data[j] = tmp;
+    }
+    
+    CSV_PROBE2(convert_done, "rowd", i);
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        CSV_PROBE2(convert_done, "rowd", i);
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/******************************************************************************/
+
+double *csv_cold(struct csv *csv, const uint32_t j, csv_errno *error)
+{
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    double *data = malloc(sizeof(double) * csv->rows);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    CSV_PROBE2(convert_start, "cold", j);
+
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        errno = 0;
+        double tmp = 0;
+        char *end = NULL;
+        
+        if (csv->data[i][j][0] == '\0') STOP(error, CSV_MISSING_DATA, fail);
+        else tmp = strtod(csv->data[i][j], &end);
+        
+        //parse error handling
+        if (end == csv->data[i][j]) 
+            STOP(error, CSV_READ_FAIL, fail);
+        if (errno == 0 && *end != '\0')
+            STOP(error, CSV_READ_PARTIAL, fail);
+        if (errno != 0)
+            STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
+        
+        //success
+        assert(*end == '\0' && "missing condition");
+        data[i] = tmp;
+    }
+    
+    CSV_PROBE2(convert_done, "cold", j);
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        CSV_PROBE2(convert_done, "cold", j);
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Probe the lookup table built by csv_get_header. Without a header there are no
+names to resolve.
+*/
+
+uint32_t csv_col_index(const struct csv *csv, const char *name, csv_errno *error)
+{
+    if (csv == NULL || name == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (csv->lookup == NULL) STOP(error, CSV_UNKNOWN_COLUMN, early_stop);
+    
+    uint64_t mask = csv_lookup_capacity(csv->cols) - 1;
+    uint64_t pos = csv_hash(name, strlen(name)) & mask;
+    
+    while (csv->lookup[pos] != 0)
+    {
+        uint32_t j = csv->lookup[pos] - 1;
+        
+        if (strcmp(csv->header[j], name) == 0)
+        {
+            if (error != NULL) *error = CSV_SUCCESS;
+            return j;
+        }
+        
+        pos = (pos + 1) & mask;
+    }
+    
+    if (error != NULL) *error = CSV_UNKNOWN_COLUMN;
+    
+    early_stop:
+        return UINT32_MAX;
+}
+
+/******************************************************************************/
+
+long *csv_coll_by_name(struct csv *csv, const char *name, const int base, csv_errno *error)
+{
+    uint32_t j = csv_col_index(csv, name, error);
+    if (j == UINT32_MAX) return NULL;
+    
+    return csv_coll(csv, j, base, error);
+}
+
+char *csv_colc_by_name(struct csv *csv, const char *name, csv_errno *error)
+{
+    uint32_t j = csv_col_index(csv, name, error);
+    if (j == UINT32_MAX) return NULL;
+    
+    return csv_colc(csv, j, error);
+}
+
+double *csv_cold_by_name(struct csv *csv, const char *name, csv_errno *error)
+{
+    uint32_t j = csv_col_index(csv, name, error);
+    if (j == UINT32_MAX) return NULL;
+    
+    return csv_cold(csv, j, error);
+}
+
+/*******************************************************************************
+Single cell conversions with the same acceptance rules and error codes as the
+csv_col[*] and csv_row[*] families. The whole cell must be consumed.
+*/
+
+static csv_errno csv_convert_long(const char *cell, const int base, long *value)
+{
+    errno = 0;
+    char *end = NULL;
+    
+    if (cell[0] == '\0') return CSV_MISSING_DATA;
+    
+    *value = strtol(cell, &end, base);
+    
+    if (end == cell) return CSV_READ_FAIL;
+    if (errno == ERANGE && *value == LONG_MIN) return CSV_READ_UNDERFLOW;
+    if (errno == ERANGE && *value == LONG_MAX) return CSV_READ_OVERFLOW;
+    if (errno == EINVAL) return CSV_INVALID_BASE;
+    if (errno == 0 && *end != '\0') return CSV_READ_PARTIAL;
+    if (errno != 0) return CSV_UNKNOWN_FATAL_ERROR;
+    
+    return CSV_SUCCESS;
+}
+
+static csv_errno csv_convert_double(const char *cell, double *value)
+{
+    errno = 0;
+    char *end = NULL;
+    
+    if (cell[0] == '\0') return CSV_MISSING_DATA;
+    
+    *value = strtod(cell, &end);
+    
+    if (end == cell) return CSV_READ_FAIL;
+    if (errno == 0 && *end != '\0') return CSV_READ_PARTIAL;
+    if (errno != 0) return CSV_UNKNOWN_FATAL_ERROR;
+    
+    return CSV_SUCCESS;
+}
+
+/*******************************************************************************
+FNV-1a over raw bytes with a final avalanche. Not cryptographic, but cheap and
+well mixed enough for bloom filters, open addressing and HyperLogLog.
+*/
+
+static uint64_t csv_hash(const char *bytes, size_t n)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    
+    for (size_t i = 0; i < n; i++)
+    {
+        hash ^= (unsigned char) bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    
+    //murmur3 finalizer so that both the high and low bits are usable
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    
+    return hash;
+}
+
+/*******************************************************************************
+Bloom filter bit positions are derived from a single hash by double hashing. The
+filter is small, so three probes is close to optimal for a handful of distinct
+values per block, and saturates gracefully to "scan everything" beyond that.
+*/
+
+#define CSV_ZONE_BLOOM_BITS (CSV_ZONE_BLOOM_WORDS * 64)
+#define CSV_ZONE_BLOOM_PROBES 3
+
+static void csv_bloom_add(uint64_t *bloom, uint64_t hash)
+{
+    uint64_t h1 = hash;
+    uint64_t h2 = (hash >> 32) | 1;
+    
+    for (uint64_t k = 0; k < CSV_ZONE_BLOOM_PROBES; k++)
+    {
+        uint64_t bit = (h1 + k * h2) % CSV_ZONE_BLOOM_BITS;
+        bloom[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static bool csv_bloom_test(const uint64_t *bloom, uint64_t hash)
+{
+    uint64_t h1 = hash;
+    uint64_t h2 = (hash >> 32) | 1;
+    
+    for (uint64_t k = 0; k < CSV_ZONE_BLOOM_PROBES; k++)
+    {
+        uint64_t bit = (h1 + k * h2) % CSV_ZONE_BLOOM_BITS;
+        if ((bloom[bit / 64] & (1ULL << (bit % 64))) == 0) return false;
+    }
+    
+    return true;
+}
+
+/*******************************************************************************
+Summarize column j block by block. The column is optimistically treated as
+numeric, and the first cell that fails to convert restarts the column as text.
+Text zones report an unbounded range so that numeric queries never skip them,
+and numeric zones report a saturated bloom filter for the same reason.
+*/
+
+static void csv_zone_column(struct csv *csv, struct csv_zonemap *map, uint32_t j)
+{
+    struct csv_zone *zones = &map->zones[(uint64_t) j * map->blocks];
+    struct csv_zone *zone = NULL;
+    bool numeric = true;
+    
+    for (uint32_t i = 0; i < csv->rows && numeric == true; i++)
+    {
+        zone = &zones[i / map->block_rows];
+        
+        if (i % map->block_rows == 0)
+        {
+            zone->min = HUGE_VAL;
+            zone->max = -HUGE_VAL;
+            zone->present = 0;
+            memset(zone->bloom, 0xFF, sizeof(zone->bloom));
+        }
+        
+        const char *cell = csv->data[i][j];
+        double value = 0;
+        
+        if (cell[0] == '\0') continue;
+        if (csv_convert_double(cell, &value) != CSV_SUCCESS) numeric = false;
+        
+        //NaN fails both comparisons and is never part of the range
+        zone->present++;
+        if (value < zone->min) zone->min = value;
+        if (value > zone->max) zone->max = value;
+    }
+    
+    map->numeric[j] = numeric;
+    
+    if (numeric == true) return;
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
+    {
+        zone = &zones[i / map->block_rows];
+        
+        if (i % map->block_rows == 0)
+        {
+            zone->min = -HUGE_VAL;
+            zone->max = HUGE_VAL;
+            zone->present = 0;
+            memset(zone->bloom, 0, sizeof(zone->bloom));
+        }
+        
+        const char *cell = csv->data[i][j];
+        
+        if (cell[0] == '\0') continue;
+        
+        zone->present++;
+        csv_bloom_add(zone->bloom, csv_hash(cell, strlen(cell)));
+    }
+}
+
+/******************************************************************************/
+
+static void csv_zonemap_free(struct csv_zonemap *map)
+{
+    if (map == NULL) return;
+    
+    free(map->numeric);
+    free(map->zones);
+    free(map);
+}
+
+/*******************************************************************************
+The zone map is built into a fresh allocation and only swapped into the struct
+once complete, so a failed rebuild leaves the previous zone map usable.
+*/
+
+bool csv_zonemap_build(struct csv *csv, const uint32_t block_rows, csv_errno *error)
+{
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    uint32_t step = block_rows == 0 ? CSV_ZONE_BLOCK_ROWS : block_rows;
+    uint32_t blocks = csv->rows / step + (csv->rows % step != 0);
+    
+    struct csv_zonemap *map = malloc(sizeof(struct csv_zonemap));
+    if (map == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    map->block_rows = step;
+    map->blocks = blocks;
+    map->numeric = malloc(sizeof(bool) * csv->cols + 1);
+    map->zones = malloc(sizeof(struct csv_zone) * blocks * csv->cols + 1);
+    
+    if (map->numeric == NULL || map->zones == NULL)
+    {
+        STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    for (uint32_t j = 0; j < csv->cols; j++)
+    {
+        csv_zone_column(csv, map, j);
+    }
+    
+    csv_zonemap_free(csv->zonemap);
+    csv->zonemap = map;
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    fail:
+        csv_zonemap_free(map);
+        return false;
+    
+    early_stop:
+        return false;
+}
+
+/*******************************************************************************
+A numeric zone is excluded when its [min, max] range does not intersect the
+query range. Zones without any present cells have an empty range.
+*/
+
+bool csv_zone_excludes(const struct csv *csv, const uint32_t b, const uint32_t j, const double lo, const double hi)
+{
+    if (csv == NULL || csv->zonemap == NULL) return false;
+    
+    const struct csv_zonemap *map = csv->zonemap;
+    
+    if (b >= map->blocks || j >= csv->cols) return false;
+    if (map->numeric[j] == false) return false;
+    
+    const struct csv_zone *zone = &map->zones[(uint64_t) j * map->blocks + b];
+    
+    return zone->max < lo || zone->min > hi;
+}
+
+/*******************************************************************************
+A text zone is excluded when any bloom probe for the value is unset. Numeric
+columns carry a saturated filter and are therefore never excluded here. Empty
+cells are not summarized, so the empty string never excludes a zone.
+*/
+
+bool csv_zone_excludes_str(const struct csv *csv, const uint32_t b, const uint32_t j, const char *value)
+{
+    if (csv == NULL || csv->zonemap == NULL || value == NULL) return false;
+    if (value[0] == '\0') return false;
+    
+    const struct csv_zonemap *map = csv->zonemap;
+    
+    if (b >= map->blocks || j >= csv->cols) return false;
+    
+    const struct csv_zone *zone = &map->zones[(uint64_t) j * map->blocks + b];
+    
+    if (zone->present == 0) return true;
+    
+    return !csv_bloom_test(zone->bloom, csv_hash(value, strlen(value)));
+}
+
+/*******************************************************************************
+csv_filter predicates are parsed into a flat list of terms that are all joined
+by a logical and. The expression is copied into scratch space so that string
+literals and column names can be nul-terminated in place.
+*/
+
+enum csv_op
+{
+    CSV_OP_EQ,
+    CSV_OP_NE,
+    CSV_OP_LT,
+    CSV_OP_LE,
+    CSV_OP_GT,
+    CSV_OP_GE
+};
+
+struct csv_term
+{
+    double number;
+    const char *text;
+    uint32_t col;
+    enum csv_op op;
+};
+
+static bool csv_term_isspace(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static char *csv_term_skip(char *p)
+{
+    while (csv_term_isspace(*p)) p++;
+    return p;
+}
+
+/*******************************************************************************
+Resolve the column operand at p and return the position after it, or null if
+the operand is malformed. Column names are resolved with csv_col_index.
+*/
+
+static char *csv_term_column(struct csv *csv, char *p, uint32_t *col, csv_errno *status)
+{
+    char *name = p;
+    char *end = NULL;
+    
+    *status = CSV_INVALID_EXPRESSION;
+    
+    if (*p == '$')
+    {
+        errno = 0;
+        unsigned long index = strtoul(p + 1, &end, 10);
+        
+        if (end == p + 1 || errno != 0) return NULL;
+        
+        if (index >= csv->cols)
+        {
+            *status = CSV_UNKNOWN_COLUMN;
+            return NULL;
+        }
+        
+        *col = (uint32_t) index;
+        *status = CSV_SUCCESS;
+        return end;
+    }
+    
+    if (*p == '"')
+    {
+        name = ++p;
+        while (*p != '"' && *p != '\0') p++;
+        if (*p == '\0') return NULL;
+        end = p++;
+    }
+    else
+    {
+        while (*p != '\0' && !csv_term_isspace(*p) && strchr("=!<>", *p) == NULL) p++;
+        if (p == name) return NULL;
+        end = p;
+    }
+    
+    //terminate the name temporarily, the operator may follow without a space
+    char c = *end;
+    *end = '\0';
+    *col = csv_col_index(csv, name, status);
+    *end = c;
+    
+    return *status == CSV_SUCCESS ? p : NULL;
+}
+
+/*******************************************************************************
+Parse "column op literal" at p into term and return the position after it.
+*/
+
+static char *csv_term_parse(struct csv *csv, char *p, struct csv_term *term, csv_errno *status)
+{
+    p = csv_term_column(csv, csv_term_skip(p), &term->col, status);
+    if (p == NULL) return NULL;
+    
+    *status = CSV_INVALID_EXPRESSION;
+    p = csv_term_skip(p);
+    
+    if (p[0] == '=' && p[1] == '=') {term->op = CSV_OP_EQ; p += 2;}
+    else if (p[0] == '!' && p[1] == '=') {term->op = CSV_OP_NE; p += 2;}
+    else if (p[0] == '<' && p[1] == '=') {term->op = CSV_OP_LE; p += 2;}
+    else if (p[0] == '>' && p[1] == '=') {term->op = CSV_OP_GE; p += 2;}
+    else if (p[0] == '<') {term->op = CSV_OP_LT; p += 1;}
+    else if (p[0] == '>') {term->op = CSV_OP_GT; p += 1;}
+    else return NULL;
+    
+    p = csv_term_skip(p);
+    
+    if (*p == '\'')
+    {
+        term->text = ++p;
+        while (*p != '\'' && *p != '\0') p++;
+        if (*p == '\0') return NULL;
+        *p++ = '\0';
+    }
+    else
+    {
+        char *end = NULL;
+        
+        errno = 0;
+        term->text = NULL;
+        term->number = strtod(p, &end);
+        
+        if (end == p || errno != 0) return NULL;
+        p = end;
+    }
+    
+    *status = CSV_SUCCESS;
+    return p;
+}
+
+/*******************************************************************************
+A term may skip block b when the zone map proves that no cell in the block can
+satisfy it. Inequality cannot be decided from min/max, and strings only support
+equality through the bloom filter.
+*/
+
+static bool csv_term_skip_block(const struct csv *csv, const struct csv_term *term, uint32_t b)
+{
+    if (term->text != NULL)
+    {
+        if (term->op != CSV_OP_EQ) return false;
+        return csv_zone_excludes_str(csv, b, term->col, term->text);
+    }
+    
+    switch (term->op)
+    {
+        case CSV_OP_EQ:
+            return csv_zone_excludes(csv, b, term->col, term->number, term->number);
+        case CSV_OP_LT:
+        case CSV_OP_LE:
+            return csv_zone_excludes(csv, b, term->col, -HUGE_VAL, term->number);
+        case CSV_OP_GT:
+        case CSV_OP_GE:
+            return csv_zone_excludes(csv, b, term->col, term->number, HUGE_VAL);
+        case CSV_OP_NE:
+            return false;
+    }
+    
+    return false;
+}
+
+/*******************************************************************************
+Evaluate one term over a batch of at most CSV_FILTER_BATCH rows and compact the
+survivors into out, which may alias rows. Numeric terms first decode the batch
+into a dense array with NaN for missing or invalid cells, so that the compare
+loops are branch-free and can be vectorized by the compiler. NaN compares false
+everywhere, including inequality which is rewritten as less or greater.
+*/
+
+static uint32_t csv_term_batch(struct csv *csv, const struct csv_term *term, const uint32_t *rows, uint32_t count, uint32_t *out)
+{
+    double values[CSV_FILTER_BATCH];
+    unsigned char keep[CSV_FILTER_BATCH];
+    const double x = term->number;
+    const uint32_t j = term->col;
+    uint32_t total = 0;
+    
+    if (term->text != NULL)
+    {
+        for (uint32_t k = 0; k < count; k++)
+        {
+            int cmp = strcmp(csv->data[rows[k]][j], term->text);
+            
+            switch (term->op)
+            {
+                case CSV_OP_EQ: keep[k] = cmp == 0; break;
+                case CSV_OP_NE: keep[k] = cmp != 0; break;
+                case CSV_OP_LT: keep[k] = cmp < 0; break;
+                case CSV_OP_LE: keep[k] = cmp <= 0; break;
+                case CSV_OP_GT: keep[k] = cmp > 0; break;
+                case CSV_OP_GE: keep[k] = cmp >= 0; break;
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t k = 0; k < count; k++)
+        {
+            if (csv_convert_double(csv->data[rows[k]][j], &values[k]) != CSV_SUCCESS)
+            {
+                values[k] = NAN;
+            }
+        }
+        
+        switch (term->op)
+        {
+            case CSV_OP_EQ:
+                for (uint32_t k = 0; k < count; k++) keep[k] = values[k] == x;
+                break;
+            case CSV_OP_NE:
+                for (uint32_t k = 0; k < count; k++) keep[k] = (values[k] < x) | (values[k] > x);
+                break;
+            case CSV_OP_LT:
+                for (uint32_t k = 0; k < count; k++) keep[k] = values[k] < x;
+                break;
+            case CSV_OP_LE:
+                for (uint32_t k = 0; k < count; k++) keep[k] = values[k] <= x;
+                break;
+            case CSV_OP_GT:
+                for (uint32_t k = 0; k < count; k++) keep[k] = values[k] > x;
+                break;
+            case CSV_OP_GE:
+                for (uint32_t k = 0; k < count; k++) keep[k] = values[k] >= x;
+                break;
+        }
+    }
+    
+    //branch-free compaction, safe in place since total never passes k
+    for (uint32_t k = 0; k < count; k++)
+    {
+        out[total] = rows[k];
+        total += keep[k];
+    }
+    
+    return total;
+}
+
+/*******************************************************************************
+Apply one term to the selection vector. The first term scans every block that
+the zone map cannot rule out. Later terms only visit rows that survived so far,
+and drop whole runs of rows that fall into a block the term can rule out.
+*/
+
+static uint32_t csv_term_apply(struct csv *csv, const struct csv_term *term, uint32_t *sel, uint32_t count, bool first)
+{
+    uint32_t step = csv->zonemap == NULL ? UINT32_MAX : csv->zonemap->block_rows;
+    uint32_t rows[CSV_FILTER_BATCH];
+    uint32_t total = 0;
+    
+    if (first == true)
+    {
+        for (uint32_t i = 0; i < csv->rows; )
+        {
+            uint32_t end = csv->rows - i > step ? i + step : csv->rows;
+            
+            if (csv_term_skip_block(csv, term, i / step) == true)
+            {
+                i = end;
+                continue;
+            }
+            
+            while (i < end)
+            {
+                uint32_t n = end - i > CSV_FILTER_BATCH ? CSV_FILTER_BATCH : end - i;
+                for (uint32_t k = 0; k < n; k++) rows[k] = i + k;
+                total += csv_term_batch(csv, term, rows, n, sel + total);
+                i += n;
+            }
+        }
+        
+        return total;
+    }
+    
+    for (uint32_t k = 0; k < count; )
+    {
+        uint32_t b = sel[k] / step;
+        uint32_t end = k;
+        
+        while (end < count && sel[end] / step == b) end++;
+        
+        if (csv_term_skip_block(csv, term, b) == true)
+        {
+            k = end;
+            continue;
+        }
+        
+        while (k < end)
+        {
+            uint32_t n = end - k > CSV_FILTER_BATCH ? CSV_FILTER_BATCH : end - k;
+            total += csv_term_batch(csv, term, sel + k, n, sel + total);
+            k += n;
+        }
+    }
+    
+    return total;
+}
+
+/*******************************************************************************
+Terms are evaluated column-at-a-time in the order written, each one narrowing
+the selection vector left by the previous term. Put the most selective term
+first for the best performance.
+*/
+
+uint32_t *csv_filter(struct csv *csv, const char *expr, uint32_t *n, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    uint32_t count = 0;
+    uint32_t total_terms = 0;
+    
+    if (csv == NULL || expr == NULL || n == NULL)
+    {
+        STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    }
+    
+    //every term has at least three characters, which bounds the term count
+    size_t len = strlen(expr);
+    char *scratch = malloc(len + 1);
+    struct csv_term *terms = malloc(sizeof(struct csv_term) * (len / 3 + 1));
+    uint32_t *sel = malloc(sizeof(uint32_t) * ((uint64_t) csv->rows + 1));
+    
+    if (scratch == NULL || terms == NULL || sel == NULL)
+    {
+        STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    memcpy(scratch, expr, len + 1);
+    
+    for (char *p = scratch; ; )
+    {
+        p = csv_term_parse(csv, p, &terms[total_terms], &status);
+        if (p == NULL) STOP(error, status, fail);
+        total_terms++;
+        
+        p = csv_term_skip(p);
+        if (*p == '\0') break;
+        
+        if ((p[0] == 'a' || p[0] == 'A') && (p[1] == 'n' || p[1] == 'N')
+            && (p[2] == 'd' || p[2] == 'D') && csv_term_isspace(p[3])) p += 3;
+        else if (p[0] == '&' && p[1] == '&') p += 2;
+        else STOP(error, CSV_INVALID_EXPRESSION, fail);
+    }
+    
+    for (uint32_t t = 0; t < total_terms; t++)
+    {
+        count = csv_term_apply(csv, &terms[t], sel, count, t == 0);
+        if (count == 0) break;
+    }
+    
+    free(scratch);
+    free(terms);
+    
+    *n = count;
+    if (error != NULL) *error = CSV_SUCCESS;
+    return sel;
+    
+    fail:
+        free(scratch);
+        free(terms);
+        free(sel);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Selection vector conversions, analogous to csv_col[*] but only over the rows in
+sel. Rows are visited in the order given, so sorted selections stay cache
+friendly.
+*/
+
+long *csv_sell(struct csv *csv, const uint32_t j, const uint32_t *sel, const uint32_t n, const int base, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    if (csv == NULL || sel == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    long *data = malloc(sizeof(long) * n + 1);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    for (uint32_t k = 0; k < n; k++)
+    {
+        if (sel[k] >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, fail);
+        
+        status = csv_convert_long(csv->data[sel[k]][j], base, &data[k]);
+        if (status != CSV_SUCCESS) STOP(error, status, fail);
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/******************************************************************************/
+
+char *csv_selc(struct csv *csv, const uint32_t j, const uint32_t *sel, const uint32_t n, csv_errno *error)
+{
+    if (csv == NULL || sel == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    char *data = malloc(sizeof(char) * n + 1);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    for (uint32_t k = 0; k < n; k++)
+    {
+        if (sel[k] >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, fail);
+        
+        data[k] = csv->data[sel[k]][j][0];
+        if (data[k] == '\0') STOP(error, CSV_MISSING_DATA, fail);
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/******************************************************************************/
+
+double *csv_seld(struct csv *csv, const uint32_t j, const uint32_t *sel, const uint32_t n, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    if (csv == NULL || sel == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    double *data = malloc(sizeof(double) * n + 1);
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    for (uint32_t k = 0; k < n; k++)
+    {
+        if (sel[k] >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, fail);
+        
+        status = csv_convert_double(csv->data[sel[k]][j], &data[k]);
+        if (status != CSV_SUCCESS) STOP(error, status, fail);
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Thread pool. Every parallel entry point runs on a caller supplied struct
+csv_pool instead of creating its own threads, so one process wide pool bounds
+the number of busy cores. Each worker owns a deque of jobs: it pushes and pops
+at the bottom, and idle workers steal from the top of other deques, trying
+workers on their own NUMA node before remote ones. Jobs submitted from outside
+the pool are dealt round robin over the deques. A thread that waits for a
+batch of jobs keeps running queued jobs until its batch is complete, which
+keeps nested parallel calls from a pool worker free of deadlock.
+
+A pool can also wrap an external executor, in which case jobs are handed to
+its submit callback and the waiting thread simply blocks until they finish.
+Without thread support every pool runs its jobs on the calling thread.
+*/
+
+struct csv_batch;
+
+struct csv_job
+{
+    void (*task)(void *);
+    void *arg;
+    struct csv_batch *batch;
+};
+
+#ifdef CSV_PTHREADS
+
+struct csv_batch
+{
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    uint32_t remaining;
+    uint32_t pad;
+};
+
+struct csv_deque
+{
+    pthread_mutex_t lock;
+    struct csv_job *jobs;
+    uint64_t top;
+    uint64_t bottom;
+    uint64_t capacity;
+};
+
+struct csv_worker
+{
+    struct csv_deque deque;
+    struct csv_pool *pool;
+    pthread_t tid;
+    uint32_t node;
+    int cpu;
+    bool started;
+    char pad[7];
+};
+
+#endif
+
+struct csv_pool
+{
+    csv_submit_fn submit;
+    void *executor;
+    uint32_t threads;
+    #ifdef CSV_PTHREADS
+    uint32_t next;
+    struct csv_worker *workers;
+    int64_t pending;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    bool pin;
+    bool stop;
+    char pad[6];
+    #else
+    uint32_t pad;
+    #endif
+};
+
+#ifdef CSV_PTHREADS
+
+#define CSV_DEQUE_INITIAL 64
+#define CSV_POOL_NODES 64
+
+static pthread_key_t csv_pool_key;
+static pthread_once_t csv_pool_once = PTHREAD_ONCE_INIT;
+
+static void csv_pool_key_init(void)
+{
+    pthread_key_create(&csv_pool_key, NULL);
+}
+
+/*******************************************************************************
+The worker running on the calling thread if it belongs to pool, else null.
+*/
+
+static struct csv_worker *csv_pool_self(struct csv_pool *pool)
+{
+    pthread_once(&csv_pool_once, csv_pool_key_init);
+    
+    struct csv_worker *self = pthread_getspecific(csv_pool_key);
+    
+    return self != NULL && self->pool == pool ? self : NULL;
+}
+
+static bool csv_deque_push(struct csv_deque *deque, const struct csv_job *job)
+{
+    pthread_mutex_lock(&deque->lock);
+    
+    if (deque->bottom - deque->top == deque->capacity)
+    {
+        uint64_t capacity = deque->capacity == 0 ? CSV_DEQUE_INITIAL : deque->capacity * 2;
+        struct csv_job *jobs = malloc(sizeof(struct csv_job) * capacity);
+        
+        if (jobs == NULL)
+        {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        
+        //unwrap the ring into the front of the new buffer
+        for (uint64_t k = deque->top; k < deque->bottom; k++)
+        {
+            jobs[k - deque->top] = deque->jobs[k & (deque->capacity - 1)];
+        }
+        
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->bottom -= deque->top;
+        deque->top = 0;
+        deque->capacity = capacity;
+    }
+    
+    deque->jobs[deque->bottom++ & (deque->capacity - 1)] = *job;
+    
+    pthread_mutex_unlock(&deque->lock);
+    
+    return true;
+}
+
+/*******************************************************************************
+Take a job from either end. A thief that passes a batch only takes the oldest
+job if it belongs to that batch.
+*/
+
+static bool csv_deque_pop(struct csv_deque *deque, struct csv_job *job, bool steal, const struct csv_batch *batch)
+{
+    bool found = false;
+    
+    pthread_mutex_lock(&deque->lock);
+    
+    //the owner works LIFO for locality, thieves take the oldest job
+    if (deque->bottom != deque->top && steal == false)
+    {
+        *job = deque->jobs[--deque->bottom & (deque->capacity - 1)];
+        found = true;
+    }
+    else if (deque->bottom != deque->top)
+    {
+        const struct csv_job *oldest = &deque->jobs[deque->top & (deque->capacity - 1)];
+        
+        if (batch == NULL || oldest->batch == batch)
+        {
+            *job = *oldest;
+            deque->top++;
+            found = true;
+        }
+    }
+    
+    pthread_mutex_unlock(&deque->lock);
+    
+    return found;
+}
+
+/*******************************************************************************
+Find a job for self, or for a thread outside the pool when self is null. Own
+deque first, then every other deque on the same node, then remote nodes. With a
+batch only jobs of that batch are stolen.
+*/
+
+static bool csv_pool_take(struct csv_pool *pool, struct csv_worker *self, const struct csv_batch *batch, struct csv_job *job)
+{
+    bool found = self != NULL && csv_deque_pop(&self->deque, job, false, NULL);
+    const uint32_t start = self == NULL ? 0 : (uint32_t) (self - pool->workers) + 1;
+    
+    for (uint32_t pass = 0; pass < 2 && found == false; pass++)
+    {
+        for (uint32_t k = 0; k < pool->threads && found == false; k++)
+        {
+            struct csv_worker *victim = &pool->workers[(start + k) % pool->threads];
+            bool local = self == NULL || victim->node == self->node;
+            
+            if (victim == self || local != (pass == 0)) continue;
+            
+            found = csv_deque_pop(&victim->deque, job, true, batch);
+        }
+    }
+    
+    if (found == true)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    
+    return found;
+}
+
+static void csv_pool_run(struct csv_job *job)
+{
+    struct csv_batch *batch = job->batch;
+    
+    job->task(job->arg);
+    
+    if (batch == NULL) return;
+    
+    pthread_mutex_lock(&batch->lock);
+    if (--batch->remaining == 0) pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void csv_pool_external_run(void *arg)
+{
+    struct csv_job job = *(struct csv_job *) arg;
+    csv_pool_run(&job);
+}
+
+/*******************************************************************************
+Queue a job. Workers push to their own deque, other threads deal jobs round
+robin. The job is copied into the deque, but an external executor receives a
+pointer to it, so the job must stay alive until it has run.
+*/
+
+static void csv_pool_submit(struct csv_pool *pool, struct csv_job *job)
+{
+    if (pool->submit != NULL)
+    {
+        pool->submit(pool->executor, csv_pool_external_run, job);
+        return;
+    }
+    
+    struct csv_worker *self = csv_pool_self(pool);
+    
+    if (self == NULL)
+    {
+        pthread_mutex_lock(&pool->lock);
+        self = &pool->workers[pool->next++ % pool->threads];
+        pthread_mutex_unlock(&pool->lock);
+    }
+    
+    if (csv_deque_push(&self->deque, job) == false)
+    {
+        csv_pool_run(job);
+        return;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*******************************************************************************
+Wait for a batch. A worker helps with any job, since running jobs is what it is
+there for. Any other thread only runs jobs of its own batch, so it never ends
+up running an unrelated request such as a csv_read_async() job. Once no job can
+be found, the remaining jobs of the batch are queued or running on workers, and
+blocking is safe.
+*/
+
+static void csv_pool_join(struct csv_pool *pool, struct csv_batch *batch)
+{
+    struct csv_worker *self = pool->submit == NULL ? csv_pool_self(pool) : NULL;
+    struct csv_job job;
+    
+    while (true)
+    {
+        pthread_mutex_lock(&batch->lock);
+        uint32_t remaining = batch->remaining;
+        pthread_mutex_unlock(&batch->lock);
+        
+        if (remaining == 0) return;
+        
+        if (pool->submit == NULL && csv_pool_take(pool, self, self == NULL ? batch : NULL, &job) == true)
+        {
+            csv_pool_run(&job);
+            continue;
+        }
+        
+        pthread_mutex_lock(&batch->lock);
+        while (batch->remaining > 0) pthread_cond_wait(&batch->done, &batch->lock);
+        pthread_mutex_unlock(&batch->lock);
+        
+        return;
+    }
+}
+
+static void *csv_pool_main(void *arg)
+{
+    struct csv_worker *self = arg;
+    struct csv_pool *pool = self->pool;
+    struct csv_job job;
+    
+    pthread_once(&csv_pool_once, csv_pool_key_init);
+    pthread_setspecific(csv_pool_key, self);
+    
+    #ifdef __linux__
+    if (pool->pin == true && self->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((size_t) self->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+    }
+    #endif
+    
+    while (true)
+    {
+        if (csv_pool_take(pool, self, NULL, &job) == true)
+        {
+            csv_pool_run(&job);
+            continue;
+        }
+        
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending <= 0 && pool->stop == false) pthread_cond_wait(&pool->work, &pool->lock);
+        bool stop = pool->pending <= 0 && pool->stop == true;
+        pthread_mutex_unlock(&pool->lock);
+        
+        if (stop == true) return NULL;
+    }
+}
+
+/*******************************************************************************
+Worker layout. With the numa option the CPU lists of the nodes are read from
+sysfs and workers are dealt over the nodes in turn, so consecutive workers land
+on different nodes and each node gets its fair share of the pool. Otherwise all
+workers are on node 0 and take CPUs in order.
+*/
+
+static uint32_t csv_pool_cpulist(const char *list, int *cpus, uint32_t capacity)
+{
+    uint32_t n = 0;
+    
+    while (*list != '\0' && *list != '\n')
+    {
+        char *end = NULL;
+        long first = strtol(list, &end, 10);
+        long last = first;
+        
+        if (end == list) break;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+        
+        for (long cpu = first; cpu <= last && n < capacity; cpu++) cpus[n++] = (int) cpu;
+        
+        list = *end == ',' ? end + 1 : end;
+    }
+    
+    return n;
+}
+
+static void csv_pool_layout(struct csv_pool *pool, bool numa)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t nodes = 0;
+    
+    if (online < 1) online = 1;
+    
+    int *cpus = malloc(sizeof(int) * (size_t) online * CSV_POOL_NODES);
+    uint32_t count[CSV_POOL_NODES] = {0};
+    
+    #ifdef __linux__
+    for (uint32_t node = 0; numa == true && cpus != NULL && node < CSV_POOL_NODES; node++)
+    {
+        char path[64];
+        char list[1024];
+        
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) break;
+        
+        if (fgets(list, sizeof(list), file) != NULL)
+        {
+            count[nodes] = csv_pool_cpulist(list, cpus + (size_t) nodes * (size_t) online, (uint32_t) online);
+            if (count[nodes] > 0) nodes++;
+        }
+        
+        fclose(file);
+    }
+    #else
+    (void) numa;
+    #endif
+    
+    for (uint32_t w = 0; w < pool->threads; w++)
+    {
+        struct csv_worker *worker = &pool->workers[w];
+        
+        if (nodes == 0)
+        {
+            worker->node = 0;
+            worker->cpu = (int) (w % (uint32_t) online);
+        }
+        else
+        {
+            worker->node = w % nodes;
+            worker->cpu = cpus[(size_t) worker->node * (size_t) online + (w / nodes) % count[worker->node]];
+        }
+    }
+    
+    free(cpus);
+}
+
+#endif
+
+struct csv_pool *csv_pool_new(const struct csv_pool_options *options, csv_errno *error)
+{
+    struct csv_pool_options defaults = {0};
+    
+    if (options == NULL) options = &defaults;
+    
+    struct csv_pool *pool = malloc(sizeof(struct csv_pool));
+    if (pool == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    pool->submit = NULL;
+    pool->executor = NULL;
+    pool->threads = 1;
+    
+    #ifdef CSV_PTHREADS
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    pool->threads = options->threads != 0 ? options->threads : online > 0 ? (uint32_t) online : 1;
+    pool->pending = 0;
+    pool->next = 0;
+    pool->pin = options->pin;
+    pool->stop = false;
+    pool->workers = calloc(pool->threads, sizeof(struct csv_worker));
+    
+    if (pool->workers == NULL)
+    {
+        free(pool);
+        STOP(error, CSV_MALLOC_FAILED, early_stop);
+    }
+    
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    
+    //every deque must exist before the first worker starts stealing
+    for (uint32_t w = 0; w < pool->threads; w++)
+    {
+        pthread_mutex_init(&pool->workers[w].deque.lock, NULL);
+        pool->workers[w].pool = pool;
+    }
+    
+    csv_pool_layout(pool, options->numa);
+    
+    for (uint32_t w = 0; w < pool->threads; w++)
+    {
+        struct csv_worker *worker = &pool->workers[w];
+        
+        worker->started = pthread_create(&worker->tid, NULL, csv_pool_main, worker) == 0;
+        if (worker->started == false) STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
+    }
+    #else
+    (void) options;
+    #endif
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return pool;
+    
+    #ifdef CSV_PTHREADS
+    fail:
+        csv_pool_free(pool);
+        return NULL;
+    #endif
+    
+    early_stop:
+        return NULL;
+}
+
+struct csv_pool *csv_pool_external(csv_submit_fn submit, void *executor, const uint32_t concurrency, csv_errno *error)
+{
+    if (submit == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    struct csv_pool *pool = malloc(sizeof(struct csv_pool));
+    if (pool == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    pool->submit = submit;
+    pool->executor = executor;
+    pool->threads = concurrency == 0 ? 1 : concurrency;
+    
+    #ifdef CSV_PTHREADS
+    pool->workers = NULL;
+    pool->pending = 0;
+    pool->next = 0;
+    pool->pin = false;
+    pool->stop = false;
+    #endif
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return pool;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Workers drain every queued job before they exit, so freeing a pool waits for
+outstanding work, including queued csv_read_async() requests.
+*/
+
+void csv_pool_free(struct csv_pool *pool)
+{
+    if (pool == NULL) return;
+    
+    #ifdef CSV_PTHREADS
+    if (pool->workers != NULL)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = true;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+        
+        //a running worker may still steal from any deque, so join them all first
+        for (uint32_t w = 0; w < pool->threads; w++)
+        {
+            if (pool->workers[w].started == true) pthread_join(pool->workers[w].tid, NULL);
+        }
+        
+        for (uint32_t w = 0; w < pool->threads; w++)
+        {
+            pthread_mutex_destroy(&pool->workers[w].deque.lock);
+            free(pool->workers[w].deque.jobs);
+        }
+        
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->work);
+        free(pool->workers);
+    }
+    #endif
+    
+    free(pool);
+}
+
+/*******************************************************************************
+Number of parts a parallel kernel should split its work into.
+*/
+
+static uint32_t csv_pool_size(const struct csv_pool *pool)
+{
+    return pool == NULL ? 1 : pool->threads;
+}
+
+/*******************************************************************************
+Run task over n argument blocks of the given size on the pool. The calling
+thread executes the first block itself and helps with the rest while it waits.
+Without a pool, or if the jobs cannot be allocated, every block runs inline so
+the result never depends on thread resources.
+*/
+
+static void csv_parallel(struct csv_pool *pool, void (*task)(void *), void *args, size_t size, uint32_t n)
+{
+    char *base = args;
+    
+    if (n == 0) return;
+    
+    #ifdef CSV_PTHREADS
+    struct csv_job *jobs = pool == NULL || n == 1 ? NULL : malloc(sizeof(struct csv_job) * n);
+    
+    if (jobs != NULL)
+    {
+        struct csv_batch batch;
+        
+        pthread_mutex_init(&batch.lock, NULL);
+        pthread_cond_init(&batch.done, NULL);
+        batch.remaining = n - 1;
+        
+        for (uint32_t t = 1; t < n; t++)
+        {
+            jobs[t].task = task;
+            jobs[t].arg = base + size * t;
+            jobs[t].batch = &batch;
+            csv_pool_submit(pool, &jobs[t]);
+        }
+        
+        task(base);
+        csv_pool_join(pool, &batch);
+        
+        pthread_mutex_destroy(&batch.lock);
+        pthread_cond_destroy(&batch.done);
+        free(jobs);
+        return;
+    }
+    #else
+    (void) pool;
+    #endif
+    
+    for (uint32_t t = 0; t < n; t++) task(base + size * t);
+}
+
+/*******************************************************************************
+Asynchronous reads. Requests are queued as jobs on options->pool, or on a
+library owned default pool created on first use. Each job runs
+csv_read_opts() to completion. Completion is published three ways: the done
+flag under the handle lock for csv_async_wait() and csv_async_done(), an
+eventfd (a pipe outside Linux) that becomes readable for epoll and poll loops,
+and the optional callback on the worker thread. The worker reads everything it
+needs from the handle before the done flag is set, because the handle may be
+collected the moment the flag is visible. Without threads the read runs inline
+and the handle is complete on return.
+*/
+
+struct csv_async
+{
+    struct csv_job job;
+    char *filename;
+    struct csv_options options;
+    csv_async_fn on_done;
+    void *data;
+    struct csv *csv;
+    csv_errno error;
+    int fd[2];
+    bool done;
+    char pad[3];
+    #ifdef CSV_PTHREADS
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    #endif
+};
+
+#ifdef CSV_PTHREADS
+
+static pthread_mutex_t csv_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct csv_pool *csv_async_pool = NULL;
+static uint32_t csv_async_threads = CSV_ASYNC_THREADS;
+
+static void csv_async_run(void *arg)
+{
+    struct csv_async *async = arg;
+    
+    async->csv = csv_read_opts(async->filename, &async->options, &async->error);
+    
+    const csv_async_fn on_done = async->on_done;
+    void *data = async->data;
+    const int fd = async->fd[1];
+    
+    //an eventfd counter write and a pipe byte both make the read end readable
+    uint64_t one = 1;
+    ssize_t written = write(fd, &one, fd == async->fd[0] ? sizeof(one) : 1);
+    (void) written;
+    
+    pthread_mutex_lock(&async->lock);
+    async->done = true;
+    pthread_cond_broadcast(&async->cond);
+    pthread_mutex_unlock(&async->lock);
+    
+    if (on_done != NULL) on_done(async, data);
+}
+
+/*******************************************************************************
+Default pool for requests without options->pool. Called with csv_async_lock.
+*/
+
+static struct csv_pool *csv_async_default(csv_errno *status)
+{
+    if (csv_async_pool == NULL)
+    {
+        struct csv_pool_options options = {0};
+        
+        options.threads = csv_async_threads;
+        csv_async_pool = csv_pool_new(&options, status);
+    }
+    else *status = CSV_SUCCESS;
+    
+    return csv_async_pool;
+}
+
+static csv_errno csv_async_notifier(struct csv_async *async)
+{
+    #ifdef __linux__
+    async->fd[0] = eventfd(0, EFD_CLOEXEC);
+    async->fd[1] = async->fd[0];
+    return async->fd[0] < 0 ? CSV_UNKNOWN_FATAL_ERROR : CSV_SUCCESS;
+    #else
+    return pipe(async->fd) != 0 ? CSV_UNKNOWN_FATAL_ERROR : CSV_SUCCESS;
+    #endif
+}
+
+#endif
+
+/*******************************************************************************
+Replacing the default pool frees the old one outside the lock, which waits for
+the requests already queued on it. Requests are submitted to the default pool
+while holding the lock, so none can reach a pool that is being freed.
+*/
+
+bool csv_async_configure(const uint32_t threads, csv_errno *error)
+{
+    csv_errno status = CSV_SUCCESS;
+    
+    #ifdef CSV_PTHREADS
+    pthread_mutex_lock(&csv_async_lock);
+    struct csv_pool *old = csv_async_pool;
+    csv_async_pool = NULL;
+    csv_async_threads = threads == 0 ? CSV_ASYNC_THREADS : threads;
+    csv_async_default(&status);
+    pthread_mutex_unlock(&csv_async_lock);
+    
+    csv_pool_free(old);
+    #else
+    (void) threads;
+    #endif
+    
+    if (error != NULL) *error = status;
+    return status == CSV_SUCCESS;
+}
+
+struct csv_async *csv_read_async(const char * const filename, const struct csv_options *options, csv_async_fn on_done, void *data, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    struct csv_async *async = NULL;
+    
+    if (filename == NULL) STOP(error, CSV_NULL_FILENAME, early_stop);
+    
+    async = malloc(sizeof(struct csv_async));
+    if (async == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    size_t length = strlen(filename) + 1;
+    async->filename = malloc(length);
+    if (async->filename == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    memcpy(async->filename, filename, length);
+    
+    if (options != NULL) async->options = *options;
+    else memset(&async->options, 0, sizeof(struct csv_options));
+    
+    async->on_done = on_done;
+    async->data = data;
+    async->csv = NULL;
+    async->error = CSV_UNDEFINED;
+    async->fd[0] = -1;
+    async->fd[1] = -1;
+    async->done = false;
+    
+    #ifdef CSV_PTHREADS
+    status = csv_async_notifier(async);
+    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    
+    if (pthread_mutex_init(&async->lock, NULL) != 0) STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
+    
+    if (pthread_cond_init(&async->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&async->lock);
+        STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
+    }
+    
+    async->job.task = csv_async_run;
+    async->job.arg = async;
+    async->job.batch = NULL;
+    
+    struct csv_pool *pool = async->options.pool;
+    
+    if (pool != NULL) csv_pool_submit(pool, &async->job);
+    else
+    {
+        //submit under the lock, csv_async_configure() may free the pool after it
+        pthread_mutex_lock(&csv_async_lock);
+        pool = csv_async_default(&status);
+        if (pool != NULL) csv_pool_submit(pool, &async->job);
+        pthread_mutex_unlock(&csv_async_lock);
+        
+        if (pool == NULL)
+        {
+            pthread_mutex_destroy(&async->lock);
+            pthread_cond_destroy(&async->cond);
+            STOP(error, status, fail);
+        }
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return async;
+    #else
+    (void) status;
+    async->csv = csv_read_opts(async->filename, &async->options, &async->error);
+    async->done = true;
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    if (on_done != NULL) on_done(async, data);
+    return async;
+    #endif
+    
+    fail:
+        #ifdef CSV_PTHREADS
+        if (async->fd[0] >= 0) close(async->fd[0]);
+        if (async->fd[1] >= 0 && async->fd[1] != async->fd[0]) close(async->fd[1]);
+        #endif
+        free(async->filename);
+        free(async);
+        return NULL;
+        
+    early_stop:
+        return NULL;
+}
+
+int csv_async_fd(const struct csv_async *async)
+{
+    return async == NULL ? -1 : async->fd[0];
+}
+
+bool csv_async_done(struct csv_async *async)
+{
+    if (async == NULL) return false;
+    
+    #ifdef CSV_PTHREADS
+    pthread_mutex_lock(&async->lock);
+    bool done = async->done;
+    pthread_mutex_unlock(&async->lock);
+    return done;
+    #else
+    return async->done;
+    #endif
+}
+
+struct csv *csv_async_wait(struct csv_async *async, csv_errno *error)
+{
+    if (async == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    #ifdef CSV_PTHREADS
+    pthread_mutex_lock(&async->lock);
+    while (async->done == false) pthread_cond_wait(&async->cond, &async->lock);
+    pthread_mutex_unlock(&async->lock);
+    
+    pthread_mutex_destroy(&async->lock);
+    pthread_cond_destroy(&async->cond);
+    close(async->fd[0]);
+    if (async->fd[1] != async->fd[0]) close(async->fd[1]);
+    #endif
+    
+    struct csv *csv = async->csv;
+    
+    if (error != NULL) *error = async->error;
+    free(async->filename);
+    free(async);
+    
+    return csv;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Open addressing hash table over cell strings with robin hood insertion. Robin
+hood keeps probe sequences short even at the high load factor used here, which
+keeps the table small enough to stay in cache for low cardinality columns. The
+table does not own the keys, they point into struct csv. A zero hash marks an
+empty slot, so stored hashes always have their low bit set.
+*/
+
+#define CSV_TABLE_INITIAL 1024
+#define CSV_TABLE_LOAD 0.9
+
+struct csv_slot
+{
+    uint64_t hash;
+    const char *key;
+    uint64_t count;
+};
+
+struct csv_table
+{
+    struct csv_slot *slots;
+    uint64_t mask;
+    uint64_t size;
+};
+
+static bool csv_table_init(struct csv_table *table, uint64_t capacity)
+{
+    table->slots = calloc(capacity, sizeof(struct csv_slot));
+    table->mask = capacity - 1;
+    table->size = 0;
+    
+    return table->slots != NULL;
+}
+
+/*******************************************************************************
+Place an entry known to be absent from the table. Richer entries are displaced
+and carried forward until an empty slot is found.
+*/
+
+static void csv_table_place(struct csv_table *table, struct csv_slot entry)
+{
+    uint64_t pos = entry.hash & table->mask;
+    uint64_t dist = 0;
+    
+    while (table->slots[pos].hash != 0)
+    {
+        struct csv_slot *slot = &table->slots[pos];
+        uint64_t slot_dist = (pos - (slot->hash & table->mask)) & table->mask;
+        
+        if (slot_dist < dist)
+        {
+            struct csv_slot tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+            dist = slot_dist;
+        }
+        
+        pos = (pos + 1) & table->mask;
+        dist++;
+    }
+    
+    table->slots[pos] = entry;
+    table->size++;
+}
+
+static bool csv_table_grow(struct csv_table *table)
+{
+    struct csv_table bigger;
+    
+    if (csv_table_init(&bigger, (table->mask + 1) * 2) == false) return false;
+    
+    for (uint64_t i = 0; i <= table->mask; i++)
+    {
+        if (table->slots[i].hash != 0) csv_table_place(&bigger, table->slots[i]);
+    }
+    
+    free(table->slots);
+    *table = bigger;
+    
+    return true;
+}
+
+/*******************************************************************************
+Add count occurrences of key. The probe stops at the first slot that is poorer
+than the probe itself, because robin hood ordering guarantees the key cannot be
+stored beyond it.
+*/
+
+static bool csv_table_add(struct csv_table *table, const char *key, uint64_t hash, uint64_t count)
+{
+    hash |= 1;
+    
+    if ((double) (table->size + 1) > CSV_TABLE_LOAD * (double) (table->mask + 1))
+    {
+        if (csv_table_grow(table) == false) return false;
+    }
+    
+    uint64_t pos = hash & table->mask;
+    uint64_t dist = 0;
+    
+    while (table->slots[pos].hash != 0)
+    {
+        struct csv_slot *slot = &table->slots[pos];
+        
+        if (slot->hash == hash && strcmp(slot->key, key) == 0)
+        {
+            slot->count += count;
+            return true;
+        }
+        
+        if (((pos - (slot->hash & table->mask)) & table->mask) < dist) break;
+        
+        pos = (pos + 1) & table->mask;
+        dist++;
+    }
+    
+    csv_table_place(table, (struct csv_slot) {hash, key, count});
+    
+    return true;
+}
+
+/*******************************************************************************
+Each task counts the non-missing cells of one row range into a private table or
+a private set of HyperLogLog registers. The partial results are merged by the
+caller once every task has finished.
+*/
+
+#define CSV_HLL_BITS 14
+#define CSV_HLL_REGISTERS (1U << CSV_HLL_BITS)
+
+struct csv_count_task
+{
+    struct csv *csv;
+    struct csv_table table;
+    unsigned char *registers;
+    uint32_t col;
+    uint32_t begin;
+    uint32_t end;
+    csv_errno status;
+};
+
+static void csv_count_range(void *arg)
+{
+    struct csv_count_task *task = arg;
+    const uint32_t j = task->col;
+    
+    task->status = CSV_SUCCESS;
+    
+    for (uint32_t i = task->begin; i < task->end; i++)
+    {
+        const char *cell = task->csv->data[i][j];
+        
+        if (cell[0] == '\0') continue;
+        
+        uint64_t hash = csv_hash(cell, strlen(cell));
+        
+        if (task->registers != NULL)
+        {
+            //leading zeros of the remaining bits, plus one, capped by width
+            uint32_t index = (uint32_t) (hash >> (64 - CSV_HLL_BITS));
+            uint64_t rest = hash << CSV_HLL_BITS;
+            unsigned char rank = 1;
+            
+            while (rank <= 64 - CSV_HLL_BITS && (rest & (1ULL << 63)) == 0)
+            {
+                rest <<= 1;
+                rank++;
+            }
+            
+            if (rank > task->registers[index]) task->registers[index] = rank;
+        }
+        else if (csv_table_add(&task->table, cell, hash, 1) == false)
+        {
+            task->status = CSV_MALLOC_FAILED;
+            return;
+        }
+    }
+}
+
+/*******************************************************************************
+Split the rows of column j into one range per pool thread and run the count
+tasks. Ranges are contiguous so that each thread walks the row array
+sequentially. The range count is clamped to the row count and returned in n.
+*/
+
+static struct csv_count_task *csv_count(struct csv *csv, const uint32_t j, struct csv_pool *pool, uint32_t *n, bool approximate, csv_errno *status)
+{
+    uint32_t threads = csv_pool_size(pool);
+    
+    if (threads > csv->rows) threads = csv->rows;
+    if (threads == 0) threads = 1;
+    
+    *n = threads;
+    
+    struct csv_count_task *tasks = calloc(threads, sizeof(struct csv_count_task));
+    if (tasks == NULL) goto fail;
+    
+    uint32_t chunk = csv->rows / threads;
+    
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        tasks[t].csv = csv;
+        tasks[t].col = j;
+        tasks[t].begin = t * chunk;
+        tasks[t].end = t == threads - 1 ? csv->rows : (t + 1) * chunk;
+        tasks[t].status = CSV_UNDEFINED;
+        
+        if (approximate == true)
+        {
+            tasks[t].registers = calloc(CSV_HLL_REGISTERS, 1);
+            if (tasks[t].registers == NULL) goto fail;
+        }
+        else if (csv_table_init(&tasks[t].table, CSV_TABLE_INITIAL) == false)
+        {
+            goto fail;
+        }
+    }
+    
+    csv_parallel(pool, csv_count_range, tasks, sizeof(struct csv_count_task), threads);
+    
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        if (tasks[t].status != CSV_SUCCESS)
+        {
+            *status = tasks[t].status;
+            goto cleanup;
+        }
+    }
+    
+    //merge everything into the first task
+    for (uint32_t t = 1; t < threads; t++)
+    {
+        for (uint64_t k = 0; approximate == false && k <= tasks[t].table.mask; k++)
+        {
+            struct csv_slot *slot = &tasks[t].table.slots[k];
+            
+            if (slot->hash == 0) continue;
+            
+            if (csv_table_add(&tasks[0].table, slot->key, slot->hash, slot->count) == false)
+            {
+                goto fail;
+            }
+        }
+        
+        for (uint32_t k = 0; approximate == true && k < CSV_HLL_REGISTERS; k++)
+        {
+            if (tasks[t].registers[k] > tasks[0].registers[k])
+            {
+                tasks[0].registers[k] = tasks[t].registers[k];
+            }
+        }
+    }
+    
+    *status = CSV_SUCCESS;
+    return tasks;
+    
+    fail:
+        *status = CSV_MALLOC_FAILED;
+        
+    cleanup:
+        for (uint32_t t = 0; tasks != NULL && t < threads; t++)
+        {
+            free(tasks[t].table.slots);
+            free(tasks[t].registers);
+        }
+        
+        free(tasks);
+        return NULL;
+}
+
+static void csv_count_free(struct csv_count_task *tasks, uint32_t threads)
+{
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        free(tasks[t].table.slots);
+        free(tasks[t].registers);
+    }
+    
+    free(tasks);
+}
+
+/*******************************************************************************
+Order by descending count, ties broken by ascending value for determinism.
+*/
+
+static int csv_count_order(const void *a, const void *b)
+{
+    const struct csv_count *x = a;
+    const struct csv_count *y = b;
+    
+    if (x->count != y->count) return x->count > y->count ? -1 : 1;
+    
+    return strcmp(x->value, y->value);
+}
+
+/*******************************************************************************
+When only the top n values are requested, a min-heap of n entries is kept over
+the table so that selecting them costs O(distinct log n) rather than a full sort
+of every distinct value. The heap root is the worst entry seen so far.
+*/
+
+static void csv_heap_sift(struct csv_count *heap, uint32_t n, uint32_t i)
+{
+    while (1)
+    {
+        uint32_t worst = i;
+        uint32_t left = 2 * i + 1;
+        uint32_t right = 2 * i + 2;
+        
+        if (left < n && csv_count_order(&heap[left], &heap[worst]) > 0) worst = left;
+        if (right < n && csv_count_order(&heap[right], &heap[worst]) > 0) worst = right;
+        if (worst == i) return;
+        
+        struct csv_count tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+struct csv_count *csv_value_counts(struct csv *csv, const uint32_t j, const uint32_t top_n, struct csv_pool *pool, uint32_t *n, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    uint32_t tasks_n = 0;
+    
+    if (csv == NULL || n == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    struct csv_count_task *tasks = csv_count(csv, j, pool, &tasks_n, false, &status);
+    if (tasks == NULL) STOP(error, status, early_stop);
+    
+    const struct csv_table *table = &tasks[0].table;
+    uint64_t limit = top_n == 0 || top_n > table->size ? table->size : top_n;
+    uint32_t total = 0;
+    
+    struct csv_count *counts = malloc(sizeof(struct csv_count) * limit + 1);
+    if (counts == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    for (uint64_t k = 0; k <= table->mask; k++)
+    {
+        const struct csv_slot *slot = &table->slots[k];
+        struct csv_count entry = {slot->key, slot->count};
+        
+        if (slot->hash == 0) continue;
+        
+        if (total < limit)
+        {
+            counts[total++] = entry;
+            
+            if (total == limit)
+            {
+                for (uint32_t i = total / 2; i-- > 0; ) csv_heap_sift(counts, total, i);
+            }
+        }
+        else if (csv_count_order(&entry, &counts[0]) < 0)
+        {
+            counts[0] = entry;
+            csv_heap_sift(counts, total, 0);
+        }
+    }
+    
+    qsort(counts, total, sizeof(struct csv_count), csv_count_order);
+    csv_count_free(tasks, tasks_n);
+    
+    *n = total;
+    if (error != NULL) *error = CSV_SUCCESS;
+    return counts;
+    
+    fail:
+        csv_count_free(tasks, tasks_n);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Exact mode sizes the merged hash table. Approximate mode uses HyperLogLog with
+2^14 one byte registers, about 0.8% standard error in 16 KiB per thread, and
+the usual linear counting correction for small cardinalities.
+*/
+
+uint64_t csv_distinct(struct csv *csv, const uint32_t j, const bool exact, struct csv_pool *pool, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    uint64_t distinct = 0;
+    uint32_t tasks_n = 0;
+    
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    struct csv_count_task *tasks = csv_count(csv, j, pool, &tasks_n, !exact, &status);
+    if (tasks == NULL) STOP(error, status, early_stop);
+    
+    if (exact == true) distinct = tasks[0].table.size;
+    else
+    {
+        const double m = CSV_HLL_REGISTERS;
+        double sum = 0;
+        uint32_t zeros = 0;
+        
+        for (uint32_t k = 0; k < CSV_HLL_REGISTERS; k++)
+        {
+            sum += ldexp(1.0, -tasks[0].registers[k]);
+            zeros += tasks[0].registers[k] == 0;
+        }
+        
+        double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+        
+        if (estimate <= 2.5 * m && zeros != 0) estimate = m * log(m / zeros);
+        
+        distinct = (uint64_t) (estimate + 0.5);
+    }
+    
+    csv_count_free(tasks, tasks_n);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return distinct;
+    
+    early_stop:
+        return 0;
+}
+
+/*******************************************************************************
+Short windows are computed directly, one pass over the input per window offset.
+Each pass is a branch-free loop over contiguous memory that the compiler turns
+into SIMD, which beats the bookkeeping of the O(n) kernels for small windows.
+The min and max selects never pick a NaN value over a number.
+*/
+
+static void csv_rolling_direct(const double *values, uint32_t n, uint32_t window, csv_rolling_op op, double *out)
+{
+    for (uint32_t i = window - 1; i < n; i++) out[i] = values[i];
+    
+    for (uint32_t k = 1; k < window; k++)
+    {
+        const double *v = values - k;
+        
+        switch (op)
+        {
+            case CSV_ROLLING_SUM:
+            case CSV_ROLLING_MEAN:
+                for (uint32_t i = window - 1; i < n; i++) out[i] += v[i];
+                break;
+            case CSV_ROLLING_MIN:
+                for (uint32_t i = window - 1; i < n; i++)
+                {
+                    out[i] = v[i] < out[i] || out[i] != out[i] ? v[i] : out[i];
+                }
+                break;
+            case CSV_ROLLING_MAX:
+                for (uint32_t i = window - 1; i < n; i++)
+                {
+                    out[i] = v[i] > out[i] || out[i] != out[i] ? v[i] : out[i];
+                }
+                break;
+        }
+    }
+    
+    if (op == CSV_ROLLING_MEAN)
+    {
+        for (uint32_t i = window - 1; i < n; i++) out[i] /= window;
+    }
+}
+
+/*******************************************************************************
+Running sum over long windows. Adding and subtracting accumulates rounding
+error, so the sum is recomputed from scratch once every window elements. That
+keeps the error bounded by a single window and the total work at about 2n. NaN
+values are counted rather than summed, otherwise one NaN would poison the
+running sum until the next recomputation.
+*/
+
+static void csv_rolling_sum(const double *values, uint32_t n, uint32_t window, csv_rolling_op op, double *out)
+{
+    double sum = 0;
+    uint32_t nans = 0;
+    
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (i >= window && i % window == 0)
+        {
+            sum = 0;
+            nans = 0;
+            
+            for (uint32_t k = i - window + 1; k <= i; k++)
+            {
+                if (values[k] == values[k]) sum += values[k];
+                else nans++;
+            }
+        }
+        else
+        {
+            if (values[i] == values[i]) sum += values[i];
+            else nans++;
+            
+            if (i >= window && values[i - window] == values[i - window]) sum -= values[i - window];
+            else if (i >= window) nans--;
+        }
+        
+        if (i + 1 < window) continue;
+        
+        if (nans > 0) out[i] = NAN;
+        else out[i] = op == CSV_ROLLING_MEAN ? sum / window : sum;
+    }
+}
+
+/*******************************************************************************
+Monotonic deque over long windows. The deque holds indices of candidate
+extremes in a ring of window slots, oldest at the front. An index is discarded
+once a newer value is at least as extreme, or once it leaves the window, so
+each index is pushed and popped at most once.
+*/
+
+static bool csv_rolling_deque(const double *values, uint32_t n, uint32_t window, csv_rolling_op op, double *out)
+{
+    uint32_t *ring = malloc(sizeof(uint32_t) * window);
+    if (ring == NULL) return false;
+    
+    uint32_t head = 0;
+    uint32_t size = 0;
+    bool max = op == CSV_ROLLING_MAX;
+    
+    for (uint32_t i = 0; i < n; i++)
+    {
+        double v = values[i];
+        
+        //expire the front once it falls out of the window
+        if (size > 0 && ring[head] + window <= i)
+        {
+            head = (head + 1) % window;
+            size--;
+        }
+        
+        if (v == v)
+        {
+            while (size > 0)
+            {
+                double back = values[ring[(head + size - 1) % window]];
+                if (max ? back > v : back < v) break;
+                size--;
+            }
+            
+            ring[(head + size) % window] = i;
+            size++;
+        }
+        
+        if (i + 1 < window) continue;
+        
+        out[i] = size > 0 ? values[ring[head]] : (double) NAN;
+    }
+    
+    free(ring);
+    return true;
+}
+
+/******************************************************************************/
+
+bool csv_rolling(const double *values, const uint32_t n, const uint32_t window, const csv_rolling_op op, double *out, csv_errno *error)
+{
+    if (values == NULL || out == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (window == 0 || op > CSV_ROLLING_MAX) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    for (uint32_t i = 0; i + 1 < window && i < n; i++) out[i] = NAN;
+    
+    if (window > n) goto success;
+    
+    if (window <= CSV_ROLLING_DIRECT)
+    {
+        csv_rolling_direct(values, n, window, op, out);
+    }
+    else if (op == CSV_ROLLING_SUM || op == CSV_ROLLING_MEAN)
+    {
+        csv_rolling_sum(values, n, window, op, out);
+    }
+    else if (csv_rolling_deque(values, n, window, op, out) == false)
+    {
+        STOP(error, CSV_MALLOC_FAILED, early_stop);
+    }
+    
+    success:
+        if (error != NULL) *error = CSV_SUCCESS;
+        return true;
+    
+    early_stop:
+        return false;
+}
+
+/*******************************************************************************
+Histogram tasks bin one contiguous row range into private counts, visiting it
+one zone map block of step rows at a time. The counts have an extra trailing
+slot for values that are out of range or missing. Routing rejects to that slot
+keeps the bin index computation free of branches.
+*/
+
+struct csv_histogram_task
+{
+    struct csv *csv;
+    uint64_t *counts;
+    double lo;
+    double hi;
+    double scale;
+    uint32_t col;
+    uint32_t bins;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t step;
+    csv_errno status;
+};
+
+static void csv_histogram_batch(struct csv_histogram_task *task, uint32_t begin, uint32_t count)
+{
+    double values[CSV_FILTER_BATCH];
+    uint32_t index[CSV_FILTER_BATCH];
+    const uint32_t bins = task->bins;
+    const double lo = task->lo;
+    const double hi = task->hi;
+    const double scale = task->scale;
+    
+    for (uint32_t k = 0; k < count; k++)
+    {
+        const char *cell = task->csv->data[begin + k][task->col];
+        csv_errno status = csv_convert_double(cell, &values[k]);
+        
+        if (status == CSV_MISSING_DATA) values[k] = NAN;
+        else if (status != CSV_SUCCESS)
+        {
+            task->status = status;
+            return;
+        }
+    }
+    
+    //NaN fails the range test and is routed to the reject slot
+    for (uint32_t k = 0; k < count; k++)
+    {
+        double v = values[k];
+        bool in = (v >= lo) & (v <= hi);
+        uint32_t b = (uint32_t) ((in ? v - lo : 0) * scale);
+        
+        b = b < bins ? b : bins - 1;
+        index[k] = in ? b : bins;
+    }
+    
+    for (uint32_t k = 0; k < count; k++) task->counts[index[k]]++;
+}
+
+static void csv_histogram_range(void *arg)
+{
+    struct csv_histogram_task *task = arg;
+    struct csv *csv = task->csv;
+    const uint32_t step = task->step;
+    
+    task->status = CSV_SUCCESS;
+    
+    for (uint32_t i = task->begin; i < task->end; )
+    {
+        uint32_t b = i / step;
+        uint32_t end = step == UINT32_MAX || (b + 1) * step > task->end ? task->end : (b + 1) * step;
+        
+        if (csv_zone_excludes(csv, b, task->col, task->lo, task->hi) == true)
+        {
+            i = end;
+            continue;
+        }
+        
+        while (i < end && task->status == CSV_SUCCESS)
+        {
+            uint32_t n = end - i > CSV_FILTER_BATCH ? CSV_FILTER_BATCH : end - i;
+            csv_histogram_batch(task, i, n);
+            i += n;
+        }
+        
+        if (task->status != CSV_SUCCESS) return;
+    }
+}
+
+/******************************************************************************/
+
+uint64_t *csv_histogram(struct csv *csv, const uint32_t j, const uint32_t bins, const double lo, const double hi, struct csv_pool *pool, csv_errno *error)
+{
+    uint32_t tasks_n = csv_pool_size(pool);
+    
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols || bins == 0) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    if (!(lo < hi)) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    if (tasks_n > csv->rows) tasks_n = csv->rows;
+    if (tasks_n == 0) tasks_n = 1;
+    
+    uint64_t *histogram = calloc(bins, sizeof(uint64_t));
+    struct csv_histogram_task *tasks = calloc(tasks_n, sizeof(struct csv_histogram_task));
+    
+    if (histogram == NULL || tasks == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    uint32_t chunk = csv->rows / tasks_n;
+    
+    for (uint32_t t = 0; t < tasks_n; t++)
+    {
+        tasks[t].csv = csv;
+        tasks[t].counts = calloc((uint64_t) bins + 1, sizeof(uint64_t));
+        tasks[t].lo = lo;
+        tasks[t].hi = hi;
+        tasks[t].scale = bins / (hi - lo);
+        tasks[t].col = j;
+        tasks[t].bins = bins;
+        tasks[t].begin = t * chunk;
+        tasks[t].end = t == tasks_n - 1 ? csv->rows : (t + 1) * chunk;
+        tasks[t].step = csv->zonemap == NULL ? UINT32_MAX : csv->zonemap->block_rows;
+        tasks[t].status = CSV_UNDEFINED;
+        
+        if (tasks[t].counts == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    csv_parallel(pool, csv_histogram_range, tasks, sizeof(struct csv_histogram_task), tasks_n);
+    
+    for (uint32_t t = 0; t < tasks_n; t++)
+    {
+        if (tasks[t].status != CSV_SUCCESS) STOP(error, tasks[t].status, fail);
+        
+        for (uint32_t b = 0; b < bins; b++) histogram[b] += tasks[t].counts[b];
+    }
+    
+    for (uint32_t t = 0; t < tasks_n; t++) free(tasks[t].counts);
+    free(tasks);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return histogram;
+    
+    fail:
+        for (uint32_t t = 0; tasks != NULL && t < tasks_n; t++) free(tasks[t].counts);
+        free(tasks);
+        free(histogram);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Columnar files. The layout is a 16 byte header, one blob per column aligned to
+8 bytes, a footer directory and a 16 byte trailer that points back at the
+footer. Every integer in the file is little endian whatever the host, so files
+move freely between machines. A reader only needs the trailer and the footer
+to find a column, and decoding a column touches nothing but its own blob.
+
+    header  : magic, reserved
+    blobs   : column data and optional missing bitmap per column
+    footer  : rows, cols, has header, names length,
+              per column offset, length, bitmap, name, type, encoding,
+              nul terminated names
+    trailer : footer offset, magic
+
+Numbers are handled as 64-bit patterns, a double by its bits, so every numeric
+column goes through the same encoders. The writer sizes each candidate and
+keeps the smallest. Bit packed vectors all share one layout, a base value, a
+width and the values minus base packed LSB first, followed by 8 spare bytes so
+the decoder can always load a whole 64-bit word.
+
+    plain   : values as 8 byte words
+    bitpack : one packed vector with base min and width of max - min
+    delta   : first value, packed vector of the n - 1 differences
+    rle     : run count, packed run values, packed run lengths
+    dict    : distinct count, packed distinct values, packed codes
+
+String columns are plain, packed start offsets into a blob of nul terminated
+strings, or dict, packed offsets of the distinct strings and packed codes. The
+strings are used straight from the mapping. Missing numbers are flagged in a
+bitmap, missing strings are simply empty.
+*/
+
+#define CSV_COLUMNAR_MAGIC "CSVCOL01"
+#define CSV_COLUMNAR_ENTRY 48
+#define CSV_COLUMNAR_FIXED 32
+
+enum csv_encoding
+{
+    CSV_ENCODING_PLAIN,
+    CSV_ENCODING_BITPACK,
+    CSV_ENCODING_DELTA,
+    CSV_ENCODING_RLE,
+    CSV_ENCODING_DICT
+};
+
+static inline void csv_put64(uint8_t *p, uint64_t value)
+{
+    for (uint32_t k = 0; k < 8; k++) p[k] = (uint8_t) (value >> (8 * k));
+}
+
+static inline uint64_t csv_get64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    
+    for (uint32_t k = 0; k < 8; k++) value |= (uint64_t) p[k] << (8 * k);
+    
+    return value;
+}
+
+static uint32_t csv_bit_width(uint64_t range)
+{
+    uint32_t width = 0;
+    
+    while (width < 64 && (range >> width) != 0) width++;
+    
+    return width;
+}
+
+/*******************************************************************************
+Bytes taken by a packed vector of n values, including its 16 byte header and
+the spare word, rounded up to keep the next vector aligned.
+*/
+
+static uint64_t csv_packed_size(uint64_t n, uint32_t width)
+{
+    return 16 + ((n * width + 7) / 8 + 8 + 7) / 8 * 8;
+}
+
+/*******************************************************************************
+Pack values minus base with the given width into out, which must be zeroed and
+hold csv_packed_size() bytes. Returns the bytes used.
+*/
+
+static uint64_t csv_pack(const uint64_t *values, uint64_t n, uint64_t base, uint32_t width, uint8_t *out)
+{
+    const uint64_t mask = width == 64 ? UINT64_MAX : (1ULL << width) - 1;
+    uint8_t *data = out + 16;
+    uint64_t acc = 0;
+    uint64_t pos = 0;
+    uint32_t fill = 0;
+    
+    csv_put64(out, base);
+    out[8] = (uint8_t) width;
+    
+    for (uint64_t i = 0; width > 0 && i < n; i++)
+    {
+        uint64_t v = (values[i] - base) & mask;
+        
+        acc |= v << fill;
+        
+        if (fill + width >= 64)
+        {
+            uint32_t used = 64 - fill;
+            
+            csv_put64(data + pos, acc);
+            pos += 8;
+            acc = used < 64 ? v >> used : 0;
+            fill = fill + width - 64;
+        }
+        else fill += width;
+    }
+    
+    if (fill > 0) csv_put64(data + pos, acc);
+    
+    return csv_packed_size(n, width);
+}
+
+/*******************************************************************************
+Decode side of a packed vector. The view is checked against the blob once, so
+the unpack loop itself needs no bounds checks.
+*/
+
+struct csv_packed
+{
+    const uint8_t *data;
+    uint64_t base;
+    uint64_t n;
+    uint32_t width;
+    uint32_t pad;
+};
+
+static bool csv_packed_view(const uint8_t *blob, uint64_t length, uint64_t *pos, uint64_t n, struct csv_packed *view)
+{
+    if (*pos > length || length - *pos < 16) return false;
+    
+    view->base = csv_get64(blob + *pos);
+    view->width = blob[*pos + 8];
+    view->n = n;
+    view->data = blob + *pos + 16;
+    
+    if (view->width > 64) return false;
+    
+    uint64_t size = csv_packed_size(n, view->width);
+    if (length - *pos < size) return false;
+    
+    *pos += size;
+    
+    return true;
+}
+
+static inline uint64_t csv_packed_get(const struct csv_packed *view, uint64_t i)
+{
+    if (view->width == 0) return view->base;
+    
+    const uint64_t bit = i * view->width;
+    const uint8_t *p = view->data + bit / 8;
+    const uint32_t shift = (uint32_t) (bit % 8);
+    uint64_t v = csv_get64(p) >> shift;
+    
+    if (shift + view->width > 64) v |= (uint64_t) p[8] << (64 - shift);
+    if (view->width < 64) v &= (1ULL << view->width) - 1;
+    
+    return view->base + v;
+}
+
+static void csv_unpack(const struct csv_packed *view, uint64_t *out)
+{
+    for (uint64_t i = 0; i < view->n; i++) out[i] = csv_packed_get(view, i);
+}
+
+/*******************************************************************************
+Growable output buffer of the writer. Space is zeroed as it is reserved, which
+is what csv_pack expects.
+*/
+
+struct csv_buffer
+{
+    uint8_t *bytes;
+    uint64_t length;
+    uint64_t capacity;
+};
+
+static uint8_t *csv_buffer_reserve(struct csv_buffer *buffer, uint64_t n)
+{
+    if (buffer->capacity - buffer->length < n)
+    {
+        uint64_t capacity = 2 * (buffer->length + n);
+        
+        if (capacity > SIZE_MAX) return NULL;
+        
+        uint8_t *bytes = realloc(buffer->bytes, (size_t) capacity);
+        if (bytes == NULL) return NULL;
+        
+        buffer->bytes = bytes;
+        buffer->capacity = capacity;
+    }
+    
+    uint8_t *p = buffer->bytes + buffer->length;
+    memset(p, 0, (size_t) n);
+    buffer->length += n;
+    
+    return p;
+}
+
+static bool csv_buffer_put64(struct csv_buffer *buffer, uint64_t value)
+{
+    uint8_t *p = csv_buffer_reserve(buffer, 8);
+    if (p == NULL) return false;
+    
+    csv_put64(p, value);
+    return true;
+}
+
+static bool csv_buffer_pack(struct csv_buffer *buffer, const uint64_t *values, uint64_t n, uint64_t base, uint32_t width)
+{
+    uint8_t *p = csv_buffer_reserve(buffer, csv_packed_size(n, width));
+    if (p == NULL) return false;
+    
+    csv_pack(values, n, base, width, p);
+    return true;
+}
+
+/*******************************************************************************
+Base and width of a frame of reference over values. Signed order is used for
+the frame, any total order works as long as all values fit above the base.
+*/
+
+static uint32_t csv_frame(const uint64_t *values, uint64_t n, uint64_t *base)
+{
+    int64_t lo = n == 0 ? 0 : (int64_t) values[0];
+    int64_t hi = lo;
+    
+    for (uint64_t i = 1; i < n; i++)
+    {
+        int64_t v = (int64_t) values[i];
+        if (v < lo) lo = v;
+        if (v > hi) hi = v;
+    }
+    
+    *base = (uint64_t) lo;
+    
+    return csv_bit_width((uint64_t) hi - (uint64_t) lo);
+}
+
+/*******************************************************************************
+Dictionary of 64-bit values or strings, open addressing with linear probing.
+Slots hold the code plus one. Building stops once the dictionary would no
+longer pay off, which bounds its cost on high cardinality columns.
+*/
+
+struct csv_dict
+{
+    uint32_t *slots;
+    uint64_t *values;
+    const char **strings;
+    uint64_t *codes;
+    uint64_t mask;
+    uint64_t size;
+};
+
+static uint64_t csv_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    
+    return x;
+}
+
+static void csv_dict_free(struct csv_dict *dict)
+{
+    free(dict->slots);
+    free(dict->values);
+    free(dict->strings);
+    free(dict->codes);
+}
+
+/*******************************************************************************
+Build the dictionary of values, or of strings when strings is not null. False
+if memory runs out or more than limit distinct entries turn up.
+*/
+
+static bool csv_dict_build(struct csv_dict *dict, const uint64_t *values, const char **strings, uint64_t n, uint64_t limit)
+{
+    uint64_t capacity = 16;
+    
+    while (capacity < 2 * limit) capacity *= 2;
+    
+    dict->mask = capacity - 1;
+    dict->size = 0;
+    dict->slots = calloc((size_t) capacity, sizeof(uint32_t));
+    dict->values = strings == NULL ? malloc(sizeof(uint64_t) * (limit + 1)) : NULL;
+    dict->strings = strings != NULL ? malloc(sizeof(char *) * (limit + 1)) : NULL;
+    dict->codes = malloc(sizeof(uint64_t) * (n + 1));
+    
+    if (dict->slots == NULL || dict->codes == NULL) return false;
+    if (dict->values == NULL && dict->strings == NULL) return false;
+    
+    for (uint64_t i = 0; i < n; i++)
+    {
+        uint64_t hash = strings == NULL ? csv_mix(values[i]) : csv_hash(strings[i], strlen(strings[i]));
+        uint64_t pos = hash & dict->mask;
+        
+        while (dict->slots[pos] != 0)
+        {
+            uint64_t code = dict->slots[pos] - 1;
+            
+            if (strings == NULL ? dict->values[code] == values[i] : strcmp(dict->strings[code], strings[i]) == 0) break;
+            pos = (pos + 1) & dict->mask;
+        }
+        
+        if (dict->slots[pos] == 0)
+        {
+            if (dict->size == limit) return false;
+            
+            if (strings == NULL) dict->values[dict->size] = values[i];
+            else dict->strings[dict->size] = strings[i];
+            
+            dict->slots[pos] = (uint32_t) ++dict->size;
+        }
+        
+        dict->codes[i] = dict->slots[pos] - 1;
+    }
+    
+    return true;
+}
+
+/*******************************************************************************
+Encode n numeric patterns with the smallest encoding. The delta and run
+arrays are derived once up front, each candidate is only sized, and the
+winner is written to the buffer.
+*/
+
+static csv_errno csv_encode_numbers(struct csv_buffer *buffer, const uint64_t *values, uint64_t n, uint64_t *encoding)
+{
+    csv_errno status = CSV_MALLOC_FAILED;
+    struct csv_dict dict = {0};
+    uint64_t *deltas = malloc(sizeof(uint64_t) * (n + 1));
+    uint64_t *runs = malloc(sizeof(uint64_t) * (n + 1));
+    uint64_t *lengths = malloc(sizeof(uint64_t) * (n + 1));
+    uint64_t r = 0;
+    
+    if (deltas == NULL || runs == NULL || lengths == NULL) goto done;
+    
+    for (uint64_t i = 0; i < n; i++)
+    {
+        if (i > 0) deltas[i - 1] = values[i] - values[i - 1];
+        
+        if (r > 0 && runs[r - 1] == values[i]) lengths[r - 1]++;
+        else
+        {
+            runs[r] = values[i];
+            lengths[r++] = 1;
+        }
+    }
+    
+    uint64_t base = 0, delta_base = 0, run_base = 0, length_base = 0, dict_base = 0;
+    const uint32_t width = csv_frame(values, n, &base);
+    const uint32_t delta_width = csv_frame(deltas, n == 0 ? 0 : n - 1, &delta_base);
+    const uint32_t run_width = csv_frame(runs, r, &run_base);
+    const uint32_t length_width = csv_frame(lengths, r, &length_base);
+    
+    uint64_t best = 8 * n;
+    *encoding = CSV_ENCODING_PLAIN;
+    
+    uint64_t size = csv_packed_size(n, width);
+    if (size < best) { best = size; *encoding = CSV_ENCODING_BITPACK; }
+    
+    size = 8 + csv_packed_size(n == 0 ? 0 : n - 1, delta_width);
+    if (size < best) { best = size; *encoding = CSV_ENCODING_DELTA; }
+    
+    size = 8 + csv_packed_size(r, run_width) + csv_packed_size(r, length_width);
+    if (size < best) { best = size; *encoding = CSV_ENCODING_RLE; }
+    
+    //a dictionary only wins with few distinct values, cap it accordingly
+    uint32_t dict_width = 0;
+    
+    if (csv_dict_build(&dict, values, NULL, n, n / 4 + 1) == true)
+    {
+        dict_width = csv_frame(dict.values, dict.size, &dict_base);
+        size = 8 + csv_packed_size(dict.size, dict_width) + csv_packed_size(n, csv_bit_width(dict.size - 1));
+        if (size < best) { best = size; *encoding = CSV_ENCODING_DICT; }
+    }
+    
+    bool written = false;
+    
+    switch (*encoding)
+    {
+        case CSV_ENCODING_PLAIN:
+            written = true;
+            for (uint64_t i = 0; i < n && written == true; i++) written = csv_buffer_put64(buffer, values[i]);
+            break;
+        case CSV_ENCODING_BITPACK:
+            written = csv_buffer_pack(buffer, values, n, base, width);
+            break;
+        case CSV_ENCODING_DELTA:
+            written = csv_buffer_put64(buffer, n == 0 ? 0 : values[0])
+                   && csv_buffer_pack(buffer, deltas, n == 0 ? 0 : n - 1, delta_base, delta_width);
+            break;
+        case CSV_ENCODING_RLE:
+            written = csv_buffer_put64(buffer, r)
+                   && csv_buffer_pack(buffer, runs, r, run_base, run_width)
+                   && csv_buffer_pack(buffer, lengths, r, length_base, length_width);
+            break;
+        case CSV_ENCODING_DICT:
+            written = csv_buffer_put64(buffer, dict.size)
+                   && csv_buffer_pack(buffer, dict.values, dict.size, dict_base, dict_width)
+                   && csv_buffer_pack(buffer, dict.codes, n, 0, csv_bit_width(dict.size - 1));
+            break;
+    }
+    
+    if (written == true) status = CSV_SUCCESS;
+    
+    done:
+        csv_dict_free(&dict);
+        free(deltas);
+        free(runs);
+        free(lengths);
+        return status;
+}
+
+/*******************************************************************************
+Append nul terminated strings to the buffer after their packed start offsets.
+*/
+
+static bool csv_encode_blob(struct csv_buffer *buffer, const char **strings, uint64_t n, uint64_t *offsets)
+{
+    uint64_t total = 0;
+    
+    for (uint64_t i = 0; i < n; i++)
+    {
+        offsets[i] = total;
+        total += strlen(strings[i]) + 1;
+    }
+    
+    uint64_t base = 0;
+    uint32_t width = csv_frame(offsets, n, &base);
+    
+    if (csv_buffer_pack(buffer, offsets, n, base, width) == false) return false;
+    if (csv_buffer_put64(buffer, total) == false) return false;
+    
+    uint8_t *p = csv_buffer_reserve(buffer, (total + 7) / 8 * 8);
+    if (p == NULL) return false;
+    
+    for (uint64_t i = 0; i < n; i++) memcpy(p + offsets[i], strings[i], strlen(strings[i]) + 1);
+    
+    return true;
+}
+
+static csv_errno csv_encode_strings(struct csv_buffer *buffer, const char **strings, uint64_t n, uint64_t *encoding)
+{
+    csv_errno status = CSV_MALLOC_FAILED;
+    struct csv_dict dict = {0};
+    uint64_t *offsets = malloc(sizeof(uint64_t) * (n + 1));
+    uint64_t plain = 0;
+    
+    if (offsets == NULL) goto done;
+    
+    for (uint64_t i = 0; i < n; i++) plain += strlen(strings[i]) + 1;
+    
+    *encoding = CSV_ENCODING_PLAIN;
+    
+    if (csv_dict_build(&dict, NULL, strings, n, n / 2 + 1) == true)
+    {
+        uint64_t distinct = 0;
+        
+        for (uint64_t k = 0; k < dict.size; k++) distinct += strlen(dict.strings[k]) + 1;
+        
+        //offsets cost about the same in both, so compare text plus codes
+        if (distinct + csv_packed_size(n, csv_bit_width(dict.size - 1)) < plain) *encoding = CSV_ENCODING_DICT;
+    }
+    
+    bool written = false;
+    
+    if (*encoding == CSV_ENCODING_DICT)
+    {
+        written = csv_buffer_put64(buffer, dict.size)
+               && csv_buffer_pack(buffer, dict.codes, n, 0, csv_bit_width(dict.size - 1))
+               && csv_encode_blob(buffer, dict.strings, dict.size, offsets);
+    }
+    else written = csv_encode_blob(buffer, strings, n, offsets);
+    
+    if (written == true) status = CSV_SUCCESS;
+    
+    done:
+        csv_dict_free(&dict);
+        free(offsets);
+        return status;
+}
+
+/*******************************************************************************
+A column is long if every present cell converts with base 10, else double if
+every present cell converts, else text.
+*/
+
+static csv_type csv_columnar_infer(struct csv *csv, uint32_t j)
+{
+    csv_type type = CSV_TYPE_LONG;
+    
+    for (uint32_t i = 0; i < csv->rows && type != CSV_TYPE_STRING; i++)
+    {
+        const char *cell = csv->data[i][j];
+        long l = 0;
+        double d = 0;
+        
+        if (cell[0] == '\0') continue;
+        
+        if (type == CSV_TYPE_LONG && csv_convert_long(cell, 10, &l) != CSV_SUCCESS) type = CSV_TYPE_DOUBLE;
+        if (type == CSV_TYPE_DOUBLE && csv_convert_double(cell, &d) != CSV_SUCCESS) type = CSV_TYPE_STRING;
+    }
+    
+    return type;
+}
+
+/*******************************************************************************
+Encode column j into the buffer, with its missing bitmap first when it has any
+missing numbers. Missing numbers repeat the previous value, which keeps runs
+and deltas intact.
+*/
+
+static csv_errno csv_encode_column(struct csv *csv, uint32_t j, csv_type type, struct csv_buffer *buffer, uint64_t entry[6])
+{
+    csv_errno status = CSV_SUCCESS;
+    const uint64_t n = csv->rows;
+    
+    if (type == CSV_TYPE_STRING)
+    {
+        const char **strings = malloc(sizeof(char *) * (n + 1));
+        if (strings == NULL) return CSV_MALLOC_FAILED;
+        
+        for (uint64_t i = 0; i < n; i++) strings[i] = csv->data[i][j];
+        
+        entry[0] = buffer->length;
+        status = csv_encode_strings(buffer, strings, n, &entry[5]);
+        entry[1] = buffer->length - entry[0];
+        
+        free(strings);
+        return status;
+    }
+    
+    uint64_t *values = malloc(sizeof(uint64_t) * (n + 1));
+    uint8_t *bitmap = calloc((size_t) ((n + 63) / 64 * 8 + 8), 1);
+    uint64_t previous = 0;
+    bool missing = false;
+    
+    if (values == NULL || bitmap == NULL)
+    {
+        status = CSV_MALLOC_FAILED;
+        goto done;
+    }
+    
+    for (uint64_t i = 0; i < n; i++)
+    {
+        const char *cell = csv->data[i][j];
+        long l = 0;
+        double d = 0;
+        
+        if (cell[0] == '\0')
+        {
+            bitmap[i / 8] |= (uint8_t) (1u << (i % 8));
+            values[i] = previous;
+            missing = true;
+            continue;
+        }
+        
+        csv_errno converted = type == CSV_TYPE_LONG ? csv_convert_long(cell, 10, &l) : csv_convert_double(cell, &d);
+        
+        if (converted != CSV_SUCCESS)
+        {
+            status = CSV_TYPE_MISMATCH;
+            goto done;
+        }
+        
+        if (type == CSV_TYPE_LONG) values[i] = (uint64_t) (int64_t) l;
+        else memcpy(&values[i], &d, sizeof(uint64_t));
+        
+        previous = values[i];
+    }
+    
+    if (missing == true)
+    {
+        const uint64_t size = (n + 63) / 64 * 8;
+        uint8_t *p = csv_buffer_reserve(buffer, size);
+        if (p == NULL)
+        {
+            status = CSV_MALLOC_FAILED;
+            goto done;
+        }
+        
+        memcpy(p, bitmap, (size_t) size);
+        entry[2] = buffer->length - size;
+    }
+    
+    entry[0] = buffer->length;
+    status = csv_encode_numbers(buffer, values, n, &entry[5]);
+    entry[1] = buffer->length - entry[0];
+    
+    done:
+        free(values);
+        free(bitmap);
+        return status;
+}
+
+/*******************************************************************************
+Blobs are collected in memory behind the 16 byte file header, which starts the
+same buffer, so their offsets are absolute file offsets. The buffer, footer and
+trailer are then written in one go.
+*/
+
+bool csv_write_columnar(struct csv *csv, const csv_type *schema, const char * const filename, csv_errno *error)
+{
+    csv_errno status = CSV_SUCCESS;
+    struct csv_buffer blobs = {NULL, 0, 0};
+    struct csv_buffer footer = {NULL, 0, 0};
+    uint64_t *entries = NULL;
+    FILE *file = NULL;
+    
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (filename == NULL) STOP(error, CSV_NULL_FILENAME, early_stop);
+    
+    entries = calloc((size_t) csv->cols * 6 + 1, sizeof(uint64_t));
+    if (entries == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    if (csv_buffer_reserve(&blobs, 16) == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    memcpy(blobs.bytes, CSV_COLUMNAR_MAGIC, 8);
+    
+    for (uint32_t j = 0; j < csv->cols; j++)
+    {
+        csv_type type = schema == NULL ? CSV_TYPE_AUTO : schema[j];
+        
+        if (type == CSV_TYPE_AUTO) type = csv_columnar_infer(csv, j);
+        if (type != CSV_TYPE_STRING && type != CSV_TYPE_LONG && type != CSV_TYPE_DOUBLE) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, fail);
+        
+        entries[6 * j + 4] = (uint64_t) type;
+        
+        status = csv_encode_column(csv, j, type, &blobs, &entries[6 * j]);
+        if (status != CSV_SUCCESS) STOP(error, status, fail);
+    }
+    
+    uint64_t names = 0;
+    
+    for (uint32_t j = 0; csv->header != NULL && j < csv->cols; j++)
+    {
+        entries[6 * j + 3] = names;
+        names += strlen(csv->header[j]) + 1;
+    }
+    
+    if (csv_buffer_put64(&footer, csv->rows) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    if (csv_buffer_put64(&footer, csv->cols) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    if (csv_buffer_put64(&footer, csv->header != NULL) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    if (csv_buffer_put64(&footer, names) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    for (uint64_t k = 0; k < 6 * (uint64_t) csv->cols; k++)
+    {
+        if (csv_buffer_put64(&footer, entries[k]) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    uint8_t *p = csv_buffer_reserve(&footer, (names + 7) / 8 * 8);
+    if (p == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    for (uint32_t j = 0; csv->header != NULL && j < csv->cols; j++)
+    {
+        memcpy(p + entries[6 * j + 3], csv->header[j], strlen(csv->header[j]) + 1);
+    }
+    
+    if (csv_buffer_put64(&footer, blobs.length) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    p = csv_buffer_reserve(&footer, 8);
+    if (p == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    memcpy(p, CSV_COLUMNAR_MAGIC, 8);
+    
+    file = fopen(filename, "wb");
+    if (file == NULL) STOP(error, CSV_INVALID_FILE, fail);
+    
+    bool written = fwrite(blobs.bytes, 1, (size_t) blobs.length, file) == blobs.length
+                && fwrite(footer.bytes, 1, (size_t) footer.length, file) == footer.length;
+    
+    if (fclose(file) != 0 || written == false)
+    {
+        remove(filename);
+        STOP(error, CSV_IO_FAIL, fail);
+    }
+    
+    free(blobs.bytes);
+    free(footer.bytes);
+    free(entries);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    fail:
+        free(blobs.bytes);
+        free(footer.bytes);
+        free(entries);
+        return false;
+    
+    early_stop:
+        return false;
+}
+
+/*******************************************************************************
+Reader. The directory is validated once at open, every blob is checked against
+the file size as it is decoded, and corrupt input fails with CSV_BAD_FORMAT
+rather than reading out of bounds.
+*/
+
+struct csv_column_entry
+{
+    uint64_t offset;
+    uint64_t length;
+    uint64_t nulls;
+    csv_type type;
+    enum csv_encoding encoding;
+};
+
+struct csv_columnar
+{
+    const uint8_t *bytes;
+    uint64_t size;
+    struct csv_column_entry *columns;
+    char **header;
+    uint32_t rows;
+    uint32_t cols;
+    bool mapped;
+    char pad[7];
+};
+
+void csv_columnar_close(struct csv_columnar *columnar)
+{
+    if (columnar == NULL) return;
+    
+    #ifdef CSV_POSIX
+    if (columnar->mapped == true) munmap((void *) (uintptr_t) columnar->bytes, (size_t) columnar->size);
+    else free((void *) (uintptr_t) columnar->bytes);
+    #else
+    free((void *) (uintptr_t) columnar->bytes);
+    #endif
+    
+    free(columnar->columns);
+    free(columnar->header);
+    free(columnar);
+}
+
+static csv_errno csv_columnar_load(struct csv_columnar *columnar, const char *filename)
+{
+    #ifdef CSV_POSIX
+    struct stat info;
+    int fd = open(filename, O_RDONLY);
+    
+    if (fd < 0) return CSV_INVALID_FILE;
+    
+    if (fstat(fd, &info) != 0 || info.st_size < 0 || (uint64_t) info.st_size > SIZE_MAX)
+    {
+        close(fd);
+        return CSV_IO_FAIL;
+    }
+    
+    columnar->size = (uint64_t) info.st_size;
+    
+    if (columnar->size > 0)
+    {
+        void *map = mmap(NULL, (size_t) columnar->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        
+        if (map != MAP_FAILED)
+        {
+            columnar->bytes = map;
+            columnar->mapped = true;
+        }
+    }
+    
+    close(fd);
+    
+    if (columnar->mapped == true) return CSV_SUCCESS;
+    #endif
+    
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return CSV_INVALID_FILE;
+    
+    uint8_t *bytes = NULL;
+    uint64_t size = 0;
+    uint64_t capacity = 0;
+    size_t n = 0;
+    
+    do
+    {
+        if (capacity - size < CSV_BLOCK_LENGTH)
+        {
+            capacity = 2 * capacity + CSV_BLOCK_LENGTH;
+            uint8_t *grown = capacity > SIZE_MAX ? NULL : realloc(bytes, (size_t) capacity);
+            
+            if (grown == NULL)
+            {
+                free(bytes);
+                fclose(file);
+                return CSV_MALLOC_FAILED;
+            }
+            
+            bytes = grown;
+        }
+        
+        n = fread(bytes + size, 1, CSV_BLOCK_LENGTH, file);
+        size += n;
+    }
+    while (n == CSV_BLOCK_LENGTH);
+    
+    if (ferror(file) != 0)
+    {
+        free(bytes);
+        fclose(file);
+        return CSV_IO_FAIL;
+    }
+    
+    fclose(file);
+    
+    columnar->bytes = bytes;
+    columnar->size = size;
+    
+    return CSV_SUCCESS;
+}
+
+struct csv_columnar *csv_columnar_open(const char * const filename, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    if (filename == NULL) STOP(error, CSV_NULL_FILENAME, early_stop);
+    
+    struct csv_columnar *columnar = calloc(1, sizeof(struct csv_columnar));
+    if (columnar == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    status = csv_columnar_load(columnar, filename);
+    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    
+    const uint8_t *bytes = columnar->bytes;
+    const uint64_t size = columnar->size;
+    
+    if (size < 32 || memcmp(bytes, CSV_COLUMNAR_MAGIC, 8) != 0) STOP(error, CSV_BAD_FORMAT, fail);
+    if (memcmp(bytes + size - 8, CSV_COLUMNAR_MAGIC, 8) != 0) STOP(error, CSV_BAD_FORMAT, fail);
+    
+    const uint64_t footer = csv_get64(bytes + size - 16);
+    if (footer < 16 || footer > size - 16 || size - 16 - footer < CSV_COLUMNAR_FIXED) STOP(error, CSV_BAD_FORMAT, fail);
+    
+    const uint8_t *p = bytes + footer;
+    const uint64_t available = size - 16 - footer - CSV_COLUMNAR_FIXED;
+    const uint64_t rows = csv_get64(p);
+    const uint64_t cols = csv_get64(p + 8);
+    const uint64_t header = csv_get64(p + 16);
+    const uint64_t names = csv_get64(p + 24);
+    
+    if (rows > UINT32_MAX || cols > UINT32_MAX) STOP(error, CSV_BAD_FORMAT, fail);
+    if (cols > available / CSV_COLUMNAR_ENTRY) STOP(error, CSV_BAD_FORMAT, fail);
+    if (names > available - cols * CSV_COLUMNAR_ENTRY) STOP(error, CSV_BAD_FORMAT, fail);
+    
+    columnar->rows = (uint32_t) rows;
+    columnar->cols = (uint32_t) cols;
+    columnar->columns = malloc(sizeof(struct csv_column_entry) * (cols + 1));
+    if (columnar->columns == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    const uint8_t *name_bytes = p + CSV_COLUMNAR_FIXED + cols * CSV_COLUMNAR_ENTRY;
+    
+    if (header != 0)
+    {
+        if (names == 0 || name_bytes[names - 1] != '\0') STOP(error, CSV_BAD_FORMAT, fail);
+        
+        columnar->header = malloc(sizeof(char *) * (cols + 1));
+        if (columnar->header == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    for (uint64_t j = 0; j < cols; j++)
+    {
+        const uint8_t *entry = p + CSV_COLUMNAR_FIXED + j * CSV_COLUMNAR_ENTRY;
+        struct csv_column_entry *column = &columnar->columns[j];
+        uint64_t name = csv_get64(entry + 24);
+        uint64_t type = csv_get64(entry + 32);
+        uint64_t encoding = csv_get64(entry + 40);
+        
+        column->offset = csv_get64(entry);
+        column->length = csv_get64(entry + 8);
+        column->nulls = csv_get64(entry + 16);
+        
+        if (column->offset > footer || column->length > footer - column->offset) STOP(error, CSV_BAD_FORMAT, fail);
+        if (column->nulls > footer || (rows + 7) / 8 > footer - column->nulls) STOP(error, CSV_BAD_FORMAT, fail);
+        if (type < CSV_TYPE_STRING || type > CSV_TYPE_DOUBLE || encoding > CSV_ENCODING_DICT) STOP(error, CSV_BAD_FORMAT, fail);
+        
+        column->type = (csv_type) type;
+        column->encoding = (enum csv_encoding) encoding;
+        
+        if (header != 0)
+        {
+            if (name >= names) STOP(error, CSV_BAD_FORMAT, fail);
+            columnar->header[j] = (char *) (uintptr_t) (name_bytes + name);
+        }
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return columnar;
+    
+    fail:
+        csv_columnar_close(columnar);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Decode a numeric column into n 64-bit patterns. Every count read from the blob
+is checked before it sizes anything.
+*/
+
+static csv_errno csv_decode_numbers(const struct csv_columnar *columnar, const struct csv_column_entry *column, uint64_t *out)
+{
+    const uint8_t *blob = columnar->bytes + column->offset;
+    const uint64_t length = column->length;
+    const uint64_t n = columnar->rows;
+    struct csv_packed values, lengths;
+    uint64_t pos = 0;
+    
+    switch (column->encoding)
+    {
+        case CSV_ENCODING_PLAIN:
+            if (length / 8 < n) return CSV_BAD_FORMAT;
+            for (uint64_t i = 0; i < n; i++) out[i] = csv_get64(blob + 8 * i);
+            return CSV_SUCCESS;
+        
+        case CSV_ENCODING_BITPACK:
+            if (csv_packed_view(blob, length, &pos, n, &values) == false) return CSV_BAD_FORMAT;
+            csv_unpack(&values, out);
+            return CSV_SUCCESS;
+        
+        case CSV_ENCODING_DELTA:
+            if (length < 8) return CSV_BAD_FORMAT;
+            pos = 8;
+            if (csv_packed_view(blob, length, &pos, n == 0 ? 0 : n - 1, &values) == false) return CSV_BAD_FORMAT;
+            if (n == 0) return CSV_SUCCESS;
+            
+            out[0] = csv_get64(blob);
+            for (uint64_t i = 1; i < n; i++) out[i] = out[i - 1] + csv_packed_get(&values, i - 1);
+            return CSV_SUCCESS;
+        
+        case CSV_ENCODING_RLE:
+        {
+            if (length < 8) return CSV_BAD_FORMAT;
+            uint64_t runs = csv_get64(blob);
+            uint64_t i = 0;
+            
+            pos = 8;
+            if (runs > n) return CSV_BAD_FORMAT;
+            if (csv_packed_view(blob, length, &pos, runs, &values) == false) return CSV_BAD_FORMAT;
+            if (csv_packed_view(blob, length, &pos, runs, &lengths) == false) return CSV_BAD_FORMAT;
+            
+            for (uint64_t r = 0; r < runs; r++)
+            {
+                uint64_t value = csv_packed_get(&values, r);
+                uint64_t count = csv_packed_get(&lengths, r);
+                
+                if (count > n - i) return CSV_BAD_FORMAT;
+                for (uint64_t k = 0; k < count; k++) out[i++] = value;
+            }
+            
+            return i == n ? CSV_SUCCESS : CSV_BAD_FORMAT;
+        }
+        
+        case CSV_ENCODING_DICT:
+        {
+            if (length < 8) return CSV_BAD_FORMAT;
+            uint64_t distinct = csv_get64(blob);
+            struct csv_packed codes;
+            
+            pos = 8;
+            if (distinct > n) return CSV_BAD_FORMAT;
+            if (csv_packed_view(blob, length, &pos, distinct, &values) == false) return CSV_BAD_FORMAT;
+            if (csv_packed_view(blob, length, &pos, n, &codes) == false) return CSV_BAD_FORMAT;
+            
+            for (uint64_t i = 0; i < n; i++)
+            {
+                uint64_t code = csv_packed_get(&codes, i);
+                if (code >= distinct) return CSV_BAD_FORMAT;
+                out[i] = csv_packed_get(&values, code);
+            }
+            
+            return CSV_SUCCESS;
+        }
+    }
+    
+    return CSV_BAD_FORMAT;
+}
+
+/*******************************************************************************
+Locate the packed offsets and the string blob that follows them.
+*/
+
+static bool csv_decode_blob(const uint8_t *blob, uint64_t length, uint64_t *pos, uint64_t n, struct csv_packed *offsets, const char **text, uint64_t *total)
+{
+    if (csv_packed_view(blob, length, pos, n, offsets) == false) return false;
+    if (length - *pos < 8) return false;
+    
+    *total = csv_get64(blob + *pos);
+    *pos += 8;
+    
+    if (*total > length - *pos) return false;
+    if (*total > 0 && blob[*pos + *total - 1] != '\0') return false;
+    if (*total == 0 && n > 0) return false;
+    
+    *text = (const char *) (blob + *pos);
+    
+    return true;
+}
+
+static csv_errno csv_decode_strings(const struct csv_columnar *columnar, const struct csv_column_entry *column, char **out)
+{
+    const uint8_t *blob = columnar->bytes + column->offset;
+    const uint64_t length = column->length;
+    const uint64_t n = columnar->rows;
+    struct csv_packed offsets, codes;
+    const char *text = NULL;
+    uint64_t total = 0;
+    uint64_t pos = 0;
+    uint64_t distinct = n;
+    
+    if (column->encoding == CSV_ENCODING_DICT)
+    {
+        if (length < 8) return CSV_BAD_FORMAT;
+        distinct = csv_get64(blob);
+        pos = 8;
+        
+        if (distinct > n) return CSV_BAD_FORMAT;
+        if (csv_packed_view(blob, length, &pos, n, &codes) == false) return CSV_BAD_FORMAT;
+    }
+    else if (column->encoding != CSV_ENCODING_PLAIN) return CSV_BAD_FORMAT;
+    
+    if (csv_decode_blob(blob, length, &pos, distinct, &offsets, &text, &total) == false) return CSV_BAD_FORMAT;
+    
+    for (uint64_t i = 0; i < n; i++)
+    {
+        uint64_t k = column->encoding == CSV_ENCODING_DICT ? csv_packed_get(&codes, i) : i;
+        if (k >= distinct) return CSV_BAD_FORMAT;
+        
+        uint64_t offset = csv_packed_get(&offsets, k);
+        if (offset >= total) return CSV_BAD_FORMAT;
+        
+        out[i] = (char *) (uintptr_t) (text + offset);
+    }
+    
+    return CSV_SUCCESS;
+}
+
+/*******************************************************************************
+Missing numbers are stored as the previous value to help the encoders, the
+bitmap turns them back into zeros.
+*/
+
+static void csv_columnar_zero(const struct csv_columnar *columnar, const struct csv_column_entry *column, uint64_t *values)
+{
+    if (column->nulls == 0) return;
+    
+    const uint8_t *bitmap = columnar->bytes + column->nulls;
+    
+    for (uint32_t i = 0; i < columnar->rows; i++)
+    {
+        if ((bitmap[i / 8] >> (i % 8) & 1) != 0) values[i] = 0;
+    }
+}
+
+static const struct csv_column_entry *csv_columnar_column(const struct csv_columnar *columnar, const uint32_t j, csv_errno *status)
+{
+    if (columnar == NULL)
+    {
+        *status = CSV_NULL_INPUT_POINTER;
+        return NULL;
+    }
+    
+    if (j >= columnar->cols)
+    {
+        *status = CSV_PARAM_OUT_OF_BOUNDS;
+        return NULL;
+    }
+    
+    return &columnar->columns[j];
+}
+
+long *csv_columnar_long(struct csv_columnar *columnar, const uint32_t j, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    const struct csv_column_entry *column = csv_columnar_column(columnar, j, &status);
+    if (column == NULL) STOP(error, status, early_stop);
+    if (column->type != CSV_TYPE_LONG) STOP(error, CSV_TYPE_MISMATCH, early_stop);
+    
+    uint64_t *values = malloc(sizeof(uint64_t) * ((uint64_t) columnar->rows + 1));
+    if (values == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    status = csv_decode_numbers(columnar, column, values);
+    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    
+    csv_columnar_zero(columnar, column, values);
+    
+    //narrow in place, long is never wider than 64 bits
+    long *data = (long *) values;
+    
+    for (uint32_t i = 0; i < columnar->rows; i++) data[i] = (long) (int64_t) values[i];
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        free(values);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+double *csv_columnar_double(struct csv_columnar *columnar, const uint32_t j, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    const struct csv_column_entry *column = csv_columnar_column(columnar, j, &status);
+    if (column == NULL) STOP(error, status, early_stop);
+    if (column->type == CSV_TYPE_STRING) STOP(error, CSV_TYPE_MISMATCH, early_stop);
+    
+    uint64_t *values = malloc(sizeof(uint64_t) * ((uint64_t) columnar->rows + 1));
+    if (values == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    status = csv_decode_numbers(columnar, column, values);
+    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    
+    csv_columnar_zero(columnar, column, values);
+    
+    double *data = (double *) values;
+    
+    for (uint32_t i = 0; i < columnar->rows; i++)
+    {
+        if (column->type == CSV_TYPE_LONG) data[i] = (double) (int64_t) values[i];
+        else memcpy(&data[i], &values[i], sizeof(double));
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        free(values);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+char **csv_columnar_str(struct csv_columnar *columnar, const uint32_t j, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    const struct csv_column_entry *column = csv_columnar_column(columnar, j, &status);
+    if (column == NULL) STOP(error, status, early_stop);
+    if (column->type != CSV_TYPE_STRING) STOP(error, CSV_TYPE_MISMATCH, early_stop);
+    
+    char **data = malloc(sizeof(char *) * ((uint64_t) columnar->rows + 1));
+    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    status = csv_decode_strings(columnar, column, data);
+    if (status != CSV_SUCCESS) STOP(error, status, fail);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return data;
+    
+    fail:
+        free(data);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+bool csv_columnar_missing(const struct csv_columnar *columnar, const uint32_t i, const uint32_t j)
+{
+    if (columnar == NULL || i >= columnar->rows || j >= columnar->cols) return false;
+    
+    const struct csv_column_entry *column = &columnar->columns[j];
+    
+    if (column->type != CSV_TYPE_STRING)
+    {
+        return column->nulls != 0 && (columnar->bytes[column->nulls + i / 8] >> (i % 8) & 1) != 0;
+    }
+    
+    //decoding one string needs its code and offset only
+    const uint8_t *blob = columnar->bytes + column->offset;
+    struct csv_packed offsets, codes;
+    const char *text = NULL;
+    uint64_t total = 0;
+    uint64_t pos = 0;
+    uint64_t k = i;
+    uint64_t distinct = columnar->rows;
+    
+    if (column->encoding == CSV_ENCODING_DICT)
+    {
+        if (column->length < 8) return false;
+        distinct = csv_get64(blob);
+        pos = 8;
+        
+        if (distinct > columnar->rows) return false;
+        if (csv_packed_view(blob, column->length, &pos, columnar->rows, &codes) == false) return false;
+        k = csv_packed_get(&codes, i);
+    }
+    
+    if (k >= distinct) return false;
+    if (csv_decode_blob(blob, column->length, &pos, distinct, &offsets, &text, &total) == false) return false;
+    
+    uint64_t offset = csv_packed_get(&offsets, k);
+    
+    return offset < total && text[offset] == '\0';
+}
+
+bool csv_columnar_dims(const struct csv_columnar *columnar, uint32_t *rows, uint32_t *cols)
+{
+    if (columnar == NULL) return false;
+    
+    if (rows != NULL) *rows = columnar->rows;
+    if (cols != NULL) *cols = columnar->cols;
+    
+    return true;
+}
+
+char **csv_columnar_header(const struct csv_columnar *columnar)
+{
+    return columnar == NULL ? NULL : columnar->header;
+}
+
+csv_type csv_columnar_type(const struct csv_columnar *columnar, const uint32_t j)
+{
+    if (columnar == NULL || j >= columnar->cols) return CSV_TYPE_AUTO;
+    
+    return columnar->columns[j].type;
+}
+
+/*******************************************************************************
+Packed integer columns. Each block of CSV_INTCOL_BLOCK values keeps its minimum
+and maximum and stores value minus minimum with the block's bit width, which
+is at most 32 bits, else the block is kept as raw 64-bit values.
+
+Offsets are laid out vertically over CSV_INTCOL_LANES lanes. Value i lives in
+lane i % lanes at row i / lanes, and each lane is its own LSB first stream of
+32-bit words, word k of every lane stored side by side. Unpacking one row is
+then the same shift and mask applied to lanes contiguous words, a loop the
+compiler turns into SSE, AVX or NEON code without intrinsics, and the rows
+come out in value order.
+
+    words : lane 0 word 0, lane 1 word 0 ... lane 31 word 0, lane 0 word 1 ...
+
+A packed block always holds a full CSV_INTCOL_BLOCK offsets, the tail of a
+short final block is padded with zero offsets, so the kernels never branch on
+the block length while decoding.
+*/
+
+#define CSV_INTCOL_LANES 32
+#define CSV_INTCOL_RAW 64
+
+struct csv_intblock
+{
+    int64_t min;
+    int64_t max;
+    uint64_t offset;
+    uint32_t width;
+    uint32_t count;
+};
+
+struct csv_intcol
+{
+    struct csv_intblock *blocks;
+    uint32_t *words;
+    uint64_t length;
+    uint64_t capacity;
+    uint32_t n;
+    uint32_t total_blocks;
+};
+
+/*******************************************************************************
+Words taken by a block of the given width, raw blocks keep two per value.
+*/
+
+static uint64_t csv_intblock_words(uint32_t width, uint32_t count)
+{
+    return width == CSV_INTCOL_RAW ? 2 * (uint64_t) count : (uint64_t) CSV_INTCOL_LANES * width;
+}
+
+static void csv_intblock_pack(const int64_t *values, struct csv_intblock *block, uint32_t *words)
+{
+    const uint32_t width = block->width;
+    
+    if (width == CSV_INTCOL_RAW)
+    {
+        memcpy(words, values, sizeof(int64_t) * block->count);
+        return;
+    }
+    
+    if (width == 0) return;
+    
+    memset(words, 0, sizeof(uint32_t) * CSV_INTCOL_LANES * width);
+    
+    for (uint32_t i = 0; i < block->count; i++)
+    {
+        const uint32_t u = (uint32_t) ((uint64_t) values[i] - (uint64_t) block->min);
+        const uint32_t lane = i % CSV_INTCOL_LANES;
+        const uint32_t bit = (i / CSV_INTCOL_LANES) * width;
+        uint32_t *word = words + (bit / 32) * CSV_INTCOL_LANES + lane;
+        
+        word[0] |= u << (bit % 32);
+        if (bit % 32 + width > 32) word[CSV_INTCOL_LANES] |= u >> (32 - bit % 32);
+    }
+}
+
+/*******************************************************************************
+Decode all offsets of a packed block. The shift and mask are uniform across a
+row, which is what lets the lane loops vectorize.
+*/
+
+static void csv_intblock_offsets(const uint32_t *restrict words, uint32_t width, uint32_t *restrict out)
+{
+    if (width == 0)
+    {
+        memset(out, 0, sizeof(uint32_t) * CSV_INTCOL_BLOCK);
+        return;
+    }
+    
+    const uint32_t mask = width == 32 ? UINT32_MAX : (1u << width) - 1;
+    
+    for (uint32_t r = 0; r < CSV_INTCOL_BLOCK / CSV_INTCOL_LANES; r++)
+    {
+        const uint32_t bit = r * width;
+        const uint32_t shift = bit % 32;
+        const uint32_t *lo = words + (bit / 32) * CSV_INTCOL_LANES;
+        const uint32_t *hi = lo + CSV_INTCOL_LANES;
+        uint32_t *o = out + r * CSV_INTCOL_LANES;
+        
+        if (shift + width > 32)
+        {
+            for (uint32_t l = 0; l < CSV_INTCOL_LANES; l++) o[l] = ((lo[l] >> shift) | (hi[l] << (32 - shift))) & mask;
+        }
+        else
+        {
+            for (uint32_t l = 0; l < CSV_INTCOL_LANES; l++) o[l] = (lo[l] >> shift) & mask;
+        }
+    }
+}
+
+/*******************************************************************************
+Append one block of count values to the column, growing the word array
+geometrically so a column built a block at a time never over allocates by
+more than half.
+*/
+
+static bool csv_intcol_append(struct csv_intcol *col, const int64_t *values, uint32_t count)
+{
+    struct csv_intblock *block = &col->blocks[col->total_blocks];
+    int64_t lo = values[0];
+    int64_t hi = values[0];
+    
+    for (uint32_t i = 1; i < count; i++)
+    {
+        if (values[i] < lo) lo = values[i];
+        if (values[i] > hi) hi = values[i];
+    }
+    
+    block->min = lo;
+    block->max = hi;
+    block->count = count;
+    block->width = csv_bit_width((uint64_t) hi - (uint64_t) lo);
+    if (block->width > 32) block->width = CSV_INTCOL_RAW;
+    
+    const uint64_t need = csv_intblock_words(block->width, count);
+    
+    if (col->capacity - col->length < need)
+    {
+        uint64_t capacity = 2 * col->capacity + need;
+        
+        if (capacity > SIZE_MAX / sizeof(uint32_t)) return false;
+        
+        uint32_t *words = realloc(col->words, sizeof(uint32_t) * (size_t) capacity);
+        if (words == NULL) return false;
+        
+        col->words = words;
+        col->capacity = capacity;
+    }
+    
+    block->offset = col->length;
+    csv_intblock_pack(values, block, col->words + col->length);
+    
+    //keep raw blocks 8 byte aligned
+    col->length += (need + 1) / 2 * 2;
+    col->total_blocks++;
+    
+    return true;
+}
+
+static struct csv_intcol *csv_intcol_alloc(uint32_t n)
+{
+    struct csv_intcol *col = calloc(1, sizeof(struct csv_intcol));
+    if (col == NULL) return NULL;
+    
+    col->n = n;
+    col->blocks = malloc(sizeof(struct csv_intblock) * ((uint64_t) n / CSV_INTCOL_BLOCK + 1));
+    
+    if (col->blocks == NULL)
+    {
+        free(col);
+        return NULL;
+    }
+    
+    return col;
+}
+
+/*******************************************************************************
+Release the slack left by geometric growth once the column is complete.
+*/
+
+static void csv_intcol_shrink(struct csv_intcol *col)
+{
+    if (col->length == 0 || col->length == col->capacity) return;
+    
+    uint32_t *words = realloc(col->words, sizeof(uint32_t) * (size_t) col->length);
+    
+    if (words != NULL)
+    {
+        col->words = words;
+        col->capacity = col->length;
+    }
+}
+
+void csv_intcol_free(struct csv_intcol *col)
+{
+    if (col == NULL) return;
+    
+    free(col->blocks);
+    free(col->words);
+    free(col);
+}
+
+struct csv_intcol *csv_intcol_new(const long *values, const uint32_t n, csv_errno *error)
+{
+    int64_t block[CSV_INTCOL_BLOCK];
+    
+    if (values == NULL && n > 0) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    struct csv_intcol *col = csv_intcol_alloc(n);
+    if (col == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    for (uint32_t first = 0; first < n; first += CSV_INTCOL_BLOCK)
+    {
+        uint32_t count = n - first < CSV_INTCOL_BLOCK ? n - first : CSV_INTCOL_BLOCK;
+        
+        for (uint32_t i = 0; i < count; i++) block[i] = values[first + i];
+        
+        if (csv_intcol_append(col, block, count) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    csv_intcol_shrink(col);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return col;
+    
+    fail:
+        csv_intcol_free(col);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+struct csv_intcol *csv_coll_packed(struct csv *csv, const uint32_t j, const int base, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    int64_t block[CSV_INTCOL_BLOCK];
+    
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    struct csv_intcol *col = csv_intcol_alloc(csv->rows);
+    if (col == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    CSV_PROBE2(convert_start, "coll_packed", j);
+    
+    for (uint32_t first = 0; first < csv->rows; first += CSV_INTCOL_BLOCK)
+    {
+        uint32_t count = csv->rows - first < CSV_INTCOL_BLOCK ? csv->rows - first : CSV_INTCOL_BLOCK;
+        
+        for (uint32_t i = 0; i < count; i++)
+        {
+            long value = 0;
+            
+            status = csv_convert_long(csv->data[first + i][j], base, &value);
+            if (status != CSV_SUCCESS) STOP(error, status, fail);
+            
+            block[i] = value;
+        }
+        
+        if (csv_intcol_append(col, block, count) == false) STOP(error, CSV_MALLOC_FAILED, fail);
+    }
+    
+    csv_intcol_shrink(col);
+    
+    CSV_PROBE2(convert_done, "coll_packed", j);
+    if (error != NULL) *error = CSV_SUCCESS;
+    return col;
+    
+    fail:
+        CSV_PROBE2(convert_done, "coll_packed", j);
+        csv_intcol_free(col);
+        return NULL;
+    
+    early_stop:
+        return NULL;
+}
+
+uint32_t csv_intcol_length(const struct csv_intcol *col)
+{
+    return col == NULL ? 0 : col->n;
+}
+
+size_t csv_intcol_bytes(const struct csv_intcol *col)
+{
+    if (col == NULL) return 0;
+    
+    return sizeof(struct csv_intcol)
+         + sizeof(struct csv_intblock) * ((size_t) col->n / CSV_INTCOL_BLOCK + 1)
+         + sizeof(uint32_t) * (size_t) col->capacity;
+}
+
+long csv_intcol_get(const struct csv_intcol *col, const uint32_t i)
+{
+    if (col == NULL || i >= col->n) return 0;
+    
+    const struct csv_intblock *block = &col->blocks[i / CSV_INTCOL_BLOCK];
+    const uint32_t *words = col->words + block->offset;
+    const uint32_t k = i % CSV_INTCOL_BLOCK;
+    
+    if (block->width == CSV_INTCOL_RAW)
+    {
+        int64_t value;
+        memcpy(&value, words + 2 * k, sizeof(int64_t));
+        return (long) value;
+    }
+    
+    if (block->width == 0) return (long) block->min;
+    
+    const uint32_t bit = (k / CSV_INTCOL_LANES) * block->width;
+    const uint32_t shift = bit % 32;
+    const uint32_t *word = words + (bit / 32) * CSV_INTCOL_LANES + k % CSV_INTCOL_LANES;
+    uint32_t u = word[0] >> shift;
+    
+    if (shift + block->width > 32) u |= word[CSV_INTCOL_LANES] << (32 - shift);
+    if (block->width < 32) u &= (1u << block->width) - 1;
+    
+    return (long) (int64_t) ((uint64_t) block->min + u);
+}
+
+bool csv_intcol_unpack(const struct csv_intcol *col, const uint32_t first, const uint32_t n, long *out, csv_errno *error)
+{
+    uint32_t offsets[CSV_INTCOL_BLOCK];
+    
+    if (col == NULL || (out == NULL && n > 0)) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (first > col->n || n > col->n - first) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    for (uint32_t i = first; i < first + n; )
+    {
+        const struct csv_intblock *block = &col->blocks[i / CSV_INTCOL_BLOCK];
+        const uint32_t *words = col->words + block->offset;
+        const uint32_t k = i % CSV_INTCOL_BLOCK;
+        const uint32_t take = block->count - k < first + n - i ? block->count - k : first + n - i;
+        long *o = out + (i - first);
+        
+        if (block->width == CSV_INTCOL_RAW)
+        {
+            for (uint32_t m = 0; m < take; m++)
+            {
+                int64_t value;
+                memcpy(&value, words + 2 * (k + m), sizeof(int64_t));
+                o[m] = (long) value;
+            }
+        }
+        else
+        {
+            csv_intblock_offsets(words, block->width, offsets);
+            for (uint32_t m = 0; m < take; m++) o[m] = (long) (int64_t) ((uint64_t) block->min + offsets[k + m]);
+        }
+        
+        i += take;
+    }
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    early_stop:
+        return false;
+}
+
+/*******************************************************************************
+Sum of the offsets of a packed block. Per lane accumulators keep the loop
+vectorizable, 1024 offsets of at most 32 bits cannot overflow 64 bits.
+*/
+
+static uint64_t csv_intblock_sum(const uint32_t *words, uint32_t width)
+{
+    uint32_t offsets[CSV_INTCOL_BLOCK];
+    uint64_t lanes[CSV_INTCOL_LANES] = {0};
+    uint64_t sum = 0;
+    
+    csv_intblock_offsets(words, width, offsets);
+    
+    for (uint32_t r = 0; r < CSV_INTCOL_BLOCK / CSV_INTCOL_LANES; r++)
+    {
+        for (uint32_t l = 0; l < CSV_INTCOL_LANES; l++) lanes[l] += offsets[r * CSV_INTCOL_LANES + l];
+    }
+    
+    for (uint32_t l = 0; l < CSV_INTCOL_LANES; l++) sum += lanes[l];
+    
+    return sum;
+}
+
+bool csv_intcol_summarize(const struct csv_intcol *col, const uint32_t *sel, const uint32_t n, struct csv_intcol_summary *summary, csv_errno *error)
+{
+    if (col == NULL || summary == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    summary->count = 0;
+    summary->min = 0;
+    summary->max = 0;
+    summary->sum = 0;
+    
+    if (sel != NULL)
+    {
+        for (uint32_t k = 0; k < n; k++)
+        {
+            if (sel[k] >= col->n) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+            
+            long value = csv_intcol_get(col, sel[k]);
+            
+            if (k == 0 || value < summary->min) summary->min = value;
+            if (k == 0 || value > summary->max) summary->max = value;
+            summary->sum += (double) value;
+        }
+        
+        summary->count = n;
+        if (error != NULL) *error = CSV_SUCCESS;
+        return true;
+    }
+    
+    for (uint32_t b = 0; b < col->total_blocks; b++)
+    {
+        const struct csv_intblock *block = &col->blocks[b];
+        const uint32_t *words = col->words + block->offset;
+        
+        if (b == 0 || block->min < summary->min) summary->min = (long) block->min;
+        if (b == 0 || block->max > summary->max) summary->max = (long) block->max;
+        
+        if (block->width == CSV_INTCOL_RAW)
+        {
+            for (uint32_t k = 0; k < block->count; k++)
+            {
+                int64_t value;
+                memcpy(&value, words + 2 * k, sizeof(int64_t));
+                summary->sum += (double) value;
+            }
+        }
+        else
+        {
+            //padding offsets are zero, so the whole block can be summed
+            uint64_t offsets = block->width == 0 ? 0 : csv_intblock_sum(words, block->width);
+            summary->sum += (double) block->min * block->count + (double) offsets;
+        }
+    }
+    
+    summary->count = col->n;
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    early_stop:
+        return false;
+}
+
+uint32_t *csv_intcol_filter(const struct csv_intcol *col, const long lo, const long hi, uint32_t *n, csv_errno *error)
+{
+    uint32_t offsets[CSV_INTCOL_BLOCK];
+    uint32_t count = 0;
+    
+    if (col == NULL || n == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    uint32_t *sel = malloc(sizeof(uint32_t) * ((uint64_t) col->n + 1));
+    if (sel == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    for (uint32_t b = 0; b < col->total_blocks; b++)
+    {
+        const struct csv_intblock *block = &col->blocks[b];
+        const uint32_t *words = col->words + block->offset;
+        const uint32_t first = b * CSV_INTCOL_BLOCK;
+        
+        if (block->max < lo || block->min > hi) continue;
+        
+        if (lo <= block->min && block->max <= hi)
+        {
+            for (uint32_t k = 0; k < block->count; k++) sel[count++] = first + k;
+            continue;
+        }
+        
+        if (block->width == CSV_INTCOL_RAW)
+        {
+            for (uint32_t k = 0; k < block->count; k++)
+            {
+                int64_t value;
+                memcpy(&value, words + 2 * k, sizeof(int64_t));
+                if (lo <= value && value <= hi) sel[count++] = first + k;
+            }
+            
+            continue;
+        }
+        
+        //the range overlaps the block, so both bounds fit the block's offsets
+        const uint32_t low = lo <= block->min ? 0 : (uint32_t) ((uint64_t) (int64_t) lo - (uint64_t) block->min);
+        const uint32_t high = hi >= block->max ? UINT32_MAX : (uint32_t) ((uint64_t) (int64_t) hi - (uint64_t) block->min);
+        
+        csv_intblock_offsets(words, block->width, offsets);
+        
+        for (uint32_t k = 0; k < block->count; k++)
+        {
+            sel[count] = first + k;
+            count += (uint32_t) (offsets[k] >= low && offsets[k] <= high);
+        }
+    }
+    
+    *n = count;
+    if (error != NULL) *error = CSV_SUCCESS;
+    return sel;
+    
+    early_stop:
+        return NULL;
+}
+
+/*******************************************************************************
+Compressed text columns. Cells are concatenated with their nul terminators
+into blocks of up to CSV_TEXTCOL_BLOCK bytes and each block is compressed
+with the LZ4 block format. A 16-bit start per cell locates it inside its
+block, which always fits because a cell only starts a block or begins before
+CSV_TEXTCOL_BLOCK bytes into one.
+
+The codec below is a plain greedy LZ4 with a single hash table, written here
+to keep the library free of dependencies. It produces standard LZ4 blocks,
+minimum match 4, 64KB window, the last 5 bytes always literals and no match
+starting in the last 12 bytes.
+*/
+
+#define CSV_LZ4_HASH_BITS 12
+#define CSV_LZ4_MIN_MATCH 4
+#define CSV_LZ4_LAST_LITERALS 5
+#define CSV_LZ4_MATCH_LIMIT 12
+
+static inline uint32_t csv_read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(uint32_t));
+    return value;
+}
+
+/*******************************************************************************
+Worst case output size, incompressible input grows by one byte in 255.
+*/
+
+static size_t csv_lz4_bound(size_t n)
+{
+    return n + n / 255 + 16;
+}
+
+static uint8_t *csv_lz4_length(uint8_t *op, size_t length)
+{
+    for ( ; length >= 255; length -= 255) *op++ = 255;
+    *op++ = (uint8_t) length;
+    
+    return op;
+}
+
+static uint8_t *csv_lz4_sequence(uint8_t *op, const uint8_t *literals, size_t n, size_t offset, size_t match)
+{
+    uint8_t *token = op++;
+    *token = (uint8_t) ((n < 15 ? n : 15) << 4);
+    
+    if (n >= 15) op = csv_lz4_length(op, n - 15);
+    memcpy(op, literals, n);
+    op += n;
+    
+    //the final sequence carries literals only
+    if (match == 0) return op;
+    
+    *op++ = (uint8_t) offset;
+    *op++ = (uint8_t) (offset >> 8);
+    
+    match -= CSV_LZ4_MIN_MATCH;
+    *token |= (uint8_t) (match < 15 ? match : 15);
+    if (match >= 15) op = csv_lz4_length(op, match - 15);
+    
+    return op;
+}
+
+/*******************************************************************************
+Compress n bytes into dst, which holds csv_lz4_bound(n) bytes. Returns the
+compressed length.
+*/
+
+static size_t csv_lz4_compress(const uint8_t *src, size_t n, uint8_t *dst)
+{
+    uint32_t table[1 << CSV_LZ4_HASH_BITS];
+    uint8_t *op = dst;
+    size_t anchor = 0;
+    size_t i = 0;
+    
+    memset(table, 0xff, sizeof(table));
+    
+    while (n > CSV_LZ4_MATCH_LIMIT && i < n - CSV_LZ4_MATCH_LIMIT)
+    {
+        const uint32_t sequence = csv_read32(src + i);
+        const uint32_t h = (sequence * 2654435761u) >> (32 - CSV_LZ4_HASH_BITS);
+        const uint32_t candidate = table[h];
+        
+        table[h] = (uint32_t) i;
+        
+        if (candidate == UINT32_MAX || i - candidate > 65535 || csv_read32(src + candidate) != sequence)
+        {
+            i++;
+            continue;
+        }
+        
+        size_t match = CSV_LZ4_MIN_MATCH;
+        
+        while (i + match < n - CSV_LZ4_LAST_LITERALS && src[candidate + match] == src[i + match]) match++;
+        
+        op = csv_lz4_sequence(op, src + anchor, i - anchor, i - candidate, match);
+        i += match;
+        anchor = i;
+    }
+    
+    op = csv_lz4_sequence(op, src + anchor, n - anchor, 0, 0);
+    
+    return (size_t) (op - dst);
+}
+
+static bool csv_lz4_extend(const uint8_t *src, size_t n, size_t *ip, size_t *length)
+{
+    uint8_t b = 255;
+    
+    while (b == 255)
+    {
+        if (*ip >= n) return false;
+        
+        b = src[(*ip)++];
+        *length += b;
+    }
+    
+    return true;
+}
+
+/*******************************************************************************
+Decompress exactly raw bytes into dst. Every length and offset is checked, a
+malformed block returns false instead of touching memory outside dst.
+*/
+
+static bool csv_lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t raw)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    
+    while (ip < n)
+    {
+        const uint8_t token = src[ip++];
+        size_t literals = token >> 4;
+        
+        if (literals == 15 && csv_lz4_extend(src, n, &ip, &literals) == false) return false;
+        if (literals > n - ip || literals > raw - op) return false;
+        
+        memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+        
+        if (ip == n) break;
+        if (n - ip < 2) return false;
+        
+        const size_t offset = (size_t) src[ip] | (size_t) src[ip + 1] << 8;
+        size_t match = token & 15;
+        
+        ip += 2;
+        
+        if (offset == 0 || offset > op) return false;
+        if (match == 15 && csv_lz4_extend(src, n, &ip, &match) == false) return false;
+        
+        match += CSV_LZ4_MIN_MATCH;
+        if (match > raw - op) return false;
+        
+        //overlapping matches repeat the last offset bytes
+        if (offset >= match) memcpy(dst + op, dst + op - offset, match);
+        else for (size_t k = 0; k < match; k++) dst[op + k] = dst[op + k - offset];
+        
+        op += match;
+    }
+    
+    return op == raw;
+}
+
+/*******************************************************************************
+Column layout. Blocks are stored back to back in one buffer, a block whose
+length equals its raw size was not worth compressing and is kept as is.
+*/
+
+struct csv_textblock
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t raw;
+    uint32_t first;
+    uint32_t pad;
+};
+
+struct csv_textcol
+{
+    struct csv_textblock *blocks;
+    uint8_t *bytes;
+    uint16_t *starts;
+    uint64_t id;
+    uint64_t length;
+    uint64_t capacity;
+    uint32_t n;
+    uint32_t total_blocks;
+    uint32_t block_capacity;
+    uint32_t pad;
+};
+
+/*******************************************************************************
+Per thread cache of decompressed blocks, least recently used is replaced.
+Columns are told apart by a process wide id rather than their address, so a
+freed column's blocks can never be served for a new one.
+*/
+
+struct csv_textslot
+{
+    uint64_t id;
+    uint64_t used;
+    char *bytes;
+    uint32_t block;
+    uint32_t capacity;
+};
+
+struct csv_textcache
+{
+    struct csv_textslot slots[CSV_TEXTCOL_CACHE];
+    uint64_t clock;
+};
+
+static uint64_t csv_textcol_ids = 0;
+
+#ifdef CSV_PTHREADS
+
+static pthread_key_t csv_textcache_key;
+static pthread_once_t csv_textcache_once = PTHREAD_ONCE_INIT;
+
+static void csv_textcache_free(void *arg)
+{
+    struct csv_textcache *cache = arg;
+    
+    for (uint32_t s = 0; s < CSV_TEXTCOL_CACHE; s++) free(cache->slots[s].bytes);
+    free(cache);
+}
+
+static void csv_textcache_key_init(void)
+{
+    pthread_key_create(&csv_textcache_key, csv_textcache_free);
+}
+
+static struct csv_textcache *csv_textcache_get(void)
+{
+    pthread_once(&csv_textcache_once, csv_textcache_key_init);
+    
+    struct csv_textcache *cache = pthread_getspecific(csv_textcache_key);
+    
+    if (cache == NULL)
+    {
+        cache = calloc(1, sizeof(struct csv_textcache));
+        if (cache == NULL) return NULL;
+        
+        if (pthread_setspecific(csv_textcache_key, cache) != 0)
+        {
+            free(cache);
+            return NULL;
+        }
+    }
+    
+    return cache;
+}
+
+static uint64_t csv_textcol_next_id(void)
+{
+    return __atomic_add_fetch(&csv_textcol_ids, 1, __ATOMIC_RELAXED);
+}
+
+#else
+
+static struct csv_textcache csv_textcache_single;
+
+static struct csv_textcache *csv_textcache_get(void)
+{
+    return &csv_textcache_single;
+}
+
+static uint64_t csv_textcol_next_id(void)
+{
+    return ++csv_textcol_ids;
+}
+
+#endif
+
+/*******************************************************************************
+Compress the raw bytes of one block and append it to the column.
+*/
+
+static bool csv_textcol_flush(struct csv_textcol *col, const uint8_t *raw, uint32_t size, uint32_t first, uint8_t *scratch)
+{
+    if (col->total_blocks == col->block_capacity)
+    {
+        uint32_t capacity = 2 * col->block_capacity + 4;
+        struct csv_textblock *blocks = realloc(col->blocks, sizeof(struct csv_textblock) * capacity);
+        if (blocks == NULL) return false;
+        
+        col->blocks = blocks;
+        col->block_capacity = capacity;
     }
     
-    if (error != NULL) *error = CSV_SUCCESS;
-    return data;
+    size_t length = csv_lz4_compress(raw, size, scratch);
+    const uint8_t *source = scratch;
     
-    fail:
-        free(data);
-        return NULL;
+    if (length >= size)
+    {
+        length = size;
+        source = raw;
+    }
     
-    early_stop:
-        return NULL;
+    if (col->capacity - col->length < length)
+    {
+        uint64_t capacity = 2 * col->capacity + length;
+        uint8_t *bytes = capacity > SIZE_MAX ? NULL : realloc(col->bytes, (size_t) capacity);
+        if (bytes == NULL) return false;
+        
+        col->bytes = bytes;
+        col->capacity = capacity;
+    }
+    
+    struct csv_textblock *block = &col->blocks[col->total_blocks++];
+    
+    block->offset = col->length;
+    block->length = (uint32_t) length;
+    block->raw = size;
+    block->first = first;
+    
+    memcpy(col->bytes + col->length, source, length);
+    col->length += length;
+    
+    return true;
 }
 
 /*******************************************************************************
-Missing values lead to error rather than copying the nul-char as the target.
+Build a column from n cells. The block being filled grows past
+CSV_TEXTCOL_BLOCK only to hold a single longer cell.
 */
 
-char *csv_rowc(struct csv *csv, const uint32_t i, csv_errno *error)
+static struct csv_textcol *csv_textcol_build(const char * const *strings, char ***data, uint32_t j, uint32_t n, csv_errno *status)
 {
-    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
-    if (i >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    uint8_t *raw = NULL;
+    uint8_t *scratch = NULL;
+    uint32_t capacity = CSV_TEXTCOL_BLOCK;
+    uint32_t size = 0;
+    uint32_t first = 0;
     
-    char *data = malloc(sizeof(char) * csv->cols);
-    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    struct csv_textcol *col = calloc(1, sizeof(struct csv_textcol));
+    if (col == NULL) goto fail;
     
-    for (uint32_t j = 0; j < csv->cols; j++)
+    col->n = n;
+    col->id = csv_textcol_next_id();
+    col->starts = malloc(sizeof(uint16_t) * ((uint64_t) n + 1));
+    raw = malloc(capacity);
+    scratch = malloc(csv_lz4_bound(capacity));
+    
+    if (col->starts == NULL || raw == NULL || scratch == NULL) goto fail;
+    
+    for (uint32_t i = 0; i < n; i++)
     {
-        char tmp = csv->data[i][j][0];
+        const char *cell = strings != NULL ? strings[i] : data[i][j];
+        const size_t length = strlen(cell) + 1;
         
-        if (tmp == '\0')
+        if (length > UINT32_MAX - CSV_TEXTCOL_BLOCK)
         {
-            STOP(error, CSV_MISSING_DATA, fail);
+            *status = CSV_LIMIT_EXCEEDED;
+            goto error;
         }
-        else
+        
+        if (size > 0 && size + length > CSV_TEXTCOL_BLOCK)
         {
-            data[j] = tmp;
+            if (csv_textcol_flush(col, raw, size, first, scratch) == false) goto fail;
+            
+            size = 0;
+            first = i;
+        }
+        
+        if (size + length > capacity)
+        {
+            uint8_t *grown_raw = realloc(raw, size + length);
+            uint8_t *grown_scratch = grown_raw == NULL ? NULL : realloc(scratch, csv_lz4_bound(size + length));
+            
+            if (grown_raw != NULL) raw = grown_raw;
+            if (grown_scratch == NULL) goto fail;
+            
+            scratch = grown_scratch;
+            capacity = (uint32_t) (size + length);
         }
+        
+        col->starts[i] = (uint16_t) size;
+        memcpy(raw + size, cell, length);
+        size += (uint32_t) length;
     }
     
-    if (error != NULL) *error = CSV_SUCCESS;
-    return data;
+    if (size > 0 && csv_textcol_flush(col, raw, size, first, scratch) == false) goto fail;
+    
+    free(raw);
+    free(scratch);
+    
+    *status = CSV_SUCCESS;
+    return col;
     
     fail:
-        free(data);
+        *status = CSV_MALLOC_FAILED;
+    
+    error:
+        free(raw);
+        free(scratch);
+        csv_textcol_free(col);
+        return NULL;
+}
+
+void csv_textcol_free(struct csv_textcol *col)
+{
+    if (col == NULL) return;
+    
+    free(col->blocks);
+    free(col->bytes);
+    free(col->starts);
+    free(col);
+}
+
+struct csv_textcol *csv_textcol_new(const char * const *strings, const uint32_t n, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    if (strings == NULL && n > 0) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (strings[i] == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    }
+    
+    struct csv_textcol *col = csv_textcol_build(strings, NULL, 0, n, &status);
+    if (col == NULL) STOP(error, status, early_stop);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return col;
+    
+    early_stop:
         return NULL;
+}
+
+struct csv_textcol *csv_col_compressed(struct csv *csv, const uint32_t j, csv_errno *error)
+{
+    csv_errno status = CSV_UNDEFINED;
+    
+    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    struct csv_textcol *col = csv_textcol_build(NULL, csv->data, j, csv->rows, &status);
+    if (col == NULL) STOP(error, status, early_stop);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return col;
     
     early_stop:
         return NULL;
 }
 
+uint32_t csv_textcol_length(const struct csv_textcol *col)
+{
+    return col == NULL ? 0 : col->n;
+}
+
+size_t csv_textcol_bytes(const struct csv_textcol *col)
+{
+    if (col == NULL) return 0;
+    
+    return sizeof(struct csv_textcol)
+         + sizeof(struct csv_textblock) * col->block_capacity
+         + sizeof(uint16_t) * ((size_t) col->n + 1)
+         + (size_t) col->capacity;
+}
+
 /*******************************************************************************
-Missing values lead to error rather than copying the nul-char as the target.
+Index of the block holding cell i, blocks are ordered by their first cell.
 */
 
-char *csv_colc(struct csv *csv, const uint32_t j, csv_errno *error)
+static uint32_t csv_textcol_block(const struct csv_textcol *col, uint32_t i)
 {
-    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
-    if (j >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    uint32_t lo = 0;
+    uint32_t hi = col->total_blocks - 1;
     
-    char *data = malloc(sizeof(char) * csv->rows);
-    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        
+        if (col->blocks[mid].first <= i) lo = mid;
+        else hi = mid - 1;
+    }
     
-    for (uint32_t i = 0; i < csv->rows; i++)
+    return lo;
+}
+
+const char *csv_textcol_get(const struct csv_textcol *col, const uint32_t i, csv_errno *error)
+{
+    if (col == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    if (i >= col->n) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    
+    struct csv_textcache *cache = csv_textcache_get();
+    if (cache == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    const uint32_t b = csv_textcol_block(col, i);
+    const struct csv_textblock *block = &col->blocks[b];
+    struct csv_textslot *slot = &cache->slots[0];
+    bool hit = false;
+    
+    for (uint32_t s = 0; s < CSV_TEXTCOL_CACHE && hit == false; s++)
     {
-        char tmp = csv->data[i][j][0];
+        struct csv_textslot *candidate = &cache->slots[s];
         
-        if (tmp == '\0')
+        hit = candidate->id == col->id && candidate->block == b;
+        if (hit == true || candidate->used < slot->used) slot = candidate;
+    }
+    
+    if (hit == false)
+    {
+        if (slot->capacity < block->raw)
         {
-            STOP(error, CSV_MISSING_DATA, fail);
+            char *bytes = realloc(slot->bytes, block->raw);
+            if (bytes == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+            
+            slot->bytes = bytes;
+            slot->capacity = block->raw;
         }
-        else
+        
+        //forget the slot first so a failed decompression never looks cached
+        slot->id = 0;
+        
+        if (block->length == block->raw) memcpy(slot->bytes, col->bytes + block->offset, block->raw);
+        else if (csv_lz4_decompress(col->bytes + block->offset, block->length, (uint8_t *) slot->bytes, block->raw) == false)
         {
-            data[i] = tmp;
+            STOP(error, CSV_BAD_FORMAT, early_stop);
         }
+        
+        slot->id = col->id;
+        slot->block = b;
     }
     
-    if (error != NULL) *error = CSV_SUCCESS;
-    return data;
+    slot->used = ++cache->clock;
     
-    fail:
-        free(data);
-        return NULL;
+    if (error != NULL) *error = CSV_SUCCESS;
+    return slot->bytes + col->starts[i];
     
     early_stop:
         return NULL;
 }
 
-/******************************************************************************/
+/*******************************************************************************
+Prefix inlined string cells. Every cell carries its length and first 4 bytes,
+so unequal lengths or prefixes are settled from the 16 byte cell alone, and
+strings up to CSV_STR_INLINE bytes never leave it. Longer strings keep the
+prefix and a pointer to the full string, written with memcpy so the struct
+stays 4 byte aligned and 16 bytes on every target.
 
-double *csv_rowd(struct csv *csv, const uint32_t i, csv_errno *error)
+Strings hold no nul bytes, so the zero padding of short prefixes orders a
+shorter string before a longer one that extends it, matching strcmp.
+*/
+
+static inline void csv_str_set(struct csv_str *s, const char *string, size_t length)
+{
+    memset(s->inlined, 0, CSV_STR_INLINE);
+    s->length = (uint32_t) length;
+    
+    if (length <= CSV_STR_INLINE) memcpy(s->inlined, string, length);
+    else
+    {
+        memcpy(s->inlined, string, 4);
+        memcpy(s->inlined + 4, &string, sizeof(const char *));
+    }
+}
+
+const char *csv_str_data(const struct csv_str *s)
+{
+    const char *pointer;
+    
+    if (s->length <= CSV_STR_INLINE) return s->inlined;
+    
+    memcpy(&pointer, s->inlined + 4, sizeof(const char *));
+    return pointer;
+}
+
+bool csv_str_from(const char *string, struct csv_str *out, csv_errno *error)
+{
+    if (string == NULL || out == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    size_t length = strlen(string);
+    if (length > UINT32_MAX) STOP(error, CSV_LIMIT_EXCEEDED, early_stop);
+    
+    csv_str_set(out, string, length);
+    
+    if (error != NULL) *error = CSV_SUCCESS;
+    return true;
+    
+    early_stop:
+        return false;
+}
+
+struct csv_str *csv_cols(struct csv *csv, const uint32_t j, csv_errno *error)
 {
     if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
-    if (i >= csv->rows) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
     
-    double *data = malloc(sizeof(double) * csv->cols);
+    struct csv_str *data = malloc(sizeof(struct csv_str) * ((uint64_t) csv->rows + 1));
     if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
-
-    for (uint32_t j = 0; j < csv->cols; j++)
+    
+    CSV_PROBE2(convert_start, "cols", j);
+    
+    for (uint32_t i = 0; i < csv->rows; i++)
     {
-        errno = 0;
-        double tmp = 0;
-        char *end = NULL;
+        const char *cell = csv->data[i][j];
+        size_t length = strlen(cell);
         
-        if (csv->data[i][j][0] == '\0') STOP(error, CSV_MISSING_DATA, fail);
-        else tmp = strtod(csv->data[i][j], &end);
-        
-        //parse error handling
-        if (end == csv->data[i][j]) 
-            STOP(error, CSV_READ_FAIL, fail);
-        if (errno == 0 && *end != '\0')
-            STOP(error, CSV_READ_PARTIAL, fail);
-        if (errno != 0)
-            STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
+        if (length > UINT32_MAX) STOP(error, CSV_LIMIT_EXCEEDED, fail);
         
-        //success
-        assert(*end == '\0' && "missing condition");
-        data[j] = tmp;
+        csv_str_set(&data[i], cell, length);
     }
     
+    CSV_PROBE2(convert_done, "cols", j);
     if (error != NULL) *error = CSV_SUCCESS;
     return data;
     
     fail:
+        CSV_PROBE2(convert_done, "cols", j);
         free(data);
         return NULL;
     
@@ -598,44 +7842,162 @@ double *csv_rowd(struct csv *csv, const uint32_t i, csv_errno *error)
         return NULL;
 }
 
-/******************************************************************************/
+bool csv_str_eq(const struct csv_str *a, const struct csv_str *b)
+{
+    uint64_t x[2];
+    uint64_t y[2];
+    
+    //length and prefix in one word, the inlined rest or pointer in the other
+    memcpy(x, a, sizeof(struct csv_str));
+    memcpy(y, b, sizeof(struct csv_str));
+    
+    if (x[0] != y[0]) return false;
+    if (x[1] == y[1]) return true;
+    if (a->length <= CSV_STR_INLINE) return false;
+    
+    return memcmp(csv_str_data(a) + 4, csv_str_data(b) + 4, a->length - 4) == 0;
+}
 
-double *csv_cold(struct csv *csv, const uint32_t j, csv_errno *error)
+static inline uint32_t csv_str_prefix(const struct csv_str *s)
 {
-    if (csv == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
-    if (j >= csv->cols) STOP(error, CSV_PARAM_OUT_OF_BOUNDS, early_stop);
+    const unsigned char *p = (const unsigned char *) s->inlined;
     
-    double *data = malloc(sizeof(double) * csv->rows);
-    if (data == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
 
-    for (uint32_t i = 0; i < csv->rows; i++)
+int csv_str_cmp(const struct csv_str *a, const struct csv_str *b)
+{
+    //big endian prefixes compare as integers in byte order
+    const uint32_t x = csv_str_prefix(a);
+    const uint32_t y = csv_str_prefix(b);
+    
+    if (x != y) return x < y ? -1 : 1;
+    
+    int cmp = 0;
+    
+    const uint32_t n = a->length < b->length ? a->length : b->length;
+    
+    //the prefixes match, look further only if both strings go past them
+    if (n > 4)
     {
-        errno = 0;
-        double tmp = 0;
-        char *end = NULL;
-        
-        if (csv->data[i][j][0] == '\0') STOP(error, CSV_MISSING_DATA, fail);
-        else tmp = strtod(csv->data[i][j], &end);
+        cmp = memcmp(csv_str_data(a) + 4, csv_str_data(b) + 4, n - 4);
+        if (cmp != 0) return cmp;
+    }
+    
+    return (a->length > b->length) - (a->length < b->length);
+}
+
+/*******************************************************************************
+Ordering sorts cells paired with their index, so each comparison reads the
+cells it moves rather than chasing indices into the column. A bottom up merge
+sort over insertion sorted runs keeps equal strings in their original order.
+*/
+
+#define CSV_STR_RUN 16
+
+struct csv_str_entry
+{
+    struct csv_str cell;
+    uint32_t index;
+};
+
+static void csv_str_sort(struct csv_str_entry *entries, struct csv_str_entry *scratch, uint32_t n)
+{
+    for (uint32_t lo = 0; lo < n; lo += CSV_STR_RUN)
+    {
+        uint32_t hi = n - lo < CSV_STR_RUN ? n : lo + CSV_STR_RUN;
         
-        //parse error handling
-        if (end == csv->data[i][j]) 
-            STOP(error, CSV_READ_FAIL, fail);
-        if (errno == 0 && *end != '\0')
-            STOP(error, CSV_READ_PARTIAL, fail);
-        if (errno != 0)
-            STOP(error, CSV_UNKNOWN_FATAL_ERROR, fail);
+        for (uint32_t i = lo + 1; i < hi; i++)
+        {
+            struct csv_str_entry entry = entries[i];
+            uint32_t k = i;
+            
+            for ( ; k > lo && csv_str_cmp(&entries[k - 1].cell, &entry.cell) > 0; k--) entries[k] = entries[k - 1];
+            entries[k] = entry;
+        }
+    }
+    
+    struct csv_str_entry *src = entries;
+    struct csv_str_entry *dst = scratch;
+    
+    for (uint64_t width = CSV_STR_RUN; width < n; width *= 2)
+    {
+        for (uint64_t lo = 0; lo < n; lo += 2 * width)
+        {
+            uint64_t mid = lo + width < n ? lo + width : n;
+            uint64_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            uint64_t x = lo;
+            uint64_t y = mid;
+            
+            for (uint64_t k = lo; k < hi; k++)
+            {
+                bool left = y == hi || (x < mid && csv_str_cmp(&src[x].cell, &src[y].cell) <= 0);
+                dst[k] = left ? src[x++] : src[y++];
+            }
+        }
         
-        //success
-        assert(*end == '\0' && "missing condition");
-        data[i] = tmp;
+        struct csv_str_entry *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    
+    if (src != entries) memcpy(entries, src, sizeof(struct csv_str_entry) * n);
+}
+
+uint32_t *csv_str_order(const struct csv_str *cells, const uint32_t n, csv_errno *error)
+{
+    if (cells == NULL && n > 0) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    struct csv_str_entry *entries = malloc(sizeof(struct csv_str_entry) * ((uint64_t) n + 1));
+    struct csv_str_entry *scratch = malloc(sizeof(struct csv_str_entry) * ((uint64_t) n + 1));
+    uint32_t *order = malloc(sizeof(uint32_t) * ((uint64_t) n + 1));
+    
+    if (entries == NULL || scratch == NULL || order == NULL) STOP(error, CSV_MALLOC_FAILED, fail);
+    
+    for (uint32_t i = 0; i < n; i++)
+    {
+        entries[i].cell = cells[i];
+        entries[i].index = i;
     }
     
+    csv_str_sort(entries, scratch, n);
+    
+    for (uint32_t i = 0; i < n; i++) order[i] = entries[i].index;
+    
+    free(entries);
+    free(scratch);
+    
     if (error != NULL) *error = CSV_SUCCESS;
-    return data;
+    return order;
     
     fail:
-        free(data);
+        free(entries);
+        free(scratch);
+        free(order);
+        return NULL;
+    
+    early_stop:
         return NULL;
+}
+
+uint32_t *csv_str_select(const struct csv_str *cells, const uint32_t n, const struct csv_str *value, uint32_t *count, csv_errno *error)
+{
+    uint32_t total = 0;
+    
+    if ((cells == NULL && n > 0) || value == NULL || count == NULL) STOP(error, CSV_NULL_INPUT_POINTER, early_stop);
+    
+    uint32_t *sel = malloc(sizeof(uint32_t) * ((uint64_t) n + 1));
+    if (sel == NULL) STOP(error, CSV_MALLOC_FAILED, early_stop);
+    
+    for (uint32_t i = 0; i < n; i++)
+    {
+        sel[total] = i;
+        total += csv_str_eq(&cells[i], value);
+    }
+    
+    *count = total;
+    if (error != NULL) *error = CSV_SUCCESS;
+    return sel;
     
     early_stop:
         return NULL;
@@ -658,7 +8020,7 @@ const char *csv_errno_decode(const csv_errno error)
         case CSV_NUM_ROWS_OVERFLOW:
             return "the number of rows in the file exceeds UINT32_MAX.\n";
         case CSV_FIELD_LEN_OVERFLOW:
-            return "attempted to parse a field that exceeds UINT32_MAX chars.\n";
+            return "attempted to parse a field that exceeds max_field or UINT32_MAX chars.\n";
         case CSV_BUFFER_OVERFLOW:
             return "the temporary buffer is not large enough to hold some field.\n";
         case CSV_MALLOC_FAILED:
@@ -683,6 +8045,24 @@ const char *csv_errno_decode(const csv_errno error)
             return "conversion to integer type failed, check base argument.\n";
         case CSV_MISSING_DATA:
             return "attempted to convert data at field, but none exists.\n";
+        case CSV_INVALID_EXPRESSION:
+            return "the provided expression could not be parsed.\n";
+        case CSV_UNKNOWN_COLUMN:
+            return "the provided column name or index does not exist.\n";
+        case CSV_UNBALANCED_QUOTE:
+            return "a quoted field is never closed before the end of file.\n";
+        case CSV_FIELD_COUNT_MISMATCH:
+            return "a record does not have the same number of fields as the first.\n";
+        case CSV_LIMIT_EXCEEDED:
+            return "the file exceeds a limit set in struct csv_options.\n";
+        case CSV_CANCELLED:
+            return "the progress callback cancelled the read.\n";
+        case CSV_TYPE_MISMATCH:
+            return "a cell or column does not have the requested type.\n";
+        case CSV_BAD_FORMAT:
+            return "the file is damaged or not a columnar file.\n";
+        case CSV_IO_FAIL:
+            return "reading or writing the file has failed.\n";
         case CSV_UNDEFINED:
             return "error code has not been set.\ns";
     }
@@ -9,14 +9,54 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /*******************************************************************************
 * NAME: CSV_TEMPORARY_BUFFER_LENGTH
 * DESC: implementation uses default 1 KiB heap buffer to process each field
-* NOTE: overflow during csv processing wil result in CSV_BUFFER_OVERFLOW error
+* NOTE: retained for compatibility, fields are now tokenized into arena slabs
+*       and are no longer limited by this length
 *******************************************************************************/
 #define CSV_TEMPORARY_BUFFER_LENGTH 1024
 
+/*******************************************************************************
+* NAME: CSV_BLOCK_LENGTH
+* DESC: bytes read from the file at a time, quotes are detected once per block
+*******************************************************************************/
+#define CSV_BLOCK_LENGTH 65536
+
+/*******************************************************************************
+* NAME: CSV_ARENA_SLAB_LENGTH
+* DESC: default byte size of each arena slab holding header and cell strings
+* NOTE: fields longer than a slab are moved into a dedicated larger slab
+*******************************************************************************/
+#define CSV_ARENA_SLAB_LENGTH 65536
+
+/*******************************************************************************
+* NAME: CSV_ROW_GROUP_CELLS
+* DESC: cell pointers per row group block, rows X cols is split into blocks of
+*       at least one whole row so that wide files avoid one allocation per row
+*******************************************************************************/
+#define CSV_ROW_GROUP_CELLS 1048576
+
+/*******************************************************************************
+* NAME: CSV_ZONE_BLOCK_ROWS
+* DESC: default number of rows summarized by each zone map block
+*******************************************************************************/
+#define CSV_ZONE_BLOCK_ROWS 65536
+
+/*******************************************************************************
+* NAME: CSV_ZONE_BLOOM_WORDS
+* DESC: 64-bit words per zone bloom filter, 512 bits suits low cardinality text
+*******************************************************************************/
+#define CSV_ZONE_BLOOM_WORDS 8
+
+/*******************************************************************************
+* NAME: CSV_FILTER_BATCH
+* DESC: cells converted and compared per batch by the csv_filter kernels
+*******************************************************************************/
+#define CSV_FILTER_BATCH 1024
+
 /*******************************************************************************
 * NAME: csv_error_t
 * DESC: API error codes
@@ -43,11 +83,157 @@ typedef enum
     CSV_READ_PARTIAL            = 15,
     CSV_INVALID_BASE            = 16,
     CSV_MISSING_DATA            = 17,
+    CSV_INVALID_EXPRESSION      = 18,
+    CSV_UNKNOWN_COLUMN          = 19,
+    CSV_UNBALANCED_QUOTE        = 20,
+    CSV_FIELD_COUNT_MISMATCH    = 21,
+    CSV_LIMIT_EXCEEDED          = 22,
+    CSV_CANCELLED               = 23,
+    CSV_TYPE_MISMATCH           = 24,
+    CSV_BAD_FORMAT              = 25,
+    CSV_IO_FAIL                 = 26,
     CSV_UNDEFINED               = 999
 } csv_errno;
 
 const char *csv_errno_decode(const csv_errno error);
 
+/*******************************************************************************
+* NAME: CSV_ROLLING_DIRECT
+* DESC: windows up to this length use a vectorizable direct kernel in csv_rolling
+*******************************************************************************/
+#define CSV_ROLLING_DIRECT 8
+
+/*******************************************************************************
+* NAME: CSV_INTCOL_BLOCK
+* DESC: values per frame of reference block of struct csv_intcol
+*******************************************************************************/
+#define CSV_INTCOL_BLOCK 1024
+
+/*******************************************************************************
+* NAME: CSV_TEXTCOL_BLOCK
+* DESC: uncompressed bytes per LZ4 block of struct csv_textcol, a longer cell
+*       gets a block of its own
+*******************************************************************************/
+#define CSV_TEXTCOL_BLOCK 65536
+
+/*******************************************************************************
+* NAME: CSV_TEXTCOL_CACHE
+* DESC: decompressed blocks each thread keeps for csv_textcol_get
+*******************************************************************************/
+#define CSV_TEXTCOL_CACHE 4
+
+/*******************************************************************************
+* NAME: CSV_STR_INLINE
+* DESC: longest string held entirely inside a struct csv_str
+*******************************************************************************/
+#define CSV_STR_INLINE 12
+
+/*******************************************************************************
+* NAME: csv_rolling_op
+* DESC: aggregate computed by csv_rolling over each trailing window
+*******************************************************************************/
+typedef enum
+{
+    CSV_ROLLING_SUM             = 0,
+    CSV_ROLLING_MEAN            = 1,
+    CSV_ROLLING_MIN             = 2,
+    CSV_ROLLING_MAX             = 3
+} csv_rolling_op;
+
+/*******************************************************************************
+* NAME: struct csv_str
+* DESC: 16 byte string cell that answers most comparisons without a pointer
+*       dereference
+* NOTE: inlined holds the whole string zero padded when length is at most
+*       CSV_STR_INLINE, else its first 4 bytes followed by a pointer to the
+*       full string stored with memcpy. Use csv_str_data() to read either.
+* @ length : string length in bytes, excluding the nul terminator
+* @ inlined : the string, or its 4 byte prefix and pointer
+*******************************************************************************/
+struct csv_str
+{
+    uint32_t length;
+    char inlined[CSV_STR_INLINE];
+};
+
+/*******************************************************************************
+* NAME: struct csv_zone
+* DESC: summary of one column over one block of rows
+* NOTE: min and max are only meaningful when the column is numeric
+* NOTE: bloom is only populated when the column is not numeric
+* @ min : smallest value in the block
+* @ max : largest value in the block
+* @ bloom : bloom filter over the raw bytes of each non-missing cell
+* @ present : total non-missing cells in the block
+*******************************************************************************/
+struct csv_zone
+{
+    double min;
+    double max;
+    uint64_t bloom[CSV_ZONE_BLOOM_WORDS];
+    uint64_t present;
+};
+
+/*******************************************************************************
+* NAME: struct csv_zonemap
+* DESC: per-block min/max and bloom filter index used to skip blocks of rows
+* @ block_rows : rows per block, the final block may be shorter
+* @ blocks : total blocks
+* @ numeric : per column flag, true when every non-missing cell is a double
+* @ zones : cols X blocks array, zone of block b in column j at [j][b]
+*******************************************************************************/
+struct csv_zonemap
+{
+    uint32_t block_rows;
+    uint32_t blocks;
+    bool *numeric;
+    struct csv_zone *zones;
+};
+
+/*******************************************************************************
+* NAME: struct csv_count
+* DESC: one distinct value of a column and its number of occurrences
+* @ value : cell contents, points into struct csv and lives as long as it does
+* @ count : total occurrences of value
+*******************************************************************************/
+struct csv_count
+{
+    const char *value;
+    uint64_t count;
+};
+
+/*******************************************************************************
+* NAME: struct csv_quarantine
+* DESC: malformed record skipped by a tolerant csv_read_opts()
+* @ offset : byte offset of the first character of the record
+* @ length : total bytes of the record including its line terminator
+* @ line : 1-based line number of the first character of the record
+* @ fields : total fields found in the record
+* @ reason : CSV_FIELD_COUNT_MISMATCH or CSV_UNBALANCED_QUOTE
+* NOTE: an unbalanced quote is assumed to end the record at the first newline
+*       after it, the following lines are parsed normally
+*******************************************************************************/
+struct csv_quarantine
+{
+    uint64_t offset;
+    uint64_t length;
+    uint64_t line;
+    uint32_t fields;
+    csv_errno reason;
+};
+
+/*******************************************************************************
+* NAME: struct csv_arena
+* DESC: opaque slab allocator, owns all header and cell strings of a struct csv
+*******************************************************************************/
+struct csv_arena;
+
+/*******************************************************************************
+* NAME: struct csv_context
+* DESC: opaque reusable parser state, see csv_context_new()
+*******************************************************************************/
+struct csv_context;
+
 /*******************************************************************************
 * NAME: struct csv
 * DESC: in-memory representation of the entire csv file
@@ -55,8 +241,16 @@ const char *csv_errno_decode(const csv_errno error);
 * @ cols : total columns
 * @ missing : total missing values
 * @ total : total values parsed, including missing values
+* @ quarantined : total malformed records skipped in tolerant mode
+* @ quarantine : quarantined records in file order, null when there are none
+* @ widths : field count of each row, null unless ragged is CSV_RAGGED_KEEP
 * @ header: array of column names, null when header not available
+* @ lookup : open addressing table of header names used by csv_col_index()
 * @ data : rows X cols 3D ragged array. Element is null pointer when missing.
+*          Rows are carved out of row group blocks of CSV_ROW_GROUP_CELLS.
+* @ arena : allocator for the strings, released all at once by csv_free()
+* @ zonemap : optional skip-scan index, null until csv_zonemap_build() is used
+* @ context : owning parser context, null when returned by csv_read()
 *******************************************************************************/
 struct csv
 {
@@ -64,8 +258,164 @@ struct csv
     uint32_t cols;
     uint64_t missing;
     uint64_t total;
+    uint64_t quarantined;
+    struct csv_quarantine *quarantine;
+    uint32_t *widths;
     char **header;
+    uint32_t *lookup;
     char ***data;
+    struct csv_arena *arena;
+    struct csv_zonemap *zonemap;
+    struct csv_context *context;
+};
+
+/*******************************************************************************
+* NAME: csv_ragged
+* DESC: policy for records whose field count differs from the first record
+* NOTE: records that do not fit the policy are errors, or quarantined when the
+*       tolerant option is set
+* @ CSV_RAGGED_ERROR : every record must have exactly as many fields
+* @ CSV_RAGGED_PAD : shorter records are padded with missing fields
+* @ CSV_RAGGED_TRUNCATE : shorter records are padded, longer ones truncated
+* @ CSV_RAGGED_KEEP : cols is the widest record, shorter records are padded and
+*                    the field count of every row is kept in csv->widths
+*******************************************************************************/
+typedef enum
+{
+    CSV_RAGGED_ERROR            = 0,
+    CSV_RAGGED_PAD              = 1,
+    CSV_RAGGED_TRUNCATE         = 2,
+    CSV_RAGGED_KEEP             = 3
+} csv_ragged;
+
+/*******************************************************************************
+* NAME: CSV_PROGRESS_BYTES
+* DESC: default bytes between two calls of the csv_options progress callback
+*******************************************************************************/
+#define CSV_PROGRESS_BYTES 16777216
+
+/*******************************************************************************
+* NAME: struct csv_progress
+* DESC: state of a running parse passed to the csv_options progress callback
+* @ bytes : file offset reached by the current pass
+* @ rows : records scanned by the first pass, rows loaded by the second pass
+* @ pass : 1 while counting rows and columns, 2 while loading the data
+*******************************************************************************/
+struct csv_progress
+{
+    uint64_t bytes;
+    uint64_t rows;
+    uint32_t pass;
+    uint32_t pad;
+};
+
+/*******************************************************************************
+* NAME: csv_progress_fn
+* DESC: progress callback, return false to cancel the parse with CSV_CANCELLED
+* NOTE: a cancelled parse releases all of its memory before returning
+*******************************************************************************/
+typedef bool (*csv_progress_fn)(const struct csv_progress *progress, void *data);
+
+/*******************************************************************************
+* NAME: struct csv_pool
+* DESC: opaque pool of worker threads shared by every parallel entry point
+* NOTE: each worker owns a deque of jobs, idle workers steal from the others,
+*       and a thread waiting on parallel work runs queued jobs meanwhile
+*******************************************************************************/
+struct csv_pool;
+
+/*******************************************************************************
+* NAME: struct csv_pool_options
+* DESC: pool configuration for csv_pool_new(), zero initialized is default
+* @ threads : worker threads, 0 for one per online CPU
+* @ pin : pin each worker to one CPU, Linux only
+* @ numa : deal workers over the NUMA nodes listed in sysfs in turn, so work
+*          stealing prefers workers on the same node. Linux only.
+*******************************************************************************/
+struct csv_pool_options
+{
+    uint32_t threads;
+    bool pin;
+    bool numa;
+    char pad[2];
+};
+
+/*******************************************************************************
+* NAME: csv_task_fn, csv_submit_fn
+* DESC: job entry point, and the submit callback of an external executor which
+*       must eventually call task(arg) on some thread
+*******************************************************************************/
+typedef void (*csv_task_fn)(void *arg);
+typedef void (*csv_submit_fn)(void *executor, csv_task_fn task, void *arg);
+
+/*******************************************************************************
+* NAME: csv_pool_new
+* DESC: start a pool of worker threads
+* OUTP: dynamically allocated pool, if null check error arg for details
+* NOTE: without thread support the pool runs every job on the calling thread
+* @ options : pool configuration, null for the defaults
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_pool *csv_pool_new(const struct csv_pool_options *options, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_pool_external
+* DESC: wrap an application executor so the library submits jobs to it
+* OUTP: dynamically allocated pool, if null check error arg for details
+* NOTE: a thread waiting on parallel work blocks until the executor has run
+*       its jobs, so they must not be deferred until that thread returns
+* @ submit : called once per job
+* @ executor : passed through to submit
+* @ concurrency : parts a parallel call splits its work into, 0 for 1
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_pool *csv_pool_external(csv_submit_fn submit, void *executor, const uint32_t concurrency, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_pool_free
+* DESC: run every queued job, stop the workers and destroy the pool
+* OUTP: none
+* NOTE: must not be called from a job of the same pool
+*******************************************************************************/
+void csv_pool_free(struct csv_pool *pool);
+
+/*******************************************************************************
+* NAME: struct csv_options
+* DESC: parser configuration for csv_read_opts(), zero initialized is default
+* NOTE: parsing is linear in the file size for every input. Memory is linear
+*       too, except that padding ragged rows can grow rows X cols well beyond
+*       the file size, which max_cells bounds for untrusted input.
+* @ progress : called about every progress_bytes of input, null for none
+* @ progress_data : passed through to the progress callback
+* @ progress_bytes : bytes between two progress calls, 0 is CSV_PROGRESS_BYTES
+* @ max_cells : fail with CSV_LIMIT_EXCEEDED if rows X cols is larger, 0 is
+*               unlimited
+* @ max_field : fail with CSV_FIELD_LEN_OVERFLOW if a field has more raw bytes,
+*               checked before any field is stored, 0 is UINT32_MAX
+* @ ragged : policy for records with a different number of fields
+* @ header : true if first row of csv file contains column headers
+* @ no_quotes : hint that the file never contains a double quote. Quote
+*               detection is skipped and '"' is treated as ordinary data.
+* @ tolerant : skip malformed records and list them in csv->quarantine rather
+*              than failing the whole read. The first record is never skipped.
+* @ latency : record latency histograms in the streaming modes, see
+*             csv_parser_latency() and csv_producer_latency()
+* @ pool : pool running csv_read_async() requests, null for the library pool
+*******************************************************************************/
+struct csv_options
+{
+    csv_progress_fn progress;
+    void *progress_data;
+    struct csv_pool *pool;
+    uint64_t progress_bytes;
+    uint64_t max_cells;
+    uint32_t max_field;
+    csv_ragged ragged;
+    bool header;
+    bool no_quotes;
+    bool tolerant;
+    bool latency;
+    char pad[4];
 };
 
 /*******************************************************************************
@@ -78,13 +428,452 @@ struct csv
 *******************************************************************************/
 struct csv *csv_read(const char * const filename, const bool header, csv_errno *error);
 
+/*******************************************************************************
+* NAME: csv_read_opts
+* DESC: same as csv_read() with the full set of parser options
+* OUTP: dynamically allocated struct csv, if null check error arg for details
+* NOTE: blocks without double quotes are parsed by a faster delimiter and
+*       newline only kernel, falling back per block when a quote appears
+* NOTE: a blank line at the very end of the file is ignored where its field
+*       count would otherwise fail the read
+* @ filename : csv filename
+* @ options : parser configuration, null for the defaults
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv *csv_read_opts(const char * const filename, const struct csv_options *options, csv_errno *error);
+
 /*******************************************************************************
 * NAME: csv_free
 * DESC: destroy struct csv and free all dynamically allocated memory
 * OUTP: none
+* NOTE: a struct csv owned by a context is reset with csv_context_reset()
 *******************************************************************************/
 void csv_free(struct csv *csv);
 
+/*******************************************************************************
+* NAME: csv_context_new
+* DESC: create a parser context for reading many small files in a row
+* OUTP: dynamically allocated context, if null check error arg for details
+* NOTE: the context keeps its block buffer and arena slabs between parses, so a
+*       warm context parses files of a similar size without calling malloc
+* @ options : parser configuration used by every parse, null for the defaults
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_context *csv_context_new(const struct csv_options *options, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_context_read[_mem]
+* DESC: same as csv_read_opts() for a file or for length bytes held in memory
+* OUTP: struct csv owned by the context, if null check error arg for details
+* NOTE: the result stays valid until the next read, reset or free of the
+*       context. Cells are copied into the context, so memory input may be
+*       released as soon as the call returns.
+* @ context : parser context
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv *csv_context_read(struct csv_context *context, const char * const filename, csv_errno *error);
+struct csv *csv_context_read_mem(struct csv_context *context, const char *bytes, const size_t length, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_context_reset
+* DESC: release the current result of the context but keep its capacity
+* OUTP: none
+*******************************************************************************/
+void csv_context_reset(struct csv_context *context);
+
+/*******************************************************************************
+* NAME: csv_context_free
+* DESC: destroy the context, its current result and all retained capacity
+* OUTP: none
+*******************************************************************************/
+void csv_context_free(struct csv_context *context);
+
+/*******************************************************************************
+* NAME: CSV_ASYNC_THREADS
+* DESC: worker threads of the library pool serving csv_read_async()
+*******************************************************************************/
+#define CSV_ASYNC_THREADS 2
+
+/*******************************************************************************
+* NAME: struct csv_async
+* DESC: opaque handle of a csv_read_async() request
+*******************************************************************************/
+struct csv_async;
+
+/*******************************************************************************
+* NAME: csv_async_fn
+* DESC: completion callback, runs on the worker thread once the read is done
+* NOTE: collect the result with csv_async_wait(), which does not block there
+*******************************************************************************/
+typedef void (*csv_async_fn)(struct csv_async *async, void *data);
+
+/*******************************************************************************
+* NAME: csv_async_configure
+* DESC: replace the library pool serving csv_read_async() without options->pool
+* OUTP: false if the new pool could not be started
+* NOTE: waits for the requests queued on the old pool, so it must not be
+*       called from a completion callback
+* @ threads : total worker threads, 0 for CSV_ASYNC_THREADS
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_async_configure(const uint32_t threads, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_read_async
+* DESC: same as csv_read_opts() on a worker of options->pool or the library pool
+* OUTP: request handle, null if the request could not be queued
+* NOTE: every handle must be collected exactly once with csv_async_wait(),
+*       either from on_done or after csv_async_fd() becomes readable
+* NOTE: without thread support the read runs before this function returns
+* @ filename : csv filename, copied
+* @ options : parser configuration, copied, null for the defaults
+* @ on_done : completion callback, null for none
+* @ data : passed through to on_done
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_async *csv_read_async(const char * const filename, const struct csv_options *options, csv_async_fn on_done, void *data, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_async_fd
+* DESC: descriptor that becomes readable when the request completes
+* OUTP: eventfd on Linux, read end of a pipe on other POSIX systems, -1 if
+*       there is no thread support
+* NOTE: valid until csv_async_wait(), reading it is optional
+*******************************************************************************/
+int csv_async_fd(const struct csv_async *async);
+
+/*******************************************************************************
+* NAME: csv_async_done
+* DESC: poll a request without blocking
+* OUTP: true once csv_async_wait() would return immediately
+*******************************************************************************/
+bool csv_async_done(struct csv_async *async);
+
+/*******************************************************************************
+* NAME: csv_async_wait
+* DESC: wait for a request to complete, then release the handle
+* OUTP: struct csv of the read, owned by the caller, if null check error arg
+* @ error : contains the error code of the read on return if not null
+*******************************************************************************/
+struct csv *csv_async_wait(struct csv_async *async, csv_errno *error);
+
+/*******************************************************************************
+* NAME: CSV_PUMP_READS
+* DESC: most reads csv_parser_pump() makes before it yields with CSV_PUMP_MORE,
+*       so one busy stream cannot starve the others served by the same thread
+*******************************************************************************/
+#define CSV_PUMP_READS 16
+
+/*******************************************************************************
+* NAME: csv_pump
+* DESC: outcome of csv_parser_pump()
+* @ CSV_PUMP_AGAIN : the descriptor would block, pump again once it is readable
+* @ CSV_PUMP_MORE : the read budget ran out, more input may be ready right away
+* @ CSV_PUMP_EOF : end of stream, every record has been delivered
+* @ CSV_PUMP_ERROR : the stream failed, see the error arg, the parser is dead
+*******************************************************************************/
+typedef enum
+{
+    CSV_PUMP_AGAIN              = 0,
+    CSV_PUMP_MORE               = 1,
+    CSV_PUMP_EOF                = 2,
+    CSV_PUMP_ERROR              = 3
+} csv_pump;
+
+/*******************************************************************************
+* NAME: struct csv_parser
+* DESC: opaque push parser that consumes a stream in chunks of any size
+* NOTE: nothing is ever read twice or rewound, so it works on sockets and pipes
+*******************************************************************************/
+struct csv_parser;
+
+/*******************************************************************************
+* NAME: csv_record_fn
+* DESC: record callback of a push parser, return false to cancel the stream
+*       with CSV_CANCELLED
+* NOTE: fields and their strings are only valid during the call
+* @ fields : nul terminated fields, missing fields are empty strings
+* @ n : number of fields, the column count unless ragged is CSV_RAGGED_KEEP
+* @ row : zero based index of the record, not counting the header
+*******************************************************************************/
+typedef bool (*csv_record_fn)(char **fields, const uint32_t n, const uint64_t row, void *data);
+
+/*******************************************************************************
+* NAME: struct csv_parser_stats
+* DESC: counters of a push parser
+* @ bytes : input consumed so far
+* @ records : records delivered to the callback
+* @ skipped : malformed records skipped in tolerant mode
+*******************************************************************************/
+struct csv_parser_stats
+{
+    uint64_t bytes;
+    uint64_t records;
+    uint64_t skipped;
+};
+
+/*******************************************************************************
+* NAME: CSV_LATENCY_BUCKETS
+* DESC: buckets of a latency histogram. Values below 64 ns are exact, above that
+*       every power of two is split into 32 buckets, about 3% relative error,
+*       up to 2^47 ns where the last bucket collects everything larger.
+*******************************************************************************/
+#define CSV_LATENCY_BUCKETS 1408
+
+/*******************************************************************************
+* NAME: csv_latency_kind
+* DESC: latencies recorded by the streaming modes with the latency option
+* @ CSV_LATENCY_PARSE : parser time per fed chunk, or per batch of a producer,
+*                       without time spent in callbacks or waiting for batches
+* @ CSV_LATENCY_WAIT : time a published batch waits in the queue until a
+*                      consumer takes it, producer only
+* @ CSV_LATENCY_CALLBACK : time per record callback, or per batch from
+*                          csv_consume() to csv_recycle() for a producer
+*******************************************************************************/
+typedef enum
+{
+    CSV_LATENCY_PARSE           = 0,
+    CSV_LATENCY_WAIT            = 1,
+    CSV_LATENCY_CALLBACK        = 2
+} csv_latency_kind;
+
+/*******************************************************************************
+* NAME: struct csv_latency
+* DESC: HDR style log linear histogram of latencies in nanoseconds
+* @ count : recorded values
+* @ min : smallest value, UINT64_MAX when empty
+* @ max : largest value
+* @ sum : sum of all values
+* @ buckets : counts per bucket
+*******************************************************************************/
+struct csv_latency
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[CSV_LATENCY_BUCKETS];
+};
+
+/*******************************************************************************
+* NAME: csv_latency_percentile
+* DESC: value at or below which the given percentage of recorded values lie
+* OUTP: highest value of the matching bucket, clamped to max, 0 when empty
+* @ percentile : between 0 and 100, such as 50, 99 or 99.9
+*******************************************************************************/
+uint64_t csv_latency_percentile(const struct csv_latency *latency, const double percentile);
+
+/*******************************************************************************
+* NAME: csv_parser_new
+* DESC: create a push parser that delivers each complete record to on_record
+* OUTP: dynamically allocated parser, if null check error arg for details
+* NOTE: the column count is taken from the first record. The ragged, tolerant,
+*       header, no_quotes, max_field and progress options apply as they do
+*       for csv_read_opts(), with rows counting delivered records.
+* @ options : parser configuration, copied, null for the defaults
+* @ on_record : record callback
+* @ data : passed through to on_record
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_parser *csv_parser_new(const struct csv_options *options, csv_record_fn on_record, void *data, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_parser_pump
+* DESC: read whatever a non-blocking descriptor has available and parse it
+* OUTP: CSV_PUMP_AGAIN when fd would block, see csv_pump for the others
+* NOTE: fd should have O_NONBLOCK set, a blocking fd simply blocks in read().
+*       POSIX only, elsewhere this fails with CSV_READ_FAIL.
+* @ error : contains error code on return if not null
+*******************************************************************************/
+csv_pump csv_parser_pump(struct csv_parser *parser, const int fd, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_parser_feed
+* DESC: parse length bytes from a caller owned buffer, for input that does not
+*       come from a plain descriptor
+* OUTP: false on error, after which the parser is dead
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_parser_feed(struct csv_parser *parser, const char *bytes, const size_t length, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_parser_finish
+* DESC: signal end of input and deliver a final record without a newline
+* OUTP: false on error, such as a quote that was never closed
+* NOTE: csv_parser_pump() calls it itself when the descriptor reaches EOF
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_parser_finish(struct csv_parser *parser, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_parser_header
+* DESC: column names of a parser created with the header option
+* OUTP: null until the first record has been parsed or without the option
+* @ n : receives the number of column names if not null
+*******************************************************************************/
+char **csv_parser_header(const struct csv_parser *parser, uint32_t *n);
+
+/*******************************************************************************
+* NAME: csv_parser_stats
+* DESC: copy the counters of a parser into stats
+* OUTP: false if either pointer is null
+*******************************************************************************/
+bool csv_parser_stats(const struct csv_parser *parser, struct csv_parser_stats *stats);
+
+/*******************************************************************************
+* NAME: csv_parser_latency
+* DESC: copy one latency histogram of a parser created with the latency option
+* OUTP: false on null input, or CSV_PARAM_OUT_OF_BOUNDS without the option
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_parser_latency(const struct csv_parser *parser, const csv_latency_kind kind, struct csv_latency *latency, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_parser_free
+* DESC: destroy the parser, it does not close any descriptor
+* OUTP: none
+*******************************************************************************/
+void csv_parser_free(struct csv_parser *parser);
+
+/*******************************************************************************
+* NAME: CSV_BATCH_ROWS, CSV_BATCH_DEPTH
+* DESC: default rows per batch and batches in flight of a struct csv_producer
+*******************************************************************************/
+#define CSV_BATCH_ROWS 1024
+#define CSV_BATCH_DEPTH 16
+
+/*******************************************************************************
+* NAME: struct csv_rows
+* DESC: batch of consecutive records published by a struct csv_producer
+* @ first : index of the first record of the batch in the stream
+* @ count : records in the batch
+* @ cols : column count of the stream
+* @ data : count rows of nul terminated fields, missing fields are empty
+* @ widths : field count of each row, cols unless ragged is CSV_RAGGED_KEEP
+* @ arena : allocator for the strings, reused once the batch is recycled
+*******************************************************************************/
+struct csv_rows
+{
+    uint64_t first;
+    uint32_t count;
+    uint32_t cols;
+    char ***data;
+    uint32_t *widths;
+    struct csv_arena *arena;
+};
+
+/*******************************************************************************
+* NAME: struct csv_producer
+* DESC: opaque fan-out of one parsed stream to many consumer threads
+* NOTE: full batches travel through a bounded lock-free MPMC queue and come
+*       back through a second one used as free list, so at most depth batches
+*       ever exist and the parser waits while every batch is in use
+*******************************************************************************/
+struct csv_producer;
+
+/*******************************************************************************
+* NAME: csv_producer_new
+* DESC: create a producer, consumers may call csv_consume() right away
+* OUTP: dynamically allocated producer, if null check error arg for details
+* NOTE: needs thread support, otherwise fails with CSV_UNKNOWN_FATAL_ERROR
+* @ options : parser configuration, see csv_parser_new()
+* @ batch_rows : records per batch, 0 for CSV_BATCH_ROWS
+* @ depth : batches in flight, 0 for CSV_BATCH_DEPTH
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_producer *csv_producer_new(const struct csv_options *options, const uint32_t batch_rows, const uint32_t depth, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_produce
+* DESC: parse a file on the calling thread and publish it in batches
+* OUTP: false if the stream failed, consumers see the same error at the end
+* NOTE: call once per producer, the queue is closed when it returns
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_produce(struct csv_producer *producer, const char * const filename, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_consume
+* DESC: take the next batch, waiting until one is published
+* OUTP: batch to hand back with csv_recycle(), or null once the stream is over
+* @ error : on null return, CSV_SUCCESS at the end of a complete stream or the
+*           error of the stream
+*******************************************************************************/
+struct csv_rows *csv_consume(struct csv_producer *producer, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_recycle
+* DESC: hand a consumed batch back to the producer for reuse
+* OUTP: none
+*******************************************************************************/
+void csv_recycle(struct csv_producer *producer, struct csv_rows *rows);
+
+/*******************************************************************************
+* NAME: csv_producer_header
+* DESC: column names when the header option is set
+* OUTP: null without the option, valid once the first batch is consumed
+* @ n : receives the number of column names if not null
+*******************************************************************************/
+char **csv_producer_header(const struct csv_producer *producer, uint32_t *n);
+
+/*******************************************************************************
+* NAME: csv_producer_latency
+* DESC: same as csv_parser_latency() for a producer
+* NOTE: safe to call while the stream is running, each counter is read
+*       atomically but the histogram as a whole is not a single snapshot
+*******************************************************************************/
+bool csv_producer_latency(const struct csv_producer *producer, const csv_latency_kind kind, struct csv_latency *latency, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_producer_cancel
+* DESC: stop the stream early, csv_produce() then fails with CSV_CANCELLED
+* OUTP: none
+* NOTE: consumers that stop before the end must cancel, or the producer waits
+*       for their batches forever
+*******************************************************************************/
+void csv_producer_cancel(struct csv_producer *producer);
+
+/*******************************************************************************
+* NAME: csv_producer_free
+* DESC: destroy the producer and every batch, including unrecycled ones
+* OUTP: none
+* NOTE: call after csv_produce() has returned and all consumers are done
+*******************************************************************************/
+void csv_producer_free(struct csv_producer *producer);
+
+/*******************************************************************************
+* NAME: struct csv_memory
+* DESC: bytes held by a struct csv, broken down by category
+* @ cells : cell strings including their nul terminators
+* @ pointers : row array, row group cell pointers and csv->widths
+* @ header : header array and column name strings
+* @ indexes : name lookup table, zone map and quarantine list
+* @ caches : capacity a context keeps for the next parse, zero without context
+* @ overhead : estimated allocator headers, unused arena space and the structs
+* @ total : sum of every category above
+*******************************************************************************/
+struct csv_memory
+{
+    uint64_t cells;
+    uint64_t pointers;
+    uint64_t header;
+    uint64_t indexes;
+    uint64_t caches;
+    uint64_t overhead;
+    uint64_t total;
+};
+
+/*******************************************************************************
+* NAME: csv_memory_usage
+* DESC: report the memory held by a struct csv
+* OUTP: true on success, the report is written to usage
+* NOTE: computed from the dimensions and the arena slabs in O(cols) time, so it
+*       is cheap enough to call before every admission decision
+* @ usage : caller allocated report
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_memory_usage(const struct csv *csv, struct csv_memory *usage, csv_errno *error);
+
 /*******************************************************************************
 * NAME: csv_row[*]
 * DESC: return row i as a dynamically allocated array of the wildcard type
@@ -107,4 +896,413 @@ long *csv_coll(struct csv *csv, const uint32_t j, const int base, csv_errno *err
 char *csv_colc(struct csv *csv, const uint32_t j, csv_errno *error);
 double *csv_cold(struct csv *csv, const uint32_t j, csv_errno *error);
 
+/*******************************************************************************
+* NAME: csv_col_index
+* DESC: resolve a header name to its column index in O(1) expected time
+* OUTP: column index, or UINT32_MAX if not found
+* NOTE: duplicate header names resolve to the leftmost column
+* @ name : nul-terminated column name
+* @ error : contains error code on return if not null
+*******************************************************************************/
+uint32_t csv_col_index(const struct csv *csv, const char *name, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_col[*]_by_name
+* DESC: same as csv_col[*] with the column resolved through csv_col_index()
+* OUTP: null if the name is unknown or if any cell cannot be transformed
+* NOTE: user responsibility to free returned array
+* @ error : contains error code on return if not null
+*******************************************************************************/
+long *csv_coll_by_name(struct csv *csv, const char *name, const int base, csv_errno *error);
+char *csv_colc_by_name(struct csv *csv, const char *name, csv_errno *error);
+double *csv_cold_by_name(struct csv *csv, const char *name, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_zonemap_build
+* DESC: summarize every column over blocks of rows for skip-scanning
+* OUTP: true on success, the zone map is attached to csv->zonemap
+* NOTE: replaces any existing zone map, rebuild after modifying csv->data
+* @ block_rows : rows per block, use 0 for CSV_ZONE_BLOCK_ROWS
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_zonemap_build(struct csv *csv, const uint32_t block_rows, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_zone_excludes[*]
+* DESC: test if block b of column j cannot contain a matching value
+* OUTP: true if the block can be skipped, false if it must be scanned
+* NOTE: always false when no zone map is attached or arguments are out of range,
+*       and csv_zone_excludes_str() is always false for the empty string
+* @ lo : lower inclusive bound of the numeric range
+* @ hi : upper inclusive bound of the numeric range
+* @ value : nul-terminated string compared for byte equality
+*******************************************************************************/
+bool csv_zone_excludes(const struct csv *csv, const uint32_t b, const uint32_t j, const double lo, const double hi);
+bool csv_zone_excludes_str(const struct csv *csv, const uint32_t b, const uint32_t j, const char *value);
+
+/*******************************************************************************
+* NAME: csv_filter
+* DESC: evaluate a predicate over all rows and return the matching row indices
+* OUTP: dynamically allocated selection vector in ascending row order
+* NOTE: user responsibility to free returned array
+* NOTE: expr is one or more comparisons joined by "and", such as
+*       col3 > 100 and col7 == 'EU'
+* NOTE: a column is a header name, a "quoted" header name, or $j for index j
+* NOTE: operators are ==, !=, <, <=, >, >=
+* NOTE: numeric literals compare as doubles, missing or non-numeric cells never
+*       match. 'quoted' literals compare with strcmp, missing cells are "".
+* NOTE: blocks are skipped using csv->zonemap when it is available
+* @ n : contains total selected rows on return
+* @ error : contains error code on return if not null
+*******************************************************************************/
+uint32_t *csv_filter(struct csv *csv, const char *expr, uint32_t *n, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_sel[*]
+* DESC: return col j of the selected rows as an array of the wildcard type
+* OUTP: null if failure to transform any cell to the requested type
+* NOTE: user responsibility to free returned array
+* @ sel : row indices, usually a selection vector returned by csv_filter
+* @ n : total row indices in sel
+* @ error : contains error code on return if not null
+*******************************************************************************/
+long *csv_sell(struct csv *csv, const uint32_t j, const uint32_t *sel, const uint32_t n, const int base, csv_errno *error);
+char *csv_selc(struct csv *csv, const uint32_t j, const uint32_t *sel, const uint32_t n, csv_errno *error);
+double *csv_seld(struct csv *csv, const uint32_t j, const uint32_t *sel, const uint32_t n, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_value_counts
+* DESC: count the occurrences of each distinct non-missing value in col j
+* OUTP: dynamically allocated array ordered by descending count, ties by value
+* NOTE: user responsibility to free returned array
+* @ top_n : maximum number of values returned, use 0 for all of them
+* @ pool : pool counting row ranges in parallel, null for serial
+* @ n : contains total values returned
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_count *csv_value_counts(struct csv *csv, const uint32_t j, const uint32_t top_n, struct csv_pool *pool, uint32_t *n, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_distinct
+* DESC: count the distinct non-missing values in col j
+* OUTP: exact count, or a HyperLogLog estimate within about 1% when not exact
+* NOTE: the estimate needs 16 KiB per thread regardless of column cardinality
+* @ exact : false to estimate, preferable for very high cardinality columns
+* @ pool : pool counting row ranges in parallel, null for serial
+* @ error : contains error code on return if not null
+*******************************************************************************/
+uint64_t csv_distinct(struct csv *csv, const uint32_t j, const bool exact, struct csv_pool *pool, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_rolling
+* DESC: aggregate each trailing window of values, such as a csv_cold column
+* OUTP: true on success, out[i] covers values[i - window + 1] to values[i]
+* NOTE: runs in O(n) regardless of the window length
+* NOTE: out[i] is NaN for the first window - 1 elements
+* NOTE: NaN values propagate to sums and means but are ignored by min and max
+* NOTE: out must have space for n doubles and must not overlap values
+* @ values : input sequence in time order
+* @ n : total elements in values and out
+* @ window : total elements in each window, at least 1
+* @ op : aggregate computed over each window
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_rolling(const double *values, const uint32_t n, const uint32_t window, const csv_rolling_op op, double *out, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_histogram
+* DESC: parse and bin col j in one pass without materializing a double array
+* OUTP: dynamically allocated array of bins counts, null on failure
+* NOTE: user responsibility to free returned array
+* NOTE: bins are equal width over [lo, hi], values equal to hi go in the last bin
+* NOTE: missing cells and values outside [lo, hi] are not counted
+* NOTE: blocks outside [lo, hi] are skipped using csv->zonemap when available
+* @ bins : total bins, at least 1
+* @ lo : lower inclusive bound of the first bin
+* @ hi : upper inclusive bound of the last bin, must exceed lo
+* @ pool : pool binning row ranges in parallel, null for serial
+* @ error : contains error code on return if not null
+*******************************************************************************/
+uint64_t *csv_histogram(struct csv *csv, const uint32_t j, const uint32_t bins, const double lo, const double hi, struct csv_pool *pool, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_type
+* DESC: column types of a columnar file
+* @ CSV_TYPE_AUTO : long if every present cell converts with base 10, else
+*                   double if every present cell converts, else string
+* @ CSV_TYPE_STRING : text, missing cells are empty strings
+* @ CSV_TYPE_LONG : base 10 integers as converted by csv_coll()
+* @ CSV_TYPE_DOUBLE : floating point as converted by csv_cold()
+*******************************************************************************/
+typedef enum
+{
+    CSV_TYPE_AUTO               = 0,
+    CSV_TYPE_STRING             = 1,
+    CSV_TYPE_LONG               = 2,
+    CSV_TYPE_DOUBLE             = 3
+} csv_type;
+
+/*******************************************************************************
+* NAME: csv_write_columnar
+* DESC: write struct csv to a compact columnar file with typed columns
+* OUTP: true on success, if false check error arg for details
+* NOTE: each column is stored with whichever of plain, bit packing with a frame
+*       of reference, delta, run length or dictionary encoding is smallest.
+*       A footer directory lets a reader find any column without touching the
+*       others. Files are little endian whatever the host.
+* NOTE: fails with CSV_TYPE_MISMATCH if a cell does not convert to the type
+*       requested for its column, and with CSV_IO_FAIL if the file cannot be
+*       written in full, in which case it is removed
+* @ schema : csv->cols column types, null to infer every column
+* @ filename : output file, replaced if it exists
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_write_columnar(struct csv *csv, const csv_type *schema, const char * const filename, csv_errno *error);
+
+/*******************************************************************************
+* NAME: struct csv_columnar
+* DESC: opaque columnar file opened for reading
+*******************************************************************************/
+struct csv_columnar;
+
+/*******************************************************************************
+* NAME: csv_columnar_open
+* DESC: map a file written by csv_write_columnar() and read its directory
+* OUTP: dynamically allocated reader, if null check error arg for details
+* NOTE: the file is mapped on POSIX systems, so only the pages of the columns
+*       that are decoded are ever read. Elsewhere it is read into memory.
+* NOTE: fails with CSV_BAD_FORMAT if the file is damaged or not columnar
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_columnar *csv_columnar_open(const char * const filename, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_columnar_close
+* DESC: unmap the file, strings returned by csv_columnar_str() become invalid
+* OUTP: none
+*******************************************************************************/
+void csv_columnar_close(struct csv_columnar *columnar);
+
+/*******************************************************************************
+* NAME: csv_columnar_dims, csv_columnar_header, csv_columnar_type
+* DESC: rows and cols, column names or null if the csv had no header, and the
+*       stored type of col j, CSV_TYPE_AUTO if j is out of bounds
+*******************************************************************************/
+bool csv_columnar_dims(const struct csv_columnar *columnar, uint32_t *rows, uint32_t *cols);
+char **csv_columnar_header(const struct csv_columnar *columnar);
+csv_type csv_columnar_type(const struct csv_columnar *columnar, const uint32_t j);
+
+/*******************************************************************************
+* NAME: csv_columnar_[long|double|str]
+* DESC: decode col j into an array of rows values
+* OUTP: dynamically allocated array, null on failure
+* NOTE: user responsibility to free returned array
+* NOTE: long needs a CSV_TYPE_LONG column, double accepts long and double
+*       columns, str needs a CSV_TYPE_STRING column, else CSV_TYPE_MISMATCH
+* NOTE: missing numbers decode as 0, see csv_columnar_missing(). Strings point
+*       into the file mapping and stay valid until csv_columnar_close().
+* @ error : contains error code on return if not null
+*******************************************************************************/
+long *csv_columnar_long(struct csv_columnar *columnar, const uint32_t j, csv_errno *error);
+double *csv_columnar_double(struct csv_columnar *columnar, const uint32_t j, csv_errno *error);
+char **csv_columnar_str(struct csv_columnar *columnar, const uint32_t j, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_columnar_missing
+* DESC: true if cell [i][j] was missing in the csv
+* NOTE: missing strings are stored as empty strings, so for string columns this
+*       is only true if i and j are in bounds and the column was written empty
+*******************************************************************************/
+bool csv_columnar_missing(const struct csv_columnar *columnar, const uint32_t i, const uint32_t j);
+
+/*******************************************************************************
+* NAME: struct csv_intcol
+* DESC: opaque in-memory integer column, frame of reference plus bit packing
+* NOTE: every CSV_INTCOL_BLOCK values store their minimum once and the rest as
+*       offsets of just enough bits for the block's range, so ids spanning 16
+*       bits take a quarter of the memory of a long array. Blocks whose range
+*       needs more than 32 bits are kept unpacked.
+*******************************************************************************/
+struct csv_intcol;
+
+/*******************************************************************************
+* NAME: csv_intcol_new, csv_coll_packed
+* DESC: pack an array of n longs, or col j converted as csv_coll() would
+* OUTP: dynamically allocated column, if null check error arg for details
+* NOTE: csv_coll_packed converts a block at a time and never holds the whole
+*       column as longs
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_intcol *csv_intcol_new(const long *values, const uint32_t n, csv_errno *error);
+struct csv_intcol *csv_coll_packed(struct csv *csv, const uint32_t j, const int base, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_intcol_free
+* DESC: free the column
+* OUTP: none
+*******************************************************************************/
+void csv_intcol_free(struct csv_intcol *col);
+
+/*******************************************************************************
+* NAME: csv_intcol_length, csv_intcol_bytes, csv_intcol_get
+* DESC: total values, bytes held by the column, and value i
+* NOTE: csv_intcol_get returns 0 if col is null or i is out of bounds
+*******************************************************************************/
+uint32_t csv_intcol_length(const struct csv_intcol *col);
+size_t csv_intcol_bytes(const struct csv_intcol *col);
+long csv_intcol_get(const struct csv_intcol *col, const uint32_t i);
+
+/*******************************************************************************
+* NAME: csv_intcol_unpack
+* DESC: decode values [first, first + n) into out
+* OUTP: true on success, if false check error arg for details
+* @ out : caller allocated array of at least n longs
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_intcol_unpack(const struct csv_intcol *col, const uint32_t first, const uint32_t n, long *out, csv_errno *error);
+
+/*******************************************************************************
+* NAME: struct csv_intcol_summary
+* DESC: aggregates computed by csv_intcol_summarize
+* @ count : total values aggregated
+* @ min : smallest value, 0 if count is 0
+* @ max : largest value, 0 if count is 0
+* @ sum : sum of the values, in double precision to avoid overflow
+*******************************************************************************/
+struct csv_intcol_summary
+{
+    uint64_t count;
+    long min;
+    long max;
+    double sum;
+};
+
+/*******************************************************************************
+* NAME: csv_intcol_summarize
+* DESC: count, min, max and sum over all values or over the rows in sel
+* OUTP: true on success, if false check error arg for details
+* NOTE: without sel, min and max come from the block headers and the sum adds
+*       packed offsets without decoding values
+* @ sel : row indices such as returned by csv_intcol_filter, null for all
+* @ n : total row indices in sel, ignored if sel is null
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_intcol_summarize(const struct csv_intcol *col, const uint32_t *sel, const uint32_t n, struct csv_intcol_summary *summary, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_intcol_filter
+* DESC: return the indices of the values v with lo <= v <= hi
+* OUTP: dynamically allocated selection vector in ascending row order
+* NOTE: user responsibility to free returned array
+* NOTE: blocks entirely outside or inside the range are decided from their
+*       header, the rest compare packed offsets against the range moved by the
+*       block minimum
+* @ n : contains total selected rows on return
+* @ error : contains error code on return if not null
+*******************************************************************************/
+uint32_t *csv_intcol_filter(const struct csv_intcol *col, const long lo, const long hi, uint32_t *n, csv_errno *error);
+
+/*******************************************************************************
+* NAME: struct csv_textcol
+* DESC: opaque in-memory string column stored as LZ4 compressed blocks
+* NOTE: meant for large, rarely read text such as comments or user agents.
+*       The column keeps no reference to the csv, so a table can be held as
+*       compressed text columns next to plain numeric ones after csv_free().
+*******************************************************************************/
+struct csv_textcol;
+
+/*******************************************************************************
+* NAME: csv_textcol_new, csv_col_compressed
+* DESC: compress n nul terminated strings, or the cells of col j
+* OUTP: dynamically allocated column, if null check error arg for details
+* NOTE: blocks that do not shrink are kept uncompressed
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_textcol *csv_textcol_new(const char * const *strings, const uint32_t n, csv_errno *error);
+struct csv_textcol *csv_col_compressed(struct csv *csv, const uint32_t j, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_textcol_free
+* DESC: free the column
+* OUTP: none
+*******************************************************************************/
+void csv_textcol_free(struct csv_textcol *col);
+
+/*******************************************************************************
+* NAME: csv_textcol_length, csv_textcol_bytes
+* DESC: total strings and bytes held by the column, excluding thread caches
+*******************************************************************************/
+uint32_t csv_textcol_length(const struct csv_textcol *col);
+size_t csv_textcol_bytes(const struct csv_textcol *col);
+
+/*******************************************************************************
+* NAME: csv_textcol_get
+* DESC: string i, decompressing its block into the calling thread's cache
+* OUTP: nul terminated string, if null check error arg for details
+* NOTE: each thread caches its CSV_TEXTCOL_CACHE most recent blocks, so nearby
+*       cells are served without decompressing again. The string stays valid
+*       until the same thread calls csv_textcol_get again, copy it to keep it.
+* NOTE: safe to call from several threads on the same column
+* @ error : contains error code on return if not null
+*******************************************************************************/
+const char *csv_textcol_get(const struct csv_textcol *col, const uint32_t i, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_cols
+* DESC: return col j as an array of prefix inlined string cells
+* OUTP: dynamically allocated array of rows cells, null on failure
+* NOTE: user responsibility to free returned array
+* NOTE: cells longer than CSV_STR_INLINE point into csv and are valid until
+*       csv_free()
+* @ error : contains error code on return if not null
+*******************************************************************************/
+struct csv_str *csv_cols(struct csv *csv, const uint32_t j, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_str_from
+* DESC: make a cell from a nul terminated string, for example a literal to
+*       compare a column against
+* OUTP: true on success, if false check error arg for details
+* NOTE: a string longer than CSV_STR_INLINE is referenced, not copied
+* @ error : contains error code on return if not null
+*******************************************************************************/
+bool csv_str_from(const char *string, struct csv_str *out, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_str_data
+* DESC: bytes of the string, length bytes long
+* NOTE: nul terminated except for an inlined string of exactly
+*       CSV_STR_INLINE bytes
+*******************************************************************************/
+const char *csv_str_data(const struct csv_str *s);
+
+/*******************************************************************************
+* NAME: csv_str_eq, csv_str_cmp
+* DESC: equality, and ordering with the sign convention of strcmp
+* NOTE: length and prefix are compared first, which settles most unequal
+*       pairs and every pair of inlined strings from the cells alone
+*******************************************************************************/
+bool csv_str_eq(const struct csv_str *a, const struct csv_str *b);
+int csv_str_cmp(const struct csv_str *a, const struct csv_str *b);
+
+/*******************************************************************************
+* NAME: csv_str_order
+* DESC: return the indices of cells in ascending string order
+* OUTP: dynamically allocated array of n indices, null on failure
+* NOTE: user responsibility to free returned array
+* NOTE: equal strings keep their original relative order
+* @ error : contains error code on return if not null
+*******************************************************************************/
+uint32_t *csv_str_order(const struct csv_str *cells, const uint32_t n, csv_errno *error);
+
+/*******************************************************************************
+* NAME: csv_str_select
+* DESC: return the indices of the cells equal to value
+* OUTP: dynamically allocated selection vector in ascending order
+* NOTE: user responsibility to free returned array
+* @ count : contains total selected cells on return
+* @ error : contains error code on return if not null
+*******************************************************************************/
+uint32_t *csv_str_select(const struct csv_str *cells, const uint32_t n, const struct csv_str *value, uint32_t *count, csv_errno *error);
+
 #endif